@@ -78,11 +78,16 @@ int main(int argc, char **argv)
 	zdl_flags_t flags = ZDL_FLAG_NONE;
 	ZDL::Window *window = new ZDL::Window(320, 240, flags);
 	FPSTracker tracker;
+	static const unsigned int rates[] = { 0, 60, 144 };
+	unsigned int rate = 0;
+	int queue = 0;
+	int capture = 0;
 	int done = 0;
 	int w, h;
 	int fps;
 
 	window->setTitle(argv[0]);
+	window->setMaxFramesInFlight(2);
 	window->getSize(&w, &h);
 	glViewport(0, 0, w, h);
 
@@ -107,6 +112,29 @@ int main(int argc, char **argv)
 					window->getSize(&w, &h);
 					glViewport(0, 0, w, h);
 					break;
+				case ZDL_KEYSYM_T: {
+					struct zdl_frame_stats stats;
+					window->getFrameStats(&stats);
+					fprintf(stderr, "\rframe time: mean %u p50 %u p90 %u p99 %u max %u wait %u (us)\n",
+							stats.mean, stats.p50, stats.p90, stats.p99, stats.max, stats.wait);
+					rate = (rate + 1) % (sizeof(rates) / sizeof(rates[0]));
+					fprintf(stderr, "\rtarget rate: %u\n", rates[rate]);
+					window->setTargetRate(rates[rate]);
+					} break;
+				case ZDL_KEYSYM_A:
+					queue = !queue;
+					if (window->setSwapQueue(queue ? 2 : 0) != 0)
+						queue = 0;
+					fprintf(stderr, "\rasync swap: %sabled\n", queue ? "en" : "dis");
+					break;
+				case ZDL_KEYSYM_C:
+					capture = !capture;
+					if (!capture)
+						window->captureEnd();
+					else if (window->captureBegin(ZDL_PIXEL_RGBA8888) != 0)
+						capture = 0;
+					fprintf(stderr, "\rcapture: %sabled\n", capture ? "en" : "dis");
+					break;
 				case ZDL_KEYSYM_ESCAPE:
 				case ZDL_KEYSYM_Q:
 					fprintf(stderr, "\rexiting");
@@ -152,6 +180,8 @@ int main(int argc, char **argv)
 			}
 		}
 
+		/* with a swap queue, swap() blocks while the queue is full rather
+		 * than this loop spinning on swapReady() */
 		glClearColor(0.0,0.0,0.0,0.0);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -178,6 +208,13 @@ int main(int argc, char **argv)
 		glEnd();
 
 		window->swap();
+		if (capture) {
+			struct zdl_capture_frame frame;
+			while (window->capturePoll(&frame)) {
+				if (frame.dropped)
+					fprintf(stderr, "\rcapture: %u frames dropped\n", frame.dropped);
+			}
+		}
 		if (tracker.update(100, fps))
 			fprintf(stderr, "\r%3d fps ", fps);
 	}
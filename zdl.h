@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 #define ZDL_EXTERN extern "C"
 #else
@@ -44,6 +46,34 @@ ZDL_EXPORT int zdl_win32_entry(int (* main)(int, char **));
 #define ZDL_MAIN_FIXUP
 #endif
 
+/** Allocate @p size bytes, or return NULL. */
+typedef void *(*zdl_alloc_t)(void *user, size_t size);
+/** Resize @p ptr (may be NULL) to @p size bytes, or return NULL leaving @p ptr intact. */
+typedef void *(*zdl_realloc_t)(void *user, void *ptr, size_t size);
+/** Release @p ptr, which may be NULL. */
+typedef void (*zdl_free_t)(void *user, void *ptr);
+
+/** Route all internal allocations through caller supplied hooks.
+ * Must be called before any window or clipboard is created, or after all
+ * of them are destroyed; memory is always released through the hooks that
+ * allocated it.  Passing NULL for all three restores the C library.
+ * Hooks may be called from backend threads as well as the caller's.
+ *
+ * Long-lived allocations are made by zdl_window_create(),
+ * zdl_clipboard_open() and the first call of an optional feature
+ * (render size, capture, pixel surface, swap queue).  Buffers which grow
+ * to fit (expose damage, motion history, event queue nodes, touch input,
+ * clipboard transfers) are kept and reused, so a steady poll/swap loop
+ * does not allocate.  Clipboard reads and writes allocate per call and
+ * release the memory on the next call or on close.
+ * @param alloc Allocation hook.
+ * @param realloc Reallocation hook.
+ * @param free Release hook.
+ * @param user User data passed to each hook.
+ * @return 0 on success, -1 if only some hooks are given.
+ */
+ZDL_EXPORT int zdl_set_allocator(zdl_alloc_t alloc, zdl_realloc_t realloc, zdl_free_t free, void *user);
+
 /**< Window flags */
 enum zdl_flag_enum {
 	ZDL_FLAG_NONE       = 0,        /**< No flags */
@@ -55,6 +85,11 @@ enum zdl_flag_enum {
 	ZDL_FLAG_COPYONHL   = (1 << 5), /**< Copy on highlight (Read-Only) */
 	ZDL_FLAG_KEYREPEAT  = (1 << 6), /**< Enable key-repeat */
 	ZDL_FLAG_FLIP_Y     = (1 << 7), /**< Y-axis is flipped (Read-Only) */
+	ZDL_FLAG_NOBYPASS   = (1 << 8), /**< Keep compositing a fullscreen window */
+	ZDL_FLAG_PIXELS     = (1 << 9), /**< Software pixel surface instead of GL (Creation only) */
+	ZDL_FLAG_NOGL       = (1 << 10), /**< No GL context, e.g. for Vulkan (Creation only) */
+	ZDL_FLAG_MOTION_HISTORY = (1 << 11), /**< Coalesce pointer motion, keeping every sample */
+	ZDL_FLAG_POINTERLOCK = (1 << 12), /**< Hold the pointer, reporting relative motion */
 };
 /**< Window flag bitmask */
 typedef unsigned int zdl_flags_t;
@@ -253,6 +288,7 @@ enum zdl_motion_flag_enum {
 	ZDL_MOTION_FLAG_NONE    = 0,        /**< Normal motion event */
 	ZDL_MOTION_FLAG_INITIAL = (1 << 0), /**< Initial motion for id (eg finger down) */
 	ZDL_MOTION_FLAG_FINAL   = (1 << 1), /**< Final motion for id (eg finger up) */
+	ZDL_MOTION_FLAG_RELATIVE = (1 << 2), /**< Only d_x, d_y are meaningful (pointer lock) */
 };
 /** Motion flag bitmask */
 typedef unsigned int zdl_motion_flags_t;
@@ -281,12 +317,27 @@ enum zdl_event_type {
 
 	ZDL_EVENT_RECONFIGURE,   /**< Window was reconfigured */
 	ZDL_EVENT_EXPOSE,        /**< Window should be redrawn */
-	ZDL_EVENT_HIDE,          /**< Window was hidden */
+	ZDL_EVENT_HIDE,          /**< Window was hidden, until the next expose */
 	ZDL_EVENT_ERROR,         /**< Unrecoverable error happened */
 	ZDL_EVENT_EXIT,          /**< Window manager requested exit */
 	ZDL_EVENT_COPY,          /**< Window manager requested copy */
 	ZDL_EVENT_PASTE,         /**< Window manager requested paste */
 	ZDL_EVENT_CUT,           /**< Window manager requested cut */
+	ZDL_EVENT_PRESENTED,     /**< Pixel buffer was presented and may be reused */
+	ZDL_EVENT_CLIPBOARD,     /**< Asynchronous clipboard read completed */
+	ZDL_EVENT_CLIPBOARD_CHANGED, /**< Clipboard contents changed owner */
+
+	ZDL_EVENT_CONTROLLER_ADDED,         /**< Game controller was connected */
+	ZDL_EVENT_CONTROLLER_REMOVED,       /**< Game controller was disconnected */
+	ZDL_EVENT_CONTROLLER_AXIS,          /**< Game controller axis moved */
+	ZDL_EVENT_CONTROLLER_BUTTONPRESS,   /**< Game controller button was pressed */
+	ZDL_EVENT_CONTROLLER_BUTTONRELEASE, /**< Game controller button was released */
+};
+
+/** Rectangle, in window coordinates */
+struct zdl_rect {
+	int x, y;          /**< Top-left corner */
+	int width, height; /**< Dimensions */
 };
 
 /** Event */
@@ -315,15 +366,66 @@ struct zdl_event {
 			int x, y;                 /**< Event position */
 			int d_x, d_y;             /**< Delta position */
 			zdl_motion_flags_t flags; /**< Flags */
+			/** Samples folded into this event with ZDL_FLAG_MOTION_HISTORY,
+			 * oldest first and ending with x, y; count is 0 otherwise.
+			 * Samples of ZDL_MOTION_FLAG_RELATIVE events are deltas.
+			 * Arrays are valid until the next event is read. */
+			struct {
+				int count;                /**< Number of samples */
+				const int *x, *y;         /**< Sample positions */
+				const unsigned int *time; /**< Sample times, in milliseconds */
+			} history;
 		} motion;
 
 		/** Reconfigure event */
 		struct {
 			int width, height; /**< New dimensions */
 		} reconfigure;
+
+		/** Expose event */
+		struct {
+			int count;                    /**< Number of exposed rectangles, 0 for the whole window */
+			const struct zdl_rect *rects; /**< Exposed rectangles, valid until the next event is read */
+			struct zdl_rect bounds;       /**< Bounding box of all exposed rectangles */
+		} expose;
+
+		/** Clipboard event */
+		struct {
+			struct zdl_clipboard *clipboard;       /**< Clipboard the read was issued on */
+			int status;                            /**< 0 on success, !0 on failure or timeout */
+			const struct zdl_clipboard_data *data; /**< Read data, valid until the next read */
+		} clipboard;
+
+		/** Game controller event */
+		struct {
+			int id;                  /**< Controller identifier, reused after removal */
+			unsigned int code;       /**< Device specific axis or button code */
+			int value;               /**< Axis position, -32768 to 32767 */
+			unsigned long long time; /**< Time reported by the device, see zdl_time_us() */
+		} controller;
 	};
 };
 
+/** Maximum number of touch points in struct zdl_input_state */
+#define ZDL_INPUT_TOUCH_MAX 16
+
+/** Input state snapshot */
+struct zdl_input_state {
+	unsigned char keys[32];      /**< Held keys, one bit per enum zdl_keysym */
+	unsigned int buttons;        /**< Held buttons, bit (1 << enum zdl_button) */
+	zdl_keymod_t modifiers;      /**< Key modifier mask */
+	int x, y;                    /**< Pointer position */
+	int touch_count;             /**< Number of active touch points */
+	struct {
+		enum zdl_motion_id id;   /**< Motion identifier */
+		int x, y;                /**< Position */
+	} touches[ZDL_INPUT_TOUCH_MAX]; /**< Active touch points, oldest first */
+};
+
+/** Check whether a key is held in an input state */
+#define zdl_input_key_down(state, sym) \
+  (((state)->keys[(sym) >> 3] >> ((sym) & 7)) & 1)
+
 /** Window handle */
 typedef struct zdl_window *zdl_window_t;
 /** Invalid window handle */
@@ -431,6 +533,17 @@ ZDL_EXPORT void zdl_window_get_position(const zdl_window_t w, int *x, int *y);
 #define zdl_window_set_keyrepeat(w, enabled) \
   zdl_window_set_flags(w, zdl_bitmask_bool(zdl_window_get_flags(w),ZDL_FLAG_KEYREPEAT,enabled))
 
+/** Set window pointer lock.
+ * While locked the pointer is confined to the window and pointer motion is
+ * reported as ZDL_MOTION_FLAG_RELATIVE events carrying unaccelerated
+ * device deltas where the platform provides them.  The cursor is left
+ * alone; combine with zdl_window_show_cursor() as needed.
+ * @param w Window handle.
+ * @param locked Whether the pointer should be locked.
+ */
+#define zdl_window_set_pointer_lock(w, locked) \
+  zdl_window_set_flags(w, zdl_bitmask_bool(zdl_window_get_flags(w),ZDL_FLAG_POINTERLOCK,locked))
+
 /** Poll for window events.
  * @param w Window handle.
  * @param ev Pointer to event structure to fill-out
@@ -444,6 +557,53 @@ ZDL_EXPORT int  zdl_window_poll_event(zdl_window_t w, struct zdl_event *ev);
  */
 ZDL_EXPORT void zdl_window_wait_event(zdl_window_t w, struct zdl_event *ev);
 
+/** Inject an event into the window's event queue.
+ * Injected events are returned by zdl_window_poll_event() and
+ * zdl_window_wait_event() ahead of platform events. Except on the headless
+ * backend, this must be called from the thread handling events.
+ * @param w Window handle.
+ * @param ev Pointer to event to inject.
+ * @return 0 on success, !0 on failure.
+ */
+ZDL_EXPORT int  zdl_window_inject_event(zdl_window_t w, const struct zdl_event *ev);
+
+/** Get the input state as of the last event read.
+ * The state is kept up to date from the events returned by
+ * zdl_window_poll_event() and zdl_window_wait_event(), so this never
+ * queries the window system.
+ * @param w Window handle.
+ * @param state Pointer to input state structure to fill-out.
+ */
+ZDL_EXPORT void zdl_window_get_input_state(const zdl_window_t w, struct zdl_input_state *state);
+
+/** Enable or disable game controller events.
+ * Controllers are read on a separate thread, so their events are queued as
+ * soon as the device reports them rather than when the window system next
+ * delivers an event.  Controllers already connected are reported with
+ * ZDL_EVENT_CONTROLLER_ADDED when enabled.  If events are not read as fast
+ * as they arrive, queued events are kept and new ones held back; once the
+ * queue drains, the current axes and any changed buttons are reported, so
+ * only a press and release both made in the meantime go unseen.
+ * @param w Window handle.
+ * @param enabled !0 to enable, 0 to disable.
+ * @return 0 on success, !0 on failure or if unsupported.
+ */
+ZDL_EXPORT int  zdl_window_set_controllers(zdl_window_t w, int enabled);
+
+/** Get the name of a connected game controller.
+ * @param w Window handle.
+ * @param id Controller identifier.
+ * @param name Buffer for the NUL-terminated name.
+ * @param size Size of @p name.
+ * @return 0 on success, !0 if no such controller is connected.
+ */
+ZDL_EXPORT int  zdl_window_get_controller_name(zdl_window_t w, int id, char *name, size_t size);
+
+/** Get the current time on the clock used for event timestamps.
+ * @return Monotonic time, in microseconds.
+ */
+ZDL_EXPORT unsigned long long zdl_time_us(void);
+
 /** Warp mouse pointer.
  * @param w Window handle.
  * @param x New X position of mouse.
@@ -456,6 +616,230 @@ ZDL_EXPORT void zdl_window_warp_mouse(zdl_window_t w, int x, int y);
  */
 ZDL_EXPORT void zdl_window_swap(zdl_window_t w);
 
+/** Swap window buffers, presenting only damaged regions.
+ * Damage is a hint: the platform may present the whole frame regardless,
+ * and whether the back buffer survives depends on how it presented, which
+ * can change from frame to frame (e.g. with zdl_window_set_render_size() or
+ * zdl_window_set_swap_queue()). Only when this returns 0 may the next frame
+ * redraw just its damaged regions.
+ * @param w Window handle.
+ * @param rects Damaged rectangles.
+ * @param count Number of rectangles in @p rects.
+ * @return 0 if the back buffer contents were preserved, !0 if they are
+ *  undefined and the next frame must be drawn in full.
+ */
+ZDL_EXPORT int  zdl_window_swap_with_damage(zdl_window_t w, const struct zdl_rect *rects, int count);
+
+/** Frame timing statistics, in microseconds. */
+struct zdl_frame_stats {
+	unsigned int frames; /**< Number of frame times sampled */
+	unsigned int target; /**< Target frame time (0 if unpaced) */
+	unsigned int mean;   /**< Mean frame time */
+	unsigned int p50;    /**< 50th percentile frame time */
+	unsigned int p90;    /**< 90th percentile frame time */
+	unsigned int p99;    /**< 99th percentile frame time */
+	unsigned int max;    /**< Longest frame time */
+	unsigned int wait;     /**< Mean time spent waiting on frames in flight */
+	unsigned int wait_max; /**< Longest time spent waiting on frames in flight */
+};
+
+/** Set target frame rate.
+ * When set, zdl_window_swap() will sleep until the next frame deadline.
+ * @param w Window handle.
+ * @param hz Desired frames per second, or 0 to disable pacing.
+ */
+ZDL_EXPORT void zdl_window_set_target_rate(zdl_window_t w, unsigned int hz);
+
+/** Get frame timing statistics.
+ * Statistics cover the most recent frames presented with zdl_window_swap().
+ * @param w Window handle.
+ * @param stats Pointer to where statistics should be stored.
+ */
+ZDL_EXPORT void zdl_window_get_frame_stats(const zdl_window_t w, struct zdl_frame_stats *stats);
+
+/** Limit the number of frames queued to the GPU.
+ * After each zdl_window_swap(), wait until the frame submitted @p n swaps
+ * earlier has completed, bounding latency without a full glFinish().
+ * @param w Window handle.
+ * @param n Maximum frames in flight, or 0 for no limit.
+ * @return 0 on success, !0 on failure.
+ */
+ZDL_EXPORT int zdl_window_set_max_frames_in_flight(zdl_window_t w, int n);
+
+/** Set asynchronous swap queue depth.
+ * With a non-zero depth, rendering is directed to an offscreen framebuffer
+ * (see zdl_window_get_framebuffer()) and zdl_window_swap() hands finished
+ * frames to a presenter thread, returning immediately unless the queue is full.
+ * On X11 the presenter shares the window's display connection, so the first
+ * zdl_window_create() calls XInitThreads(). Xlib requires that to precede any
+ * other Xlib call, so applications which use Xlib before creating a window
+ * must call XInitThreads() themselves first.
+ * @param w Window handle.
+ * @param depth Number of frames which may be queued, or 0 for synchronous swaps.
+ * @return 0 on success, !0 on failure.
+ */
+ZDL_EXPORT int zdl_window_set_swap_queue(zdl_window_t w, int depth);
+
+/** Check whether the swap queue can accept another frame.
+ * @param w Window handle.
+ * @return 0 if zdl_window_swap() will not block, !0 if the frame should be skipped.
+ */
+ZDL_EXPORT int zdl_window_swap_ready(zdl_window_t w);
+
+/** Get the framebuffer which should be rendered into.
+ * Applications binding their own framebuffers must restore this one,
+ * rather than 0, before rendering the frame. It may change after each swap.
+ * @param w Window handle.
+ * @return GL framebuffer object name.
+ */
+ZDL_EXPORT unsigned int zdl_window_get_framebuffer(zdl_window_t w);
+
+/** Scaling filter */
+enum zdl_filter {
+	ZDL_FILTER_NEAREST, /**< Nearest neighbour */
+	ZDL_FILTER_LINEAR,  /**< Bilinear */
+};
+
+/** Set a fixed rendering resolution, independent of the window size.
+ * Rendering is redirected to an offscreen framebuffer of the given size,
+ * which is stretched over the window by zdl_window_swap(), emulating a mode
+ * switch without changing the display mode. Pointer coordinates in events and
+ * zdl_window_warp_mouse() are scaled to match, and the viewport is reset to
+ * cover the new size. As with zdl_window_set_swap_queue(), applications
+ * binding their own framebuffers must restore zdl_window_get_framebuffer().
+ * @param w Window handle.
+ * @param width Render width, or 0 to render at the window size.
+ * @param height Render height, or 0 to render at the window size.
+ * @param filter Filter used when scaling.
+ * @return 0 on success, !0 on failure.
+ */
+ZDL_EXPORT int zdl_window_set_render_size(zdl_window_t w, int width, int height, enum zdl_filter filter);
+
+/** Pixel format, in memory byte order */
+enum zdl_pixel_format {
+	ZDL_PIXEL_RGBA8888, /**< R, G, B, A bytes */
+	ZDL_PIXEL_BGRA8888, /**< B, G, R, A bytes */
+};
+
+/** Captured frame */
+struct zdl_capture_frame {
+	const void *pixels;           /**< Pixels, top row first; valid until the next poll */
+	int width, height;            /**< Dimensions */
+	int stride;                   /**< Bytes per row */
+	enum zdl_pixel_format format; /**< Pixel format */
+	unsigned int dropped;         /**< Frames not captured since the last poll */
+};
+
+/** Begin capturing presented frames.
+ * Every zdl_window_swap() then queues an asynchronous read-back of the frame,
+ * which can be collected with zdl_window_capture_poll() a frame or two later.
+ * Frames are dropped, rather than stalling, while all read-backs are pending.
+ * @param w Window handle.
+ * @param format Pixel format of captured frames.
+ * @return 0 on success, !0 on failure.
+ */
+ZDL_EXPORT int zdl_window_capture_begin(zdl_window_t w, enum zdl_pixel_format format);
+
+/** Collect the oldest completed frame capture.
+ * @param w Window handle.
+ * @param frame Pointer to where the frame should be stored.
+ * @return 0 on success, !0 if no capture has completed yet.
+ */
+ZDL_EXPORT int zdl_window_capture_poll(zdl_window_t w, struct zdl_capture_frame *frame);
+
+/** Stop capturing frames, discarding any pending captures.
+ * @param w Window handle.
+ */
+ZDL_EXPORT void zdl_window_capture_end(zdl_window_t w);
+
+/** Locked pixel surface */
+struct zdl_pixels {
+	void *pixels;                 /**< Pixels, top row first */
+	int width, height;            /**< Dimensions */
+	int stride;                   /**< Bytes per row */
+	enum zdl_pixel_format format; /**< Pixel format, alpha is ignored */
+};
+
+/** Lock the next pixel buffer of a ZDL_FLAG_PIXELS window for drawing.
+ * Windows have two buffers, so drawing may overlap presentation of the
+ * previous frame. Locking blocks while the buffer is still being presented;
+ * a ZDL_EVENT_PRESENTED event is delivered when each buffer is released.
+ * Contents are undefined after a resize.
+ * @param w Window handle.
+ * @param pixels Pointer to where the surface should be stored.
+ * @return 0 on success, !0 on failure.
+ */
+ZDL_EXPORT int zdl_window_lock_pixels(zdl_window_t w, struct zdl_pixels *pixels);
+
+/** Unlock and present the pixel buffer locked with zdl_window_lock_pixels().
+ * @param w Window handle.
+ */
+ZDL_EXPORT void zdl_window_unlock_pixels(zdl_window_t w);
+
+/** Vulkan present mode, numerically equal to VkPresentModeKHR */
+enum zdl_present_mode {
+	ZDL_PRESENT_IMMEDIATE    = 0, /**< No vsync, may tear */
+	ZDL_PRESENT_MAILBOX      = 1, /**< Vsync, newest frame replaces queued ones */
+	ZDL_PRESENT_FIFO         = 2, /**< Vsync, frames queued; always supported */
+	ZDL_PRESENT_FIFO_RELAXED = 3, /**< Vsync, late frames tear */
+};
+
+/** Get the Vulkan instance extensions needed by zdl_window_create_vulkan_surface().
+ * @param count Pointer to where the number of extensions should be stored.
+ * @return Array of extension names, or NULL if Vulkan is not supported.
+ */
+ZDL_EXPORT const char *const *zdl_vulkan_get_instance_extensions(unsigned int *count);
+
+/** Create a Vulkan surface for a window.
+ * The window must be created with ZDL_FLAG_NOGL; this fails on a window
+ * with a GL context. The Vulkan loader is opened at run time, so ZDL itself
+ * does not depend on it.
+ * @param w Window handle.
+ * @param instance VkInstance, created with zdl_vulkan_get_instance_extensions().
+ * @param allocator const VkAllocationCallbacks pointer, or NULL.
+ * @param surface VkSurfaceKHR pointer where the surface should be stored.
+ * @return 0 on success, !0 on failure.
+ */
+ZDL_EXPORT int zdl_window_create_vulkan_surface(zdl_window_t w, void *instance, const void *allocator, void *surface);
+
+/** Choose a Vulkan present mode suiting the window.
+ * With vsync, mailbox is preferred only when the window is unredirected,
+ * since a compositor already adds a frame of queueing.
+ * @param w Window handle.
+ * @param modes Present modes supported by the surface.
+ * @param count Number of entries in @p modes.
+ * @param vsync Non-zero if tearing is unacceptable.
+ * @return Present mode to use.
+ */
+ZDL_EXPORT enum zdl_present_mode zdl_window_choose_present_mode(const zdl_window_t w,
+		const enum zdl_present_mode *modes, int count, int vsync);
+
+/** Check whether the window is presented without compositing.
+ * This is a best-effort guess: it is true when no compositing manager is
+ * running, or when a fullscreen window has asked to bypass it (see
+ * ZDL_FLAG_NOBYPASS), which compositors are free to ignore.
+ * @param w Window handle.
+ * @return !0 if the window is believed to be unredirected, 0 otherwise.
+ */
+ZDL_EXPORT int zdl_window_is_unredirected(const zdl_window_t w);
+
+/** Check for a GL or window-system (GLX, EGL, WGL) extension.
+ * Extension strings are parsed once per window, so this is cheap to call.
+ * @param w Window handle.
+ * @param name Extension name, e.g. "GL_ARB_sync".
+ * @return !0 if supported, 0 otherwise.
+ */
+ZDL_EXPORT int zdl_gl_has_extension(const zdl_window_t w, const char *name);
+
+/** Get the address of a GL or window-system entry point.
+ * Addresses are cached for the life of the window's context. Must be called
+ * from the thread using the window.
+ * @param w Window handle.
+ * @param name Entry point name, e.g. "glFenceSync".
+ * @return Entry point address, or NULL if unavailable.
+ */
+ZDL_EXPORT void *zdl_gl_get_proc(zdl_window_t w, const char *name);
+
 /** Native window handle. */
 union zdl_native_handle {
 	void *ptr;
@@ -471,6 +855,56 @@ union zdl_native_handle {
  */
 ZDL_EXPORT union zdl_native_handle zdl_window_native_handle(zdl_window_t w);
 
+/** Main loop callbacks */
+struct zdl_run_callbacks {
+	/** Handle an event, or NULL to stop on ZDL_EVENT_EXIT and ZDL_EVENT_ERROR.
+	 * @return !0 to stop running. */
+	int (*event)(void *user, const struct zdl_event *ev);
+	/** Advance by one fixed step of @p dt seconds, may be NULL. */
+	void (*update)(void *user, double dt);
+	/** Draw a frame, @p alpha (0 to 1) being how far past the last update to
+	 * interpolate; the frame is swapped on return. May be NULL. */
+	void (*render)(void *user, double alpha);
+	void *user; /**< User data passed to callbacks */
+};
+
+/** Main loop timing statistics */
+struct zdl_run_stats {
+	unsigned long long frames;   /**< Frames rendered */
+	unsigned long long updates;  /**< Updates run */
+	unsigned long long overruns; /**< Frames which hit the update catch-up limit */
+	unsigned long long dropped;  /**< Update time skipped by overruns, in microseconds */
+	unsigned int update_mean;    /**< Mean time spent in an update, in microseconds */
+	unsigned int update_max;     /**< Longest time spent in an update, in microseconds */
+};
+
+/** Main loop configuration */
+struct zdl_run_config {
+	unsigned int update_hz;   /**< Fixed update rate, 0 for 60 */
+	unsigned int max_updates; /**< Updates per frame before falling behind, 0 for 5 */
+	unsigned int max_events;  /**< Events handled per frame, 0 for all pending */
+	unsigned int target_hz;   /**< Frame rate for zdl_window_set_target_rate(), 0 to leave as set */
+	struct zdl_run_stats *stats; /**< Updated as the loop runs, may be NULL */
+};
+
+/** Run a fixed-timestep main loop.
+ * Each frame handles pending events, runs as many updates as the time since
+ * the last frame calls for, then renders and calls zdl_window_swap(), which
+ * applies frame pacing. When updates cannot keep up, time beyond
+ * @p max_updates steps is dropped rather than caught up later. While the
+ * window is hidden, the loop sleeps waiting for events and no time passes
+ * for updates. Hidden means from ZDL_EVENT_HIDE to the next
+ * ZDL_EVENT_EXPOSE: unmapped or minimized, or fully covered where the
+ * window system reports it (X11 without a compositor). Other occlusion is
+ * not detected, and the loop keeps rendering.
+ * @param w Window handle.
+ * @param callbacks Callbacks.
+ * @param config Configuration, or NULL for defaults.
+ * @return 0 once stopped.
+ */
+ZDL_EXPORT int zdl_run(zdl_window_t w, const struct zdl_run_callbacks *callbacks,
+		const struct zdl_run_config *config);
+
 /** Clipboard handle. */
 typedef struct zdl_clipboard *zdl_clipboard_t;
 
@@ -484,6 +918,9 @@ enum zdl_clipboard_format {
 	ZDL_CLIPBOARD_URI,   /**< ASCII URI. */
 };
 
+/** Clipboard format mask bit, for selecting acceptable formats. */
+#define ZDL_CLIPBOARD_MASK(format) (1u << (format))
+
 /** Clipboard data */
 struct zdl_clipboard_data {
 	enum zdl_clipboard_format format; /**< Clipboard format. */
@@ -502,6 +939,20 @@ struct zdl_clipboard_data {
 	};
 };
 
+/** Clipboard data chunk callback.
+ * @param user User pointer passed to zdl_clipboard_read_stream().
+ * @param data Next chunk of data, valid only for the duration of the call.
+ * @param size Size of the chunk in bytes.
+ * @return 0 to continue reading, !0 to abort.
+ */
+typedef int (*zdl_clipboard_chunk_t)(void *user, const void *data, size_t size);
+
+/** Clipboard buffer release callback.
+ * @param user User pointer passed to zdl_clipboard_write_buffer().
+ * @param data Buffer which is no longer referenced.
+ */
+typedef void (*zdl_clipboard_release_t)(void *user, const void *data);
+
 /** Open the window manager's clipboard.
  * @param w Window handle.
  * @return Clipboard handle on success, ZDL_CLIPBOARD_INVALID on failure.
@@ -520,6 +971,21 @@ ZDL_EXPORT void zdl_clipboard_close(zdl_clipboard_t c);
  */
 ZDL_EXPORT int zdl_clipboard_write(zdl_clipboard_t c, const struct zdl_clipboard_data *data);
 
+/** Write a caller-owned buffer to clipboard.
+ * Where the platform allows, the buffer is served to other applications
+ * directly instead of being copied. It must stay valid until @p release is
+ * called, which may happen before this function returns.
+ * @param c Clipboard handle.
+ * @param format Clipboard format, text or URI.
+ * @param data Data, need not be NULL terminated.
+ * @param size Size of the data in bytes.
+ * @param release Callback invoked once the buffer is no longer used, or NULL.
+ * @param user User pointer passed to @p release.
+ * @return 0 on success, !0 on failure; @p release is not called on failure.
+ */
+ZDL_EXPORT int zdl_clipboard_write_buffer(zdl_clipboard_t c, enum zdl_clipboard_format format,
+		const void *data, size_t size, zdl_clipboard_release_t release, void *user);
+
 /** Read from clipboard.
  * @param c Clipboard handle.
  * @param data Pointer where clipboard data should be written.
@@ -527,7 +993,54 @@ ZDL_EXPORT int zdl_clipboard_write(zdl_clipboard_t c, const struct zdl_clipboard
  */
 ZDL_EXPORT int zdl_clipboard_read(zdl_clipboard_t c, struct zdl_clipboard_data *data);
 
+/** Stream clipboard contents.
+ * Text and URI data are passed to @p chunk as they arrive, without being
+ * collected in memory; large transfers arrive over several calls. Data is
+ * not NULL terminated. Images cannot be streamed.
+ * @param c Clipboard handle.
+ * @param formats Mask of acceptable formats, see ZDL_CLIPBOARD_MASK().
+ * @param chunk Callback receiving the data.
+ * @param user User pointer passed to @p chunk.
+ * @param format Pointer where the selected format should be written, or NULL.
+ * @return 0 on success, !0 on failure.
+ */
+ZDL_EXPORT int zdl_clipboard_read_stream(zdl_clipboard_t c, unsigned int formats,
+		zdl_clipboard_chunk_t chunk, void *user, enum zdl_clipboard_format *format);
+
+/** Read clipboard text into a caller-provided buffer.
+ * @param c Clipboard handle.
+ * @param formats Mask of acceptable formats, see ZDL_CLIPBOARD_MASK().
+ * @param buffer Buffer where the NULL terminated data should be written.
+ * @param size Size of @p buffer in bytes.
+ * @param length Pointer where the data length should be written, or NULL.
+ *               On truncation this is the size the buffer needed, less one.
+ * @param format Pointer where the selected format should be written, or NULL.
+ * @return 0 on success, !0 on failure or if @p buffer was too small.
+ */
+ZDL_EXPORT int zdl_clipboard_read_buffer(zdl_clipboard_t c, unsigned int formats,
+		void *buffer, size_t size, size_t *length, enum zdl_clipboard_format *format);
+
+/** Read from clipboard asynchronously.
+ * Requests the clipboard contents and returns immediately. Completion,
+ * failure or timeout is reported by a ZDL_EVENT_CLIPBOARD event on the
+ * clipboard's window. Only one read may be outstanding per window.
+ * @param c Clipboard handle.
+ * @param formats Mask of acceptable formats, see ZDL_CLIPBOARD_MASK().
+ * @return 0 if the read was issued, !0 on failure.
+ */
+ZDL_EXPORT int zdl_clipboard_read_async(zdl_clipboard_t c, unsigned int formats);
+
+/** Set clipboard read timeout.
+ * @param c Clipboard handle.
+ * @param ms Time in milliseconds to wait for the owner, default 1000.
+ */
+ZDL_EXPORT void zdl_clipboard_set_timeout(zdl_clipboard_t c, unsigned int ms);
+
 #ifdef __cplusplus
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
 namespace ZDL {
 
 class Clipboard {
@@ -543,6 +1056,66 @@ public:
 	int read(struct zdl_clipboard_data *data)
 	{ return zdl_clipboard_read(m_clip, data); }
 
+	int readBuffer(void *buffer, size_t size, size_t *length = 0,
+			unsigned int formats = ZDL_CLIPBOARD_MASK(ZDL_CLIPBOARD_TEXT))
+	{ return zdl_clipboard_read_buffer(m_clip, formats, buffer, size, length, 0); }
+
+	/** View of image pixels, valid until the next read. */
+	struct Pixels {
+		const unsigned int *data;
+		int width, height;
+
+		size_t size() const { return data ? (size_t)width * height : 0; }
+		const unsigned int *begin() const { return data; }
+		const unsigned int *end() const { return data + size(); }
+	};
+
+	Pixels pixels()
+	{
+		struct zdl_clipboard_data data;
+		Pixels p = { 0, 0, 0 };
+		if (zdl_clipboard_read(m_clip, &data) == 0 &&
+		    data.format == ZDL_CLIPBOARD_IMAGE) {
+			p.data = data.image.pixels;
+			p.width = data.image.width;
+			p.height = data.image.height;
+		}
+		return p;
+	}
+
+#if __cplusplus >= 201703L
+	/** Text or URI contents, valid until the next read. */
+	std::string_view text()
+	{
+		struct zdl_clipboard_data data;
+		if (zdl_clipboard_read(m_clip, &data) != 0)
+			return std::string_view();
+		if (data.format == ZDL_CLIPBOARD_URI)
+			return std::string_view(data.uri.uri);
+		if (data.format == ZDL_CLIPBOARD_TEXT)
+			return std::string_view(data.text.text);
+		return std::string_view();
+	}
+
+	/** Write text without copying, see zdl_clipboard_write_buffer().
+	 * Without @p release the text must stay valid until the next write. */
+	int write(std::string_view text, zdl_clipboard_release_t release = 0, void *user = 0)
+	{
+		return zdl_clipboard_write_buffer(m_clip, ZDL_CLIPBOARD_TEXT,
+				text.data(), text.size(), release, user);
+	}
+#endif
+
+	int readStream(unsigned int formats, zdl_clipboard_chunk_t chunk, void *user,
+			enum zdl_clipboard_format *format = 0)
+	{ return zdl_clipboard_read_stream(m_clip, formats, chunk, user, format); }
+
+	int readAsync(unsigned int formats)
+	{ return zdl_clipboard_read_async(m_clip, formats); }
+
+	void setTimeout(unsigned int ms)
+	{ zdl_clipboard_set_timeout(m_clip, ms); }
+
 	int write(const struct zdl_clipboard_data *data)
 	{ return zdl_clipboard_write(m_clip, data); }
 
@@ -595,12 +1168,65 @@ public:
 	void waitEvent(struct zdl_event *ev)
 	{ zdl_window_wait_event(m_win, ev); }
 
+	int injectEvent(const struct zdl_event *ev)
+	{ return zdl_window_inject_event(m_win, ev); }
+	void getInputState(struct zdl_input_state *state) const
+	{ zdl_window_get_input_state(m_win, state); }
+	int setControllers(bool enabled)
+	{ return zdl_window_set_controllers(m_win, enabled ? 1 : 0); }
+	int getControllerName(int id, char *name, size_t size)
+	{ return zdl_window_get_controller_name(m_win, id, name, size); }
+
 	void swap(void)
 	{ zdl_window_swap(m_win); }
+	int swap(const struct zdl_rect *rects, int count)
+	{ return zdl_window_swap_with_damage(m_win, rects, count); }
+
+	void setTargetRate(unsigned int hz)
+	{ zdl_window_set_target_rate(m_win, hz); }
+	void getFrameStats(struct zdl_frame_stats *stats) const
+	{ zdl_window_get_frame_stats(m_win, stats); }
+
+	int setMaxFramesInFlight(int n)
+	{ return zdl_window_set_max_frames_in_flight(m_win, n); }
+
+	int setSwapQueue(int depth)
+	{ return zdl_window_set_swap_queue(m_win, depth); }
+	bool swapReady(void)
+	{ return zdl_window_swap_ready(m_win) == 0; }
+	unsigned int getFramebuffer(void)
+	{ return zdl_window_get_framebuffer(m_win); }
+	int lockPixels(struct zdl_pixels *pixels)
+	{ return zdl_window_lock_pixels(m_win, pixels); }
+	void unlockPixels(void)
+	{ zdl_window_unlock_pixels(m_win); }
+	int createVulkanSurface(void *instance, const void *allocator, void *surface)
+	{ return zdl_window_create_vulkan_surface(m_win, instance, allocator, surface); }
+	enum zdl_present_mode choosePresentMode(const enum zdl_present_mode *modes, int count, bool vsync)
+	{ return zdl_window_choose_present_mode(m_win, modes, count, vsync); }
+	bool hasExtension(const char *name)
+	{ return zdl_gl_has_extension(m_win, name) != 0; }
+	void *getProc(const char *name)
+	{ return zdl_gl_get_proc(m_win, name); }
+	bool isUnredirected(void)
+	{ return zdl_window_is_unredirected(m_win) != 0; }
+
+	int setRenderSize(int width, int height, enum zdl_filter filter = ZDL_FILTER_NEAREST)
+	{ return zdl_window_set_render_size(m_win, width, height, filter); }
+
+	int captureBegin(enum zdl_pixel_format format)
+	{ return zdl_window_capture_begin(m_win, format); }
+	bool capturePoll(struct zdl_capture_frame *frame)
+	{ return zdl_window_capture_poll(m_win, frame) == 0; }
+	void captureEnd(void)
+	{ zdl_window_capture_end(m_win); }
 
 	union zdl_native_handle getNativeHandle(void)
 	{ return zdl_window_native_handle(m_win); }
 
+	int run(const struct zdl_run_callbacks *callbacks, const struct zdl_run_config *config = NULL)
+	{ return zdl_run(m_win, callbacks, config); }
+
 	Clipboard *getClipboard(void)
 	{
 		return new Clipboard(m_win);
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ZDL_INTERNAL
+#include "zdl.h"
+#include "zdl_alloc.h"
+
+static struct {
+	zdl_alloc_t alloc;
+	zdl_realloc_t realloc;
+	zdl_free_t free;
+	void *user;
+} zdl_allocator;
+
+int zdl_set_allocator(zdl_alloc_t alloc, zdl_realloc_t realloc, zdl_free_t free, void *user)
+{
+	if ((alloc == NULL) != (realloc == NULL) || (alloc == NULL) != (free == NULL))
+		return -1;
+
+	zdl_allocator.alloc = alloc;
+	zdl_allocator.realloc = realloc;
+	zdl_allocator.free = free;
+	zdl_allocator.user = alloc != NULL ? user : NULL;
+	return 0;
+}
+
+void *zdl_malloc(size_t size)
+{
+	if (zdl_allocator.alloc == NULL)
+		return malloc(size);
+	return zdl_allocator.alloc(zdl_allocator.user, size);
+}
+
+void *zdl_calloc(size_t count, size_t size)
+{
+	void *ptr;
+
+	if (zdl_allocator.alloc == NULL)
+		return calloc(count, size);
+
+	if (size != 0 && count > (size_t)-1 / size)
+		return NULL;
+	ptr = zdl_allocator.alloc(zdl_allocator.user, count * size);
+	if (ptr != NULL)
+		memset(ptr, 0, count * size);
+	return ptr;
+}
+
+void *zdl_realloc(void *ptr, size_t size)
+{
+	if (zdl_allocator.realloc == NULL)
+		return realloc(ptr, size);
+	return zdl_allocator.realloc(zdl_allocator.user, ptr, size);
+}
+
+void zdl_free(void *ptr)
+{
+	if (ptr == NULL)
+		return;
+	if (zdl_allocator.free == NULL)
+		free(ptr);
+	else
+		zdl_allocator.free(zdl_allocator.user, ptr);
+}
+
+char *zdl_strdup(const char *s)
+{
+	size_t len;
+	char *copy;
+
+	len = strlen(s) + 1;
+	copy = (char *)zdl_malloc(len);
+	if (copy != NULL)
+		memcpy(copy, s, len);
+	return copy;
+}
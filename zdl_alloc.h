@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Internal allocation entry points, shared between backends. Everything the
+ * library owns goes through these so zdl_set_allocator() sees it all; memory
+ * allocated by system libraries (XGetImage, XGetWindowProperty, ...) is still
+ * released through their own functions. */
+
+#pragma once
+
+#include <stddef.h>
+
+/** Allocate uninitialized memory.
+ * @param size Size in bytes.
+ * @return Memory, or NULL on failure.
+ */
+void *zdl_malloc(size_t size);
+
+/** Allocate zeroed memory.
+ * @param count Number of elements.
+ * @param size Element size in bytes.
+ * @return Memory, or NULL on failure or overflow.
+ */
+void *zdl_calloc(size_t count, size_t size);
+
+/** Resize memory.
+ * @param ptr Memory from zdl_malloc() and friends, may be NULL.
+ * @param size New size in bytes.
+ * @return Memory, or NULL on failure with @p ptr left intact.
+ */
+void *zdl_realloc(void *ptr, size_t size);
+
+/** Release memory.
+ * @param ptr Memory from zdl_malloc() and friends, may be NULL.
+ */
+void zdl_free(void *ptr);
+
+/** Duplicate a string.
+ * @param s String.
+ * @return Copy to release with zdl_free(), or NULL on failure.
+ */
+char *zdl_strdup(const char *s);
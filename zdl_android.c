@@ -28,14 +28,18 @@
 
 #include <jni.h>
 #include <poll.h>
+#include <dlfcn.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
 #include <sys/resource.h>
 
 #include <android/native_activity.h>
@@ -46,6 +50,10 @@
 #define LAYOUTPARAMS_FULLSCREEN 0x00000400
 
 #include "zdl.h"
+#include "zdl_alloc.h"
+#include "zdl_input.h"
+#include "zdl_pacer.h"
+#include "zdl_registry.h"
 
 #define LOG_TAG "zdl"
 #define LOGI(...) ((void)__android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__))
@@ -110,14 +118,24 @@ struct zdl_sem_stack {
 	struct zdl_sem_stack_item *head;
 };
 
+struct zdl_history {
+	int *x, *y;
+	unsigned int *time;
+	int count;
+	int size;
+};
+
 struct zdl_queue_item {
 	struct zdl_event data;
 	struct zdl_queue_item *next;
+	/* motion history is copied in, as queued events outlive the input event */
+	struct zdl_history history;
 };
 
 struct zdl_queue {
 	struct zdl_queue_item *head;
 	struct zdl_queue_item *tail;
+	struct zdl_queue_item *spare;
 };
 
 struct zdl_wueue_item {
@@ -135,16 +153,33 @@ struct zdl_wueue {
 	int wpipe[2];
 };
 
+#define ZDL_FRAMES_IN_FLIGHT_MAX 8
+
+struct zdl_limiter {
+	int max;
+	int head;
+	EGLSyncKHR fences[ZDL_FRAMES_IN_FLIGHT_MAX];
+	PFNEGLCREATESYNCKHRPROC CreateSync;
+	PFNEGLCLIENTWAITSYNCKHRPROC ClientWaitSync;
+	PFNEGLDESTROYSYNCKHRPROC DestroySync;
+};
+
 struct zdl_window {
 	ANativeWindow *native;
 	zdl_flags_t flags;
 	EGLDisplay display;
+	struct zdl_registry *registry;
 	EGLSurface surface;
 	EGLContext context;
 	int shutdown;
 	int width;
 	int height;
+	struct zdl_input_state input;
 	struct zdl_queue queue;
+	struct zdl_history history;
+	struct zdl_pacer pacer;
+	struct zdl_limiter limiter;
+	PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC SwapBuffersWithDamage;
 };
 
 struct zdl_app {
@@ -439,17 +474,73 @@ static void zdl_wueue_fini(struct zdl_wueue *w)
 	close(w->wpipe[1]);
 }
 
+static int zdl_history_reserve(struct zdl_history *h, int count)
+{
+	int size = h->size ? h->size : 64;
+	void *p;
+
+	if (count <= h->size)
+		return 0;
+	while (size < count)
+		size *= 2;
+
+	if ((p = zdl_realloc(h->x, size * sizeof(int))) == NULL)
+		return -1;
+	h->x = (int *)p;
+	if ((p = zdl_realloc(h->y, size * sizeof(int))) == NULL)
+		return -1;
+	h->y = (int *)p;
+	if ((p = zdl_realloc(h->time, size * sizeof(unsigned int))) == NULL)
+		return -1;
+	h->time = (unsigned int *)p;
+	h->size = size;
+	return 0;
+}
+
+static void zdl_history_free(struct zdl_history *h)
+{
+	zdl_free(h->x);
+	zdl_free(h->y);
+	zdl_free(h->time);
+	memset(h, 0, sizeof(*h));
+}
+
 static void zdl_queue_init(struct zdl_queue *q)
 {
-	q->head = q->tail = NULL;
+	q->head = q->tail = q->spare = NULL;
 }
 
 static void zdl_queue_push(struct zdl_queue *q, struct zdl_event *ev)
 {
 	struct zdl_queue_item *item;
 
-	item = (struct zdl_queue_item *)calloc(1, sizeof(*item));
+	item = q->spare;
+	if (item != NULL) {
+		q->spare = item->next;
+	} else {
+		item = (struct zdl_queue_item *)zdl_calloc(1, sizeof(*item));
+		if (item == NULL)
+			return;
+	}
 	item->data = *ev;
+	item->next = NULL;
+
+	if (ev->type == ZDL_EVENT_MOTION && ev->motion.history.count > 0) {
+		struct zdl_history *h = &item->history;
+		int count = ev->motion.history.count;
+
+		if (zdl_history_reserve(h, count) == 0) {
+			memcpy(h->x, ev->motion.history.x, count * sizeof(int));
+			memcpy(h->y, ev->motion.history.y, count * sizeof(int));
+			memcpy(h->time, ev->motion.history.time, count * sizeof(unsigned int));
+			item->data.motion.history.x = h->x;
+			item->data.motion.history.y = h->y;
+			item->data.motion.history.time = h->time;
+		} else {
+			/* out of memory; deliver the event without its samples */
+			item->data.motion.history.count = 0;
+		}
+	}
 
 	if (q->tail != NULL) {
 		q->tail->next = item;
@@ -470,7 +561,9 @@ static int zdl_queue_pop(struct zdl_queue *q, struct zdl_event *ev)
 			q->tail = NULL;
 
 		*ev = item->data;
-		free(item);
+		/* nodes are kept for reuse rather than freed */
+		item->next = q->spare;
+		q->spare = item;
 		return 0;
 	}
 	return -1;
@@ -478,8 +571,15 @@ static int zdl_queue_pop(struct zdl_queue *q, struct zdl_event *ev)
 
 static void zdl_queue_destroy(struct zdl_queue *q)
 {
+	struct zdl_queue_item *item;
 	struct zdl_event ev;
+
 	while (zdl_queue_pop(q, &ev) == 0);
+	while ((item = q->spare) != NULL) {
+		q->spare = item->next;
+		zdl_history_free(&item->history);
+		zdl_free(item);
+	}
 }
 
 static void zdl_window_queue_push(zdl_window_t w, struct zdl_event *ev)
@@ -489,6 +589,21 @@ static void zdl_window_queue_push(zdl_window_t w, struct zdl_event *ev)
 	zdl_queue_push(&w->queue, ev);
 }
 
+static void *zdl_egl_get_proc(const char *name)
+{
+	return (void *)eglGetProcAddress(name);
+}
+
+int zdl_gl_has_extension(const zdl_window_t w, const char *name)
+{
+	return zdl_registry_has_extension(w->registry, name);
+}
+
+void *zdl_gl_get_proc(zdl_window_t w, const char *name)
+{
+	return zdl_registry_get_proc(w->registry, name, zdl_egl_get_proc);
+}
+
 static int zdl_display_init(zdl_window_t w)
 {
 	const EGLint attrs[] = {
@@ -532,6 +647,15 @@ static int zdl_display_init(zdl_window_t w)
 	eglQuerySurface(w->display, w->surface, EGL_WIDTH, &w->width);
 	eglQuerySurface(w->display, w->surface, EGL_HEIGHT, &w->height);
 
+	w->registry = zdl_registry_create();
+	zdl_registry_add_extensions(w->registry, eglQueryString(w->display, EGL_EXTENSIONS));
+	zdl_registry_add_extensions(w->registry, (const char *)glGetString(GL_EXTENSIONS));
+
+	if (zdl_registry_has_extension(w->registry, "EGL_KHR_swap_buffers_with_damage"))
+		w->SwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+			zdl_registry_get_proc(w->registry,
+					"eglSwapBuffersWithDamageKHR", zdl_egl_get_proc);
+
 	return 0;
 
 err_make:
@@ -546,23 +670,181 @@ err_displ:
 
 static void zdl_display_fini(zdl_window_t w)
 {
+	int i;
+
 	if (w->display != EGL_NO_DISPLAY) {
+		for (i = 0; i < ZDL_FRAMES_IN_FLIGHT_MAX; ++i) {
+			if (w->limiter.fences[i] != EGL_NO_SYNC_KHR)
+				w->limiter.DestroySync(w->display, w->limiter.fences[i]);
+			w->limiter.fences[i] = EGL_NO_SYNC_KHR;
+		}
 		eglMakeCurrent(w->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 		eglDestroyContext(w->display, w->context);
 		eglDestroySurface(w->display, w->surface);
 		eglTerminate(w->display);
 	}
+	zdl_registry_destroy(w->registry);
+	w->registry = NULL;
 	w->display = EGL_NO_DISPLAY;
 	w->context = EGL_NO_CONTEXT;
 	w->surface = EGL_NO_SURFACE;
 }
 
-void zdl_window_swap(zdl_window_t w)
+unsigned long long zdl_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void zdl_limiter_clear(zdl_window_t w)
 {
+	struct zdl_limiter *l = &w->limiter;
+	int i;
+
+	for (i = 0; i < ZDL_FRAMES_IN_FLIGHT_MAX; ++i) {
+		if (l->fences[i] != EGL_NO_SYNC_KHR)
+			l->DestroySync(w->display, l->fences[i]);
+		l->fences[i] = EGL_NO_SYNC_KHR;
+	}
+	l->head = 0;
+}
+
+static void zdl_limiter_wait(zdl_window_t w)
+{
+	struct zdl_limiter *l = &w->limiter;
+	EGLSyncKHR fence = l->fences[l->head];
+
+	/* the slot being reused holds the fence from max frames earlier */
+	if (fence != EGL_NO_SYNC_KHR) {
+		unsigned long long start = zdl_time_ns();
+
+		l->ClientWaitSync(w->display, fence,
+				EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 1000000000ULL);
+		l->DestroySync(w->display, fence);
+		w->pacer.waited += zdl_time_ns() - start;
+	}
+
+	l->fences[l->head] = l->CreateSync(w->display, EGL_SYNC_FENCE_KHR, NULL);
+	l->head = (l->head + 1) % l->max;
+}
+
+int zdl_window_set_max_frames_in_flight(zdl_window_t w, int n)
+{
+	struct zdl_limiter *l = &w->limiter;
+
+	if (n < 0 || n > ZDL_FRAMES_IN_FLIGHT_MAX)
+		return -1;
+	if (w->display == EGL_NO_DISPLAY)
+		return -1;
+
+	if (l->CreateSync == NULL) {
+		if (!zdl_registry_has_extension(w->registry, "EGL_KHR_fence_sync"))
+			return (n == 0) ? 0 : -1;
+		l->CreateSync = (PFNEGLCREATESYNCKHRPROC)
+			zdl_gl_get_proc(w, "eglCreateSyncKHR");
+		l->ClientWaitSync = (PFNEGLCLIENTWAITSYNCKHRPROC)
+			zdl_gl_get_proc(w, "eglClientWaitSyncKHR");
+		l->DestroySync = (PFNEGLDESTROYSYNCKHRPROC)
+			zdl_gl_get_proc(w, "eglDestroySyncKHR");
+	}
+
+	zdl_limiter_clear(w);
+	l->max = n;
+	return 0;
+}
+
+#define ZDL_DAMAGE_MAX 32
+
+static void zdl_window_present(zdl_window_t w, const struct zdl_rect *rects, int count)
+{
+	EGLint damage[ZDL_DAMAGE_MAX * 4];
+	int i;
+
 	if (w->display == EGL_NO_DISPLAY)
 		return;
 
-	eglSwapBuffers(w->display, w->surface);
+	if (w->pacer.hz != 0)
+		zdl_pacer_wait(&w->pacer);
+
+	if (rects != NULL && w->SwapBuffersWithDamage != NULL &&
+	    count <= ZDL_DAMAGE_MAX) {
+		/* EGL damage rectangles have a bottom-left origin */
+		for (i = 0; i < count; ++i) {
+			damage[i * 4 + 0] = rects[i].x;
+			damage[i * 4 + 1] = w->height - (rects[i].y + rects[i].height);
+			damage[i * 4 + 2] = rects[i].width;
+			damage[i * 4 + 3] = rects[i].height;
+		}
+		w->SwapBuffersWithDamage(w->display, w->surface, damage, count);
+	} else {
+		eglSwapBuffers(w->display, w->surface);
+	}
+
+	if (w->limiter.max != 0)
+		zdl_limiter_wait(w);
+	zdl_pacer_record(&w->pacer);
+}
+
+void zdl_window_swap(zdl_window_t w)
+{
+	zdl_window_present(w, NULL, 0);
+}
+
+int zdl_window_swap_with_damage(zdl_window_t w, const struct zdl_rect *rects, int count)
+{
+	/* EGL_KHR_swap_buffers_with_damage leaves the buffer EGL_BUFFER_DESTROYED */
+	zdl_window_present(w, rects, count);
+	return -1;
+}
+
+void zdl_window_set_target_rate(zdl_window_t w, unsigned int hz)
+{
+	zdl_pacer_set_rate(&w->pacer, hz);
+}
+
+void zdl_window_get_frame_stats(const zdl_window_t w, struct zdl_frame_stats *stats)
+{
+	zdl_pacer_get_stats(&w->pacer, stats);
+}
+
+int zdl_window_set_swap_queue(zdl_window_t w, int depth)
+{
+	/* XXX: the EGL surface can only be current on one thread, so a presenter
+	 * would need a second context rendering to a shared image; not done yet */
+	return (depth == 0) ? 0 : -1;
+}
+
+int zdl_window_swap_ready(zdl_window_t w)
+{
+	return 0;
+}
+
+unsigned int zdl_window_get_framebuffer(zdl_window_t w)
+{
+	return 0;
+}
+
+int zdl_window_set_render_size(zdl_window_t w, int width, int height, enum zdl_filter filter)
+{
+	/* XXX: ANativeWindow_setBuffersGeometry() could have the compositor
+	 * scale, but it only filters linearly; not done yet */
+	return (width == 0 && height == 0) ? 0 : -1;
+}
+
+int zdl_window_capture_begin(zdl_window_t w, enum zdl_pixel_format format)
+{
+	/* XXX: needs pixel buffer objects, which GLES2 does not have */
+	return -1;
+}
+
+int zdl_window_capture_poll(zdl_window_t w, struct zdl_capture_frame *frame)
+{
+	return -1;
+}
+
+void zdl_window_capture_end(zdl_window_t w)
+{
 }
 
 void zdl_window_set_title(zdl_window_t w, const char *icon, const char *name)
@@ -604,6 +886,125 @@ void zdl_window_set_title(zdl_window_t w, const char *icon, const char *name)
 	(*env)->DeleteLocalRef(env, oWindow);
 }
 
+int zdl_window_lock_pixels(zdl_window_t w, struct zdl_pixels *pixels)
+{
+	/* XXX: ANativeWindow_lock() would do, with ZDL_FLAG_PIXELS skipping
+	 * zdl_display_init(); not done yet */
+	return -1;
+}
+
+void zdl_window_unlock_pixels(zdl_window_t w)
+{
+}
+
+int zdl_window_is_unredirected(const zdl_window_t w)
+{
+	/* SurfaceFlinger decides on overlay use */
+	return 0;
+}
+
+#define ZDL_VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR 1000008000
+
+/* from vulkan_android.h, so the Vulkan headers are not needed to build */
+struct zdl_vk_android_surface_create_info {
+	int sType;
+	const void *pNext;
+	unsigned int flags;
+	ANativeWindow *window;
+};
+
+typedef void (*zdl_vk_void_function)(void);
+typedef zdl_vk_void_function (*zdl_vk_get_instance_proc_addr)(void *instance, const char *name);
+typedef int (*zdl_vk_create_android_surface)(void *instance,
+		const struct zdl_vk_android_surface_create_info *info,
+		const void *allocator, void *surface);
+
+const char *const *zdl_vulkan_get_instance_extensions(unsigned int *count)
+{
+	static const char *const extensions[] = {
+		"VK_KHR_surface",
+		"VK_KHR_android_surface",
+	};
+
+	*count = sizeof(extensions)/sizeof(extensions[0]);
+	return extensions;
+}
+
+int zdl_window_create_vulkan_surface(zdl_window_t w, void *instance, const void *allocator, void *surface)
+{
+	static void *loader;
+	struct zdl_vk_android_surface_create_info info;
+	zdl_vk_get_instance_proc_addr get_proc;
+	zdl_vk_create_android_surface create;
+
+	if (w->display != EGL_NO_DISPLAY) {
+		LOGE("Vulkan surface on a GL window; use ZDL_FLAG_NOGL");
+		return -1;
+	}
+	/* the surface is lost with the window; recreate it after EXPOSE */
+	if (w->native == NULL)
+		return -1;
+
+	if (loader == NULL)
+		loader = dlopen("libvulkan.so", RTLD_NOW | RTLD_LOCAL);
+	if (loader == NULL) {
+		LOGE("Unable to load Vulkan: %s", dlerror());
+		return -1;
+	}
+
+	get_proc = (zdl_vk_get_instance_proc_addr)dlsym(loader, "vkGetInstanceProcAddr");
+	if (get_proc == NULL)
+		return -1;
+	create = (zdl_vk_create_android_surface)get_proc(instance, "vkCreateAndroidSurfaceKHR");
+	if (create == NULL) {
+		LOGE("VK_KHR_android_surface not enabled on instance");
+		return -1;
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.sType = ZDL_VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR;
+	info.window = w->native;
+
+	/* VK_SUCCESS is 0 */
+	return create(instance, &info, allocator, surface) == 0 ? 0 : -1;
+}
+
+static int zdl_present_mode_supported(const enum zdl_present_mode *modes, int count,
+		enum zdl_present_mode mode)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (modes[i] == mode)
+			return 1;
+	}
+	return 0;
+}
+
+enum zdl_present_mode zdl_window_choose_present_mode(const zdl_window_t w,
+		const enum zdl_present_mode *modes, int count, int vsync)
+{
+	static const enum zdl_present_mode tearing[] = {
+		ZDL_PRESENT_IMMEDIATE,
+		ZDL_PRESENT_MAILBOX,
+		ZDL_PRESENT_FIFO_RELAXED,
+	};
+	int i;
+
+	if (vsync) {
+		if (zdl_window_is_unredirected(w) &&
+		    zdl_present_mode_supported(modes, count, ZDL_PRESENT_MAILBOX))
+			return ZDL_PRESENT_MAILBOX;
+		return ZDL_PRESENT_FIFO;
+	}
+
+	for (i = 0; i < sizeof(tearing)/sizeof(tearing[0]); ++i) {
+		if (zdl_present_mode_supported(modes, count, tearing[i]))
+			return tearing[i];
+	}
+	return ZDL_PRESENT_FIFO;
+}
+
 union zdl_native_handle zdl_window_native_handle(zdl_window_t w)
 {
 	union zdl_native_handle ret;
@@ -620,12 +1021,16 @@ static const struct {
 
 void zdl_window_set_flags(zdl_window_t w, zdl_flags_t flags)
 {
-	zdl_flags_t new = flags | ZDL_FLAG_FULLSCREEN | ZDL_FLAG_NORESIZE;
-	zdl_flags_t chg = new ^ w->flags;
+	zdl_flags_t new, chg;
 	unsigned int wflags_add = 0;
 	unsigned int wflags_rem = 0;
 	int i;
 
+	/* creation-only flags */
+	flags = (flags & ~ZDL_FLAG_NOGL) | (w->flags & ZDL_FLAG_NOGL);
+	new = flags | ZDL_FLAG_FULLSCREEN | ZDL_FLAG_NORESIZE;
+	chg = new ^ w->flags;
+
 	for (i = 0; i < sizeof(zdl_flag_mapping)/sizeof(zdl_flag_mapping[0]); ++i) {
 		if (!(chg & zdl_flag_mapping[i].flag))
 			continue;
@@ -668,8 +1073,10 @@ void zdl_window_warp_mouse(zdl_window_t w, int x, int y)
 { /* XXX: Android has no way to warp or hide the mouse cursor as of 2013-06-24 */ }
 
 struct zdl_clipboard {
+	zdl_window_t window;
 	struct zdl_jni *jni;
 	void *data;
+	struct zdl_clipboard_data result;
 };
 
 zdl_clipboard_t zdl_clipboard_open(zdl_window_t w)
@@ -677,10 +1084,11 @@ zdl_clipboard_t zdl_clipboard_open(zdl_window_t w)
 	struct zdl_jni *g = &g_zdl_jni;
 	zdl_clipboard_t b;
 
-	b = calloc(1, sizeof(*b));
+	b = zdl_calloc(1, sizeof(*b));
 	if (b == NULL)
 		return ZDL_CLIPBOARD_INVALID;
 
+	b->window = w;
 	b->jni = g;
 
 	return b;
@@ -688,9 +1096,8 @@ zdl_clipboard_t zdl_clipboard_open(zdl_window_t w)
 
 void zdl_clipboard_close(zdl_clipboard_t c)
 {
-	if (c->data != NULL)
-		free(c->data);
-	free(c);
+	zdl_free(c->data);
+	zdl_free(c);
 }
 
 /* TODO: add URI and Image support */
@@ -754,6 +1161,33 @@ int zdl_clipboard_write(zdl_clipboard_t c, const struct zdl_clipboard_data *data
 	return 0;
 }
 
+int zdl_clipboard_write_buffer(zdl_clipboard_t c, enum zdl_clipboard_format format,
+		const void *data, size_t size, zdl_clipboard_release_t release, void *user)
+{
+	struct zdl_clipboard_data d;
+	char *text;
+	int rc;
+
+	/* JNI wants a terminated string */
+	text = (char *)zdl_malloc(size + 1);
+	if (text == NULL)
+		return -1;
+	memcpy(text, data, size);
+	text[size] = '\0';
+
+	d.format = format;
+	if (format == ZDL_CLIPBOARD_URI)
+		d.uri.uri = text;
+	else
+		d.text.text = text;
+	rc = zdl_clipboard_write(c, &d);
+	zdl_free(text);
+
+	if (rc == 0 && release != NULL)
+		release(user, data);
+	return rc;
+}
+
 /* TODO: add URI and Image support */
 int zdl_clipboard_read(zdl_clipboard_t c, struct zdl_clipboard_data *data)
 {
@@ -806,12 +1240,11 @@ int zdl_clipboard_read(zdl_clipboard_t c, struct zdl_clipboard_data *data)
 			return -1;
 	}
 
-	if (c->data != NULL)
-		free(c->data);
+	zdl_free(c->data);
 
 	str = (*env)->GetStringUTFChars(env, text, 0);
 	data->format = ZDL_CLIPBOARD_TEXT;
-	data->text.text = strdup(str);
+	data->text.text = zdl_strdup(str);
 	c->data = (void *)data->text.text;
 	(*env)->ReleaseStringUTFChars(env, text, str);
 	(*env)->DeleteLocalRef(env, text);
@@ -833,11 +1266,12 @@ zdl_window_t zdl_window_create(int width, int height, zdl_flags_t flags)
 	if (g_zdl_app->window != ZDL_WINDOW_INVALID)
 		return ZDL_WINDOW_INVALID;
 
-	w = calloc(1, sizeof(struct zdl_window));
+	w = zdl_calloc(1, sizeof(struct zdl_window));
 	if (w == NULL)
 		return ZDL_WINDOW_INVALID;
 
 	zdl_queue_init(&w->queue);
+	w->flags = flags & ZDL_FLAG_NOGL;
 	zdl_window_set_flags(w, flags);
 
 	g_zdl_app->window = w;
@@ -846,7 +1280,13 @@ zdl_window_t zdl_window_create(int width, int height, zdl_flags_t flags)
 		zdl_window_wait_event(w, &ev);
 	} while (ev.type != ZDL_EVENT_EXPOSE);
 
-	zdl_display_init(w);
+	if (flags & ZDL_FLAG_NOGL) {
+		/* the swapchain sizes itself to the window */
+		w->width = ANativeWindow_getWidth(w->native);
+		w->height = ANativeWindow_getHeight(w->native);
+	} else {
+		zdl_display_init(w);
+	}
 	LOGD("-%s()", __func__);
 
 	return w;
@@ -858,7 +1298,8 @@ void zdl_window_destroy(zdl_window_t w)
 
 	zdl_display_fini(w);
 	zdl_queue_destroy(&w->queue);
-	free(w);
+	zdl_history_free(&w->history);
+	zdl_free(w);
 }
 
 static unsigned short zdl_key_uc(struct zdl_app *app, int meta, int keycode, int action)
@@ -996,6 +1437,34 @@ static const enum zdl_keysym zdl_keysyms[] = {
 	[AKEYCODE_BUTTON_MODE] = -1,
 };
 
+/* batched samples oldest first, then the current position; the input
+ * system's nanosecond times are cut down to milliseconds as on X11 */
+static void zdl_window_history_motion(zdl_window_t w, const AInputEvent *event,
+		int pointer, int nold, struct zdl_event *ev)
+{
+	struct zdl_history *h = &w->history;
+	int i;
+
+	if (zdl_history_reserve(h, nold + 1) != 0)
+		return;
+
+	for (i = 0; i < nold; ++i) {
+		h->x[i] = AMotionEvent_getHistoricalX(event, pointer, i);
+		h->y[i] = AMotionEvent_getHistoricalY(event, pointer, i);
+		h->time[i] = AMotionEvent_getHistoricalEventTime(event, i) / 1000000;
+	}
+	h->x[nold] = ev->motion.x;
+	h->y[nold] = ev->motion.y;
+	h->time[nold] = AMotionEvent_getEventTime(event) / 1000000;
+	h->count = nold + 1;
+
+	/* zdl_queue_push() copies the samples into the queued event */
+	ev->motion.history.count = h->count;
+	ev->motion.history.x = h->x;
+	ev->motion.history.y = h->y;
+	ev->motion.history.time = h->time;
+}
+
 static int zdl_app_handle_input(struct zdl_app *app, AInputEvent *event, int *handled)
 {
 	int type = AInputEvent_getType(event);
@@ -1021,6 +1490,10 @@ static int zdl_app_handle_input(struct zdl_app *app, AInputEvent *event, int *ha
 			ev.motion.y = AMotionEvent_getY(event, i);
 			ev.motion.id = AMotionEvent_getPointerId(event, i) + id_off;
 			ev.motion.flags = ZDL_MOTION_FLAG_NONE;
+			ev.motion.history.count = 0;
+			if (w != ZDL_WINDOW_INVALID && nold > 0 &&
+			    (w->flags & ZDL_FLAG_MOTION_HISTORY))
+				zdl_window_history_motion(w, event, i, nold, &ev);
 			switch (code) {
 			case AMOTION_EVENT_ACTION_DOWN:
 			case AMOTION_EVENT_ACTION_POINTER_DOWN:
@@ -1189,12 +1662,17 @@ static int zdl_app_handle_event(struct zdl_app *app, struct zdl_app_event *aev)
 		if (w != ZDL_WINDOW_INVALID)
 			w->native = aev->window.window;
 		ev.type = ZDL_EVENT_EXPOSE;
+		ev.expose.count = 0;
+		ev.expose.rects = NULL;
+		memset(&ev.expose.bounds, 0, sizeof(ev.expose.bounds));
 		zdl_window_queue_push(w, &ev);
 		break;
 	case ZDL_APP_WINDOW_DESTROYED:
 		app->internal.window = NULL;
 		if (w != ZDL_WINDOW_INVALID)
 			w->native = NULL;
+		ev.type = ZDL_EVENT_HIDE;
+		zdl_window_queue_push(w, &ev);
 		break;
 	case ZDL_APP_WINDOW_FOCUS_LOST:
 		ev.type = ZDL_EVENT_LOSEFOCUS;
@@ -1206,6 +1684,12 @@ static int zdl_app_handle_event(struct zdl_app *app, struct zdl_app_event *aev)
 		break;
 	case ZDL_APP_WINDOW_REDRAW_NEEDED:
 		ev.type = ZDL_EVENT_EXPOSE;
+		ev.expose.count = 0;
+		ev.expose.rects = NULL;
+		ev.expose.bounds.x = 0;
+		ev.expose.bounds.y = 0;
+		ev.expose.bounds.width = (w != ZDL_WINDOW_INVALID) ? w->width : 0;
+		ev.expose.bounds.height = (w != ZDL_WINDOW_INVALID) ? w->height : 0;
 		zdl_window_queue_push(w, &ev);
 		break;
 	case ZDL_APP_INPUT_QUEUE_DESTROYED:
@@ -1311,6 +1795,17 @@ static void *zdl_app_thread(void *param)
 	return NULL;
 }
 
+/* pop a queued event, noting an exit so later calls stop early */
+static int zdl_window_pop_event(zdl_window_t w, struct zdl_event *ev)
+{
+	if (zdl_queue_pop(&w->queue, ev) != 0)
+		return -1;
+	if (ev->type == ZDL_EVENT_EXIT)
+		w->shutdown = 1;
+	zdl_input_update(&w->input, ev);
+	return 0;
+}
+
 void zdl_window_wait_event(zdl_window_t w, struct zdl_event *ev)
 {
 	void *data;
@@ -1321,15 +1816,8 @@ void zdl_window_wait_event(zdl_window_t w, struct zdl_event *ev)
 		return;
 	}
 
-	for (;;) {
+	while (zdl_window_pop_event(w, ev) != 0)
 		ALooper_pollOnce(-1, NULL, &events, &data);
-
-		if (zdl_queue_pop(&w->queue, ev) == 0) {
-			if (ev->type == ZDL_EVENT_EXIT)
-				w->shutdown = 1;
-			return;
-		}
-	}
 }
 
 int zdl_window_poll_event(zdl_window_t w, struct zdl_event *ev)
@@ -1340,17 +1828,42 @@ int zdl_window_poll_event(zdl_window_t w, struct zdl_event *ev)
 	if (w->shutdown)
 		return -1;
 
+	if (zdl_window_pop_event(w, ev) == 0)
+		return 0;
+
 	while (ALooper_pollOnce(0, NULL, &events, &data) == ALOOPER_POLL_CALLBACK) {
-		if (zdl_queue_pop(&w->queue, ev) == 0) {
-			if (ev->type == ZDL_EVENT_EXIT)
-				w->shutdown = 1;
+		if (zdl_window_pop_event(w, ev) == 0)
 			return 0;
-		}
 	}
 
 	return -1;
 }
 
+int zdl_window_inject_event(zdl_window_t w, const struct zdl_event *ev)
+{
+	struct zdl_event copy = *ev;
+
+	zdl_window_queue_push(w, &copy);
+	return 0;
+}
+
+void zdl_window_get_input_state(const zdl_window_t w, struct zdl_input_state *state)
+{
+	*state = w->input;
+}
+
+int zdl_window_set_controllers(zdl_window_t w, int enabled)
+{
+	/* XXX: gamepad input arrives as AINPUT_SOURCE_JOYSTICK motion events, but
+	 * the button and axis layout is per device; not done yet */
+	return enabled ? -1 : 0;
+}
+
+int zdl_window_get_controller_name(zdl_window_t w, int id, char *name, size_t size)
+{
+	return -1;
+}
+
 static struct zdl_app *zdl_app_create(ANativeActivity *act,
 		void *savedState, size_t savedStateSize)
 {
@@ -1358,6 +1871,7 @@ static struct zdl_app *zdl_app_create(ANativeActivity *act,
 	struct zdl_app *app;
 
 	LOGD("+%s()", __func__);
+	/* created by the activity before main(), so not through zdl_malloc() */
 	app = calloc(1, sizeof(*app));
 	if (app == NULL)
 		return NULL;
@@ -1592,3 +2106,80 @@ void ANativeActivity_onCreate(ANativeActivity* act,
 	act->instance = zdl_app_create(act, savedState, savedStateSize);
 	zdl_jni_setup(act);
 }
+
+int zdl_clipboard_read_stream(zdl_clipboard_t c, unsigned int formats,
+		zdl_clipboard_chunk_t chunk, void *user, enum zdl_clipboard_format *format)
+{
+	struct zdl_clipboard_data data;
+	const char *text;
+
+	if (zdl_clipboard_read(c, &data))
+		return -1;
+	if (data.format == ZDL_CLIPBOARD_IMAGE ||
+	    !(formats & ZDL_CLIPBOARD_MASK(data.format)))
+		return -1;
+
+	text = data.format == ZDL_CLIPBOARD_URI ? data.uri.uri : data.text.text;
+	if (format != NULL)
+		*format = data.format;
+	return chunk(user, text, strlen(text));
+}
+
+void zdl_clipboard_set_timeout(zdl_clipboard_t c, unsigned int ms)
+{
+	/* reads never wait on another process */
+}
+
+struct zdl_clipboard_copy {
+	char *buffer;
+	size_t size;
+	size_t length;
+};
+
+static int zdl_clipboard_copy(void *user, const void *data, size_t size)
+{
+	struct zdl_clipboard_copy *cp = (struct zdl_clipboard_copy *)user;
+	size_t n;
+
+	if (cp->length < cp->size) {
+		n = cp->size - cp->length;
+		memcpy(cp->buffer + cp->length, data, n < size ? n : size);
+	}
+	cp->length += size;
+	return 0;
+}
+
+int zdl_clipboard_read_buffer(zdl_clipboard_t c, unsigned int formats,
+		void *buffer, size_t size, size_t *length, enum zdl_clipboard_format *format)
+{
+	struct zdl_clipboard_copy cp;
+
+	cp.buffer = (char *)buffer;
+	cp.size = size;
+	cp.length = 0;
+
+	if (zdl_clipboard_read_stream(c, formats, zdl_clipboard_copy, &cp, format))
+		return -1;
+	if (length != NULL)
+		*length = cp.length;
+	/* leave room for the terminator */
+	if (cp.length >= size)
+		return -1;
+	cp.buffer[cp.length] = '\0';
+	return 0;
+}
+
+int zdl_clipboard_read_async(zdl_clipboard_t c, unsigned int formats)
+{
+	struct zdl_event ev;
+
+	/* complete immediately, the event is delivered on the next poll */
+	ev.type = ZDL_EVENT_CLIPBOARD;
+	ev.clipboard.clipboard = c;
+	ev.clipboard.status = zdl_clipboard_read(c, &c->result);
+	if (ev.clipboard.status == 0 &&
+	    !(formats & ZDL_CLIPBOARD_MASK(c->result.format)))
+		ev.clipboard.status = -1;
+	ev.clipboard.data = ev.clipboard.status == 0 ? &c->result : NULL;
+	return zdl_window_inject_event(c->window, &ev);
+}
@@ -0,0 +1,487 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE /* pipe2() */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <linux/input.h>
+
+#include "zdl_alloc.h"
+#include "zdl_evdev.h"
+
+#define ZDL_EVDEV_DIR "/dev/input"
+#define ZDL_EVDEV_MAX 16
+#define ZDL_EVDEV_BATCH 64
+
+#define ZDL_BITS_LONGS(n) (((n) + 8 * sizeof(long) - 1) / (8 * sizeof(long)))
+#define zdl_bit_test(bits, n) \
+  (((bits)[(n) / (8 * sizeof(long))] >> ((n) % (8 * sizeof(long)))) & 1)
+
+struct zdl_evdev_device {
+	int fd;      /* -1 when the slot is free */
+	int dropped; /* SYN_DROPPED seen; skipping to the next SYN_REPORT */
+	int lost;    /* the sink refused an event; skipping to zdl_evdev_resync() */
+	char node[16];
+	char name[128];
+	unsigned long absbits[ZDL_BITS_LONGS(ABS_CNT)];
+	unsigned long keybits[ZDL_BITS_LONGS(KEY_CNT)];
+	unsigned long keys[ZDL_BITS_LONGS(KEY_CNT)];
+	struct { int min, max; } abs[ABS_CNT];
+};
+
+struct zdl_evdev {
+	pthread_t thread;
+	pthread_mutex_t lock; /* names, for zdl_evdev_get_name() */
+	int inotify;
+	int wake[2];          /* 'q' stops the reader thread, 'r' resyncs */
+	zdl_evdev_push_t push;
+	void *user;
+	struct zdl_evdev_device devices[ZDL_EVDEV_MAX];
+};
+
+/* scale to -32768..32767 from the device's range */
+static int zdl_evdev_scale(const struct zdl_evdev_device *d, int code, int value)
+{
+	long long range = (long long)d->abs[code].max - d->abs[code].min;
+
+	if (range <= 0)
+		return 0;
+	if (value < d->abs[code].min)
+		value = d->abs[code].min;
+	if (value > d->abs[code].max)
+		value = d->abs[code].max;
+	/* rounded, so a centred hat or stick reads 0 */
+	return (int)((((long long)value - d->abs[code].min) * 65535 + range / 2) / range) - 32768;
+}
+
+static int zdl_evdev_emit(struct zdl_evdev *e, enum zdl_event_type type, int id,
+		unsigned int code, int value, unsigned long long time)
+{
+	struct zdl_event ev;
+
+	ev.type = type;
+	ev.controller.id = id;
+	ev.controller.code = code;
+	ev.controller.value = value;
+	ev.controller.time = time;
+	if (e->push(e->user, &ev) == 0)
+		return 0;
+	if (type != ZDL_EVENT_CONTROLLER_ADDED && type != ZDL_EVENT_CONTROLLER_REMOVED)
+		e->devices[id].lost = 1;
+	return -1;
+}
+
+/* report current axis positions and any button changes, after opening or
+ * after the kernel or the sink dropped events; d->keys tracks what was
+ * reported, so a refused button is reported again on the next sync */
+static void zdl_evdev_sync(struct zdl_evdev *e, int id)
+{
+	struct zdl_evdev_device *d = &e->devices[id];
+	unsigned long keys[ZDL_BITS_LONGS(KEY_CNT)];
+	unsigned long long now = zdl_time_us();
+	struct input_absinfo info;
+	unsigned int code;
+
+	for (code = 0; code < ABS_CNT; ++code) {
+		if (!zdl_bit_test(d->absbits, code))
+			continue;
+		if (ioctl(d->fd, EVIOCGABS(code), &info) < 0)
+			continue;
+		if (zdl_evdev_emit(e, ZDL_EVENT_CONTROLLER_AXIS, id, code,
+				zdl_evdev_scale(d, code, info.value), now) != 0)
+			return;
+	}
+
+	memset(keys, 0, sizeof(keys));
+	if (ioctl(d->fd, EVIOCGKEY(sizeof(keys)), keys) < 0)
+		return;
+	for (code = BTN_MISC; code < KEY_CNT; ++code) {
+		if (!zdl_bit_test(d->keybits, code) ||
+		    zdl_bit_test(keys, code) == zdl_bit_test(d->keys, code))
+			continue;
+		if (zdl_evdev_emit(e, zdl_bit_test(keys, code) ?
+				ZDL_EVENT_CONTROLLER_BUTTONPRESS :
+				ZDL_EVENT_CONTROLLER_BUTTONRELEASE, id, code, 0, now) != 0)
+			return;
+		d->keys[code / (8 * sizeof(long))] ^= 1UL << (code % (8 * sizeof(long)));
+	}
+}
+
+static int zdl_evdev_find(struct zdl_evdev *e, const char *node)
+{
+	int i;
+
+	for (i = 0; i < ZDL_EVDEV_MAX; ++i) {
+		if (e->devices[i].fd >= 0 && strcmp(e->devices[i].node, node) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static void zdl_evdev_open(struct zdl_evdev *e, const char *node)
+{
+	unsigned long evbits[ZDL_BITS_LONGS(EV_CNT)];
+	struct zdl_evdev_device *d;
+	struct input_absinfo info;
+	int clock = CLOCK_MONOTONIC;
+	unsigned int code;
+	char path[64];
+	int joystick;
+	int fd;
+	int id;
+
+	if (strncmp(node, "event", 5) != 0 || strlen(node) >= sizeof(d->node) ||
+	    zdl_evdev_find(e, node) >= 0)
+		return;
+	for (id = 0; id < ZDL_EVDEV_MAX; ++id) {
+		if (e->devices[id].fd < 0)
+			break;
+	}
+	if (id == ZDL_EVDEV_MAX)
+		return;
+	d = &e->devices[id];
+
+	/* fails until udev has set up permissions; retried on IN_ATTRIB */
+	snprintf(path, sizeof(path), ZDL_EVDEV_DIR "/%s", node);
+	fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	memset(evbits, 0, sizeof(evbits));
+	memset(d->keybits, 0, sizeof(d->keybits));
+	memset(d->absbits, 0, sizeof(d->absbits));
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(evbits)), evbits) < 0 ||
+	    !zdl_bit_test(evbits, EV_KEY) ||
+	    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(d->keybits)), d->keybits) < 0) {
+		close(fd);
+		return;
+	}
+	if (zdl_bit_test(evbits, EV_ABS))
+		ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(d->absbits)), d->absbits);
+
+	/* joystick and gamepad buttons tell controllers from keyboards,
+	 * mice and touchscreens */
+	joystick = 0;
+	for (code = BTN_JOYSTICK; code < BTN_DIGI; ++code)
+		joystick |= zdl_bit_test(d->keybits, code);
+	if (!joystick) {
+		close(fd);
+		return;
+	}
+
+	/* timestamps on the zdl_time_us() base */
+	ioctl(fd, EVIOCSCLOCKID, &clock);
+
+	for (code = 0; code < ABS_CNT; ++code) {
+		d->abs[code].min = d->abs[code].max = 0;
+		if (zdl_bit_test(d->absbits, code) &&
+		    ioctl(fd, EVIOCGABS(code), &info) == 0) {
+			d->abs[code].min = info.minimum;
+			d->abs[code].max = info.maximum;
+		}
+	}
+
+	pthread_mutex_lock(&e->lock);
+	d->fd = fd;
+	d->dropped = 0;
+	d->lost = 0;
+	strcpy(d->node, node);
+	if (ioctl(fd, EVIOCGNAME(sizeof(d->name)), d->name) < 0)
+		strcpy(d->name, node);
+	d->name[sizeof(d->name) - 1] = '\0';
+	pthread_mutex_unlock(&e->lock);
+
+	memset(d->keys, 0, sizeof(d->keys));
+	zdl_evdev_emit(e, ZDL_EVENT_CONTROLLER_ADDED, id, 0, 0, zdl_time_us());
+	zdl_evdev_sync(e, id);
+}
+
+static void zdl_evdev_close(struct zdl_evdev *e, int id)
+{
+	struct zdl_evdev_device *d = &e->devices[id];
+
+	pthread_mutex_lock(&e->lock);
+	close(d->fd);
+	d->fd = -1;
+	pthread_mutex_unlock(&e->lock);
+
+	zdl_evdev_emit(e, ZDL_EVENT_CONTROLLER_REMOVED, id, 0, 0, zdl_time_us());
+}
+
+static void zdl_evdev_read(struct zdl_evdev *e, int id)
+{
+	struct zdl_evdev_device *d = &e->devices[id];
+	struct input_event batch[ZDL_EVDEV_BATCH];
+	unsigned long long time;
+	ssize_t n;
+	int i;
+
+	for (;;) {
+		n = read(d->fd, batch, sizeof(batch));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			/* ENODEV once unplugged */
+			if (errno != EAGAIN)
+				zdl_evdev_close(e, id);
+			return;
+		}
+
+		for (i = 0; i < n / (ssize_t)sizeof(batch[0]); ++i) {
+			const struct input_event *ie = &batch[i];
+
+			time = (unsigned long long)ie->input_event_sec * 1000000 +
+				ie->input_event_usec;
+			if (ie->type == EV_SYN) {
+				if (ie->code == SYN_DROPPED) {
+					d->dropped = 1;
+				} else if (ie->code == SYN_REPORT && d->dropped) {
+					d->dropped = 0;
+					/* a refused device waits for zdl_evdev_resync() */
+					if (!d->lost)
+						zdl_evdev_sync(e, id);
+				}
+				continue;
+			}
+			if (d->dropped || d->lost)
+				continue;
+
+			if (ie->type == EV_ABS && ie->code < ABS_CNT) {
+				zdl_evdev_emit(e, ZDL_EVENT_CONTROLLER_AXIS, id, ie->code,
+						zdl_evdev_scale(d, ie->code, ie->value), time);
+			} else if (ie->type == EV_KEY && ie->code >= BTN_MISC &&
+				   ie->code < KEY_CNT && ie->value != 2) {
+				if (zdl_evdev_emit(e, ie->value ?
+						ZDL_EVENT_CONTROLLER_BUTTONPRESS :
+						ZDL_EVENT_CONTROLLER_BUTTONRELEASE,
+						id, ie->code, 0, time) != 0)
+					continue;
+				if (ie->value)
+					d->keys[ie->code / (8 * sizeof(long))] |=
+						1UL << (ie->code % (8 * sizeof(long)));
+				else
+					d->keys[ie->code / (8 * sizeof(long))] &=
+						~(1UL << (ie->code % (8 * sizeof(long))));
+			}
+		}
+		if (n < (ssize_t)sizeof(batch))
+			return;
+	}
+}
+
+static void zdl_evdev_hotplug(struct zdl_evdev *e)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ie;
+	ssize_t n;
+	char *p;
+	int id;
+
+	while ((n = read(e->inotify, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + n; p += sizeof(*ie) + ie->len) {
+			ie = (const struct inotify_event *)p;
+			if (ie->len == 0)
+				continue;
+			if (ie->mask & (IN_CREATE | IN_ATTRIB)) {
+				zdl_evdev_open(e, ie->name);
+			} else if (ie->mask & IN_DELETE) {
+				id = zdl_evdev_find(e, ie->name);
+				if (id >= 0)
+					zdl_evdev_close(e, id);
+			}
+		}
+	}
+}
+
+/* returns !0 when asked to stop */
+static int zdl_evdev_wake(struct zdl_evdev *e)
+{
+	char buf[16];
+	ssize_t n;
+	int id;
+
+	n = read(e->wake[0], buf, sizeof(buf));
+	if (n <= 0 || memchr(buf, 'q', n) != NULL)
+		return 1;
+
+	for (id = 0; id < ZDL_EVDEV_MAX; ++id) {
+		if (e->devices[id].fd < 0 || !e->devices[id].lost)
+			continue;
+		e->devices[id].lost = 0;
+		/* mid-report after SYN_DROPPED; that SYN_REPORT syncs instead */
+		if (!e->devices[id].dropped)
+			zdl_evdev_sync(e, id);
+	}
+	return 0;
+}
+
+static void *zdl_evdev_thread(void *arg)
+{
+	struct zdl_evdev *e = (struct zdl_evdev *)arg;
+	struct pollfd pfd[ZDL_EVDEV_MAX + 2];
+	int map[ZDL_EVDEV_MAX + 2];
+	int i, n;
+
+	for (;;) {
+		pfd[0].fd = e->wake[0];
+		pfd[0].events = POLLIN;
+		pfd[1].fd = e->inotify;
+		pfd[1].events = POLLIN;
+		n = 2;
+		for (i = 0; i < ZDL_EVDEV_MAX; ++i) {
+			if (e->devices[i].fd < 0)
+				continue;
+			pfd[n].fd = e->devices[i].fd;
+			pfd[n].events = POLLIN;
+			map[n++] = i;
+		}
+
+		if (poll(pfd, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pfd[0].revents && zdl_evdev_wake(e))
+			break;
+
+		/* devices first; hotplug only changes the set */
+		for (i = 2; i < n; ++i) {
+			if (pfd[i].revents & POLLIN)
+				zdl_evdev_read(e, map[i]);
+			else if (pfd[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+				zdl_evdev_close(e, map[i]);
+		}
+		if (pfd[1].revents & POLLIN)
+			zdl_evdev_hotplug(e);
+	}
+	return NULL;
+}
+
+struct zdl_evdev *zdl_evdev_create(zdl_evdev_push_t push, void *user)
+{
+	struct zdl_evdev *e;
+	struct dirent *de;
+	DIR *dir;
+	int i;
+
+	e = (struct zdl_evdev *)zdl_calloc(1, sizeof(*e));
+	if (e == NULL)
+		return NULL;
+	e->push = push;
+	e->user = user;
+	for (i = 0; i < ZDL_EVDEV_MAX; ++i)
+		e->devices[i].fd = -1;
+
+	e->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (e->inotify < 0)
+		goto err_free;
+	if (inotify_add_watch(e->inotify, ZDL_EVDEV_DIR,
+			IN_CREATE | IN_ATTRIB | IN_DELETE) < 0)
+		goto err_inotify;
+	if (pipe2(e->wake, O_CLOEXEC) < 0)
+		goto err_inotify;
+	pthread_mutex_init(&e->lock, NULL);
+
+	/* watch first, so nothing plugged in meanwhile is missed */
+	dir = opendir(ZDL_EVDEV_DIR);
+	if (dir != NULL) {
+		while ((de = readdir(dir)) != NULL)
+			zdl_evdev_open(e, de->d_name);
+		closedir(dir);
+	}
+
+	if (pthread_create(&e->thread, NULL, zdl_evdev_thread, e) != 0)
+		goto err_devices;
+	return e;
+
+err_devices:
+	for (i = 0; i < ZDL_EVDEV_MAX; ++i) {
+		if (e->devices[i].fd >= 0)
+			close(e->devices[i].fd);
+	}
+	pthread_mutex_destroy(&e->lock);
+	close(e->wake[0]);
+	close(e->wake[1]);
+err_inotify:
+	close(e->inotify);
+err_free:
+	zdl_free(e);
+	return NULL;
+}
+
+void zdl_evdev_destroy(struct zdl_evdev *e)
+{
+	int i;
+
+	if (e == NULL)
+		return;
+
+	while (write(e->wake[1], "q", 1) < 0 && errno == EINTR);
+	pthread_join(e->thread, NULL);
+
+	for (i = 0; i < ZDL_EVDEV_MAX; ++i) {
+		if (e->devices[i].fd >= 0)
+			close(e->devices[i].fd);
+	}
+	pthread_mutex_destroy(&e->lock);
+	close(e->wake[0]);
+	close(e->wake[1]);
+	close(e->inotify);
+	zdl_free(e);
+}
+
+void zdl_evdev_resync(struct zdl_evdev *e)
+{
+	while (write(e->wake[1], "r", 1) < 0 && errno == EINTR);
+}
+
+int zdl_evdev_get_name(struct zdl_evdev *e, int id, char *name, size_t size)
+{
+	int rc = -1;
+
+	if (id < 0 || id >= ZDL_EVDEV_MAX || size == 0)
+		return -1;
+
+	pthread_mutex_lock(&e->lock);
+	if (e->devices[id].fd >= 0) {
+		snprintf(name, size, "%s", e->devices[id].name);
+		rc = 0;
+	}
+	pthread_mutex_unlock(&e->lock);
+	return rc;
+}
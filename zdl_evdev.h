@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Internal Linux evdev game controller support, shared between backends.
+ * A reader thread watches /dev/input for joysticks and gamepads and hands
+ * their events to the backend as soon as the kernel reports them. */
+
+#pragma once
+
+#include <stddef.h>
+
+#include "zdl.h"
+
+struct zdl_evdev;
+
+/** Event sink, called from the reader thread.
+ * A full sink refuses input rather than dropping events it already holds;
+ * the device then goes quiet until zdl_evdev_resync() reports its current
+ * state.  Added and removed events cannot be recovered that way, so the
+ * sink should keep room for them.
+ * @param user User data given to zdl_evdev_create().
+ * @param ev Controller event.
+ * @return 0 if queued, !0 if refused.
+ */
+typedef int (*zdl_evdev_push_t)(void *user, const struct zdl_event *ev);
+
+/** Start watching for controllers.
+ * Controllers already plugged in are reported as added right away.
+ * @param push Event sink.
+ * @param user User data for @p push.
+ * @return Watcher, or NULL if /dev/input cannot be watched.
+ */
+struct zdl_evdev *zdl_evdev_create(zdl_evdev_push_t push, void *user);
+
+/** Stop watching, joining the reader thread and closing all devices.
+ * @param e Watcher, may be NULL.
+ */
+void zdl_evdev_destroy(struct zdl_evdev *e);
+
+/** Report the current state of controllers whose events were refused.
+ * Call once the sink has room again; safe from any thread.
+ * @param e Watcher.
+ */
+void zdl_evdev_resync(struct zdl_evdev *e);
+
+/** Copy the name of a controller.
+ * @param e Watcher.
+ * @param id Controller identifier.
+ * @param name Buffer for the NUL-terminated name.
+ * @param size Size of @p name.
+ * @return 0 on success, -1 if no such controller is connected.
+ */
+int zdl_evdev_get_name(struct zdl_evdev *e, int id, char *name, size_t size);
@@ -0,0 +1,1157 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Headless backend: renders into an EGL pbuffer without any display server,
+ * for benchmarking and automated testing.  Input is supplied through
+ * zdl_window_inject_event(), and vertical refresh is simulated.
+ *
+ * Environment:
+ *   ZDL_HEADLESS_REFRESH  simulated refresh rate in Hz (default 60, 0 = off)
+ *   ZDL_HEADLESS_SCREEN   simulated screen size as WxH (default 1920x1080)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "zdl.h"
+#include "zdl_alloc.h"
+#include "zdl_evdev.h"
+#include "zdl_input.h"
+#include "zdl_pacer.h"
+#include "zdl_pixel.h"
+#include "zdl_registry.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+#define ZDL_FRAMES_IN_FLIGHT_MAX 8
+
+struct zdl_limiter {
+	int max;
+	int head;
+	GLsync fences[ZDL_FRAMES_IN_FLIGHT_MAX];
+};
+
+#define ZDL_CAPTURE_RING 3
+
+struct zdl_capture {
+	int active;
+	enum zdl_pixel_format format;
+	int head;
+	int pending;
+	unsigned int dropped;
+	struct {
+		GLuint pbo;
+		GLsync fence;
+		int width, height;
+	} slots[ZDL_CAPTURE_RING];
+	void *pixels;
+	size_t size;
+};
+
+struct zdl_gl {
+	struct zdl_registry *registry;
+	int major, minor;
+
+	int has_sync;
+	int has_pbo;
+
+	PFNGLFENCESYNCPROC FenceSync;
+	PFNGLCLIENTWAITSYNCPROC ClientWaitSync;
+	PFNGLDELETESYNCPROC DeleteSync;
+
+	PFNGLGENBUFFERSPROC GenBuffers;
+	PFNGLDELETEBUFFERSPROC DeleteBuffers;
+	PFNGLBINDBUFFERPROC BindBuffer;
+	PFNGLBUFFERDATAPROC BufferData;
+	PFNGLMAPBUFFERRANGEPROC MapBufferRange;
+	PFNGLUNMAPBUFFERPROC UnmapBuffer;
+};
+
+struct zdl_queue_item {
+	struct zdl_event data;
+	struct zdl_queue_item *next;
+};
+
+struct zdl_queue {
+	struct zdl_queue_item *head;
+	struct zdl_queue_item *tail;
+	struct zdl_queue_item *spare;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct zdl_window {
+	EGLDisplay display;
+	EGLConfig config;
+	EGLContext context;
+	EGLSurface surface;
+	struct zdl_gl gl;
+
+	int x, y;
+	int width, height;
+	struct {
+		int x, y;
+		int width, height;
+	} masked;
+	struct {
+		int width, height;
+	} screen;
+	zdl_flags_t flags;
+
+	struct {
+		unsigned int hz;
+		unsigned long long epoch;
+	} refresh;
+
+	struct { int x, y; } lastmotion;
+	struct zdl_input_state input;
+	struct zdl_queue queue;
+	struct zdl_evdev *evdev;
+	struct zdl_pacer pacer;
+	struct zdl_limiter limiter;
+	struct zdl_capture capture;
+
+	struct {
+		void *buffers[2];
+		int width, height;
+		int current;
+	} pixels;
+};
+
+static void zdl_queue_init(struct zdl_queue *q)
+{
+	q->head = q->tail = q->spare = NULL;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+}
+
+static int zdl_queue_push(struct zdl_queue *q, const struct zdl_event *ev)
+{
+	struct zdl_queue_item *item;
+
+	pthread_mutex_lock(&q->lock);
+	item = q->spare;
+	if (item != NULL) {
+		q->spare = item->next;
+	} else {
+		item = (struct zdl_queue_item *)zdl_malloc(sizeof(*item));
+		if (item == NULL) {
+			pthread_mutex_unlock(&q->lock);
+			return -1;
+		}
+	}
+	item->data = *ev;
+	item->next = NULL;
+
+	if (q->tail != NULL) {
+		q->tail->next = item;
+		q->tail = item;
+	} else {
+		q->tail = q->head = item;
+	}
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+static int zdl_queue_pop(struct zdl_queue *q, struct zdl_event *ev, int block)
+{
+	struct zdl_queue_item *item;
+
+	pthread_mutex_lock(&q->lock);
+	while (block && q->head == NULL)
+		pthread_cond_wait(&q->cond, &q->lock);
+	item = q->head;
+	if (item != NULL) {
+		q->head = q->head->next;
+		if (q->head == NULL)
+			q->tail = NULL;
+
+		*ev = item->data;
+		/* nodes are kept for reuse rather than freed */
+		item->next = q->spare;
+		q->spare = item;
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return item != NULL ? 0 : -1;
+}
+
+static void zdl_queue_destroy(struct zdl_queue *q)
+{
+	struct zdl_queue_item *item;
+	struct zdl_event ev;
+
+	while (zdl_queue_pop(q, &ev, 0) == 0);
+	while ((item = q->spare) != NULL) {
+		q->spare = item->next;
+		zdl_free(item);
+	}
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->lock);
+}
+
+unsigned long long zdl_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static const struct {
+	const char *name;
+	size_t offset;
+} zdl_gl_procs[] = {
+	{ "glFenceSync", offsetof(struct zdl_gl, FenceSync) },
+	{ "glClientWaitSync", offsetof(struct zdl_gl, ClientWaitSync) },
+	{ "glDeleteSync", offsetof(struct zdl_gl, DeleteSync) },
+	{ "glGenBuffers", offsetof(struct zdl_gl, GenBuffers) },
+	{ "glDeleteBuffers", offsetof(struct zdl_gl, DeleteBuffers) },
+	{ "glBindBuffer", offsetof(struct zdl_gl, BindBuffer) },
+	{ "glBufferData", offsetof(struct zdl_gl, BufferData) },
+	{ "glMapBufferRange", offsetof(struct zdl_gl, MapBufferRange) },
+	{ "glUnmapBuffer", offsetof(struct zdl_gl, UnmapBuffer) },
+};
+
+static int zdl_gl_supported(zdl_window_t w, int major, int minor, const char *ext)
+{
+	if (w->gl.major > major || (w->gl.major == major && w->gl.minor >= minor))
+		return 1;
+	return zdl_registry_has_extension(w->gl.registry, ext);
+}
+
+static void *zdl_egl_get_proc(const char *name)
+{
+	return (void *)eglGetProcAddress(name);
+}
+
+static void zdl_gl_load(zdl_window_t w)
+{
+	struct zdl_registry *r = w->gl.registry;
+	const char *version;
+	int i;
+
+	zdl_registry_add_extensions(r, eglQueryString(w->display, EGL_EXTENSIONS));
+	zdl_registry_add_extensions(r, (const char *)glGetString(GL_EXTENSIONS));
+
+	version = (const char *)glGetString(GL_VERSION);
+	if (version == NULL || sscanf(version, "%d.%d", &w->gl.major, &w->gl.minor) != 2)
+		w->gl.major = w->gl.minor = 0;
+
+	for (i = 0; i < sizeof(zdl_gl_procs)/sizeof(zdl_gl_procs[0]); ++i) {
+		void **proc = (void **)((char *)&w->gl + zdl_gl_procs[i].offset);
+		*proc = zdl_registry_get_proc(r, zdl_gl_procs[i].name, zdl_egl_get_proc);
+	}
+
+	w->gl.has_sync = zdl_gl_supported(w, 3, 2, "GL_ARB_sync") &&
+			w->gl.FenceSync != NULL;
+	/* the loader returns a stub for any name, so glMapBufferRange needs
+	 * its own version or extension check */
+	w->gl.has_pbo = zdl_gl_supported(w, 3, 0, "GL_ARB_pixel_buffer_object") &&
+			zdl_gl_supported(w, 3, 0, "GL_ARB_map_buffer_range") &&
+			w->gl.MapBufferRange != NULL;
+}
+
+int zdl_gl_has_extension(const zdl_window_t w, const char *name)
+{
+	return zdl_registry_has_extension(w->gl.registry, name);
+}
+
+void *zdl_gl_get_proc(zdl_window_t w, const char *name)
+{
+	return zdl_registry_get_proc(w->gl.registry, name, zdl_egl_get_proc);
+}
+
+static EGLDisplay zdl_display_open(zdl_window_t w)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC GetPlatformDisplay;
+	struct zdl_registry *r = w->gl.registry;
+
+	/* client extensions, which are queried without a display */
+	zdl_registry_add_extensions(r, eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS));
+	if (zdl_registry_has_extension(r, "EGL_MESA_platform_surfaceless")) {
+		GetPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+			zdl_registry_get_proc(r, "eglGetPlatformDisplayEXT", zdl_egl_get_proc);
+		if (GetPlatformDisplay != NULL)
+			return GetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+					EGL_DEFAULT_DISPLAY, NULL);
+	}
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+static int zdl_surface_create(zdl_window_t w, int width, int height)
+{
+	EGLint attrs[] = {
+		EGL_WIDTH, width,
+		EGL_HEIGHT, height,
+		EGL_NONE
+	};
+	EGLSurface surface;
+
+	surface = eglCreatePbufferSurface(w->display, w->config, attrs);
+	if (surface == EGL_NO_SURFACE) {
+		fprintf(stderr, "Unable to create EGL pbuffer (0x%x)\n", eglGetError());
+		return -1;
+	}
+
+	eglMakeCurrent(w->display, surface, surface, w->context);
+	if (w->surface != EGL_NO_SURFACE)
+		eglDestroySurface(w->display, w->surface);
+	w->surface = surface;
+	w->width = width;
+	w->height = height;
+	return 0;
+}
+
+static int zdl_display_init(zdl_window_t w)
+{
+	const EGLint attrs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_DEPTH_SIZE, 24,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_NONE
+	};
+	EGLint count;
+
+	w->gl.registry = zdl_registry_create();
+	if (w->gl.registry == NULL)
+		return -1;
+
+	w->display = zdl_display_open(w);
+	if (w->display == EGL_NO_DISPLAY) {
+		fprintf(stderr, "Unable to open EGL display\n");
+		goto err_registry;
+	}
+
+	if (!eglInitialize(w->display, NULL, NULL)) {
+		fprintf(stderr, "Unable to initialize EGL (0x%x)\n", eglGetError());
+		goto err_registry;
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_API) ||
+	    !eglChooseConfig(w->display, attrs, &w->config, 1, &count) ||
+	    count == 0) {
+		fprintf(stderr, "Unable to choose appropriate EGL config\n");
+		goto err_terminate;
+	}
+
+	w->context = eglCreateContext(w->display, w->config, EGL_NO_CONTEXT, NULL);
+	if (w->context == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Unable to create EGL context (0x%x)\n", eglGetError());
+		goto err_terminate;
+	}
+
+	w->surface = EGL_NO_SURFACE;
+	if (zdl_surface_create(w, w->width, w->height))
+		goto err_context;
+
+	zdl_gl_load(w);
+	return 0;
+
+err_context:
+	eglDestroyContext(w->display, w->context);
+err_terminate:
+	eglTerminate(w->display);
+err_registry:
+	zdl_registry_destroy(w->gl.registry);
+	return -1;
+}
+
+static void zdl_display_fini(zdl_window_t w)
+{
+	eglMakeCurrent(w->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroySurface(w->display, w->surface);
+	eglDestroyContext(w->display, w->context);
+	eglTerminate(w->display);
+	zdl_registry_destroy(w->gl.registry);
+}
+
+static void zdl_window_reconfigure(zdl_window_t w, int width, int height)
+{
+	struct zdl_event ev;
+
+	if (width <= 0 || height <= 0)
+		return;
+	if (width == w->width && height == w->height)
+		return;
+	if (zdl_surface_create(w, width, height))
+		return;
+
+	ev.type = ZDL_EVENT_RECONFIGURE;
+	ev.reconfigure.width = width;
+	ev.reconfigure.height = height;
+	zdl_queue_push(&w->queue, &ev);
+}
+
+zdl_window_t zdl_window_create(int width, int height, zdl_flags_t flags)
+{
+	zdl_window_t w;
+	struct zdl_event ev;
+	const char *env;
+
+	w = (zdl_window_t)zdl_calloc(1, sizeof(*w));
+	if (w == NULL)
+		return ZDL_WINDOW_INVALID;
+
+	w->screen.width = 1920;
+	w->screen.height = 1080;
+	env = getenv("ZDL_HEADLESS_SCREEN");
+	if (env != NULL)
+		sscanf(env, "%dx%d", &w->screen.width, &w->screen.height);
+
+	w->refresh.hz = 60;
+	env = getenv("ZDL_HEADLESS_REFRESH");
+	if (env != NULL)
+		w->refresh.hz = strtoul(env, NULL, 10);
+	w->refresh.epoch = zdl_time_ns();
+
+	if (width <= 0 || height <= 0) {
+		width = 640;
+		height = 480;
+	}
+	w->masked.width = w->width = width;
+	w->masked.height = w->height = height;
+	if (flags & ZDL_FLAG_FULLSCREEN) {
+		w->width = w->screen.width;
+		w->height = w->screen.height;
+	}
+	w->flags = flags & ~ZDL_FLAG_COPYONHL;
+
+	zdl_queue_init(&w->queue);
+
+	if (zdl_display_init(w)) {
+		zdl_queue_destroy(&w->queue);
+		zdl_free(w);
+		return ZDL_WINDOW_INVALID;
+	}
+
+	ev.type = ZDL_EVENT_EXPOSE;
+	ev.expose.count = 0;
+	ev.expose.rects = NULL;
+	ev.expose.bounds.x = 0;
+	ev.expose.bounds.y = 0;
+	ev.expose.bounds.width = w->width;
+	ev.expose.bounds.height = w->height;
+	zdl_queue_push(&w->queue, &ev);
+
+	return w;
+}
+
+void zdl_window_destroy(zdl_window_t w)
+{
+	zdl_window_set_controllers(w, 0);
+	zdl_window_capture_end(w);
+	zdl_window_set_max_frames_in_flight(w, 0);
+	zdl_free(w->pixels.buffers[0]);
+	zdl_free(w->pixels.buffers[1]);
+	zdl_display_fini(w);
+	zdl_queue_destroy(&w->queue);
+	zdl_free(w);
+}
+
+void zdl_window_set_title(zdl_window_t w, const char *icon, const char *name)
+{
+}
+
+void zdl_window_set_flags(zdl_window_t w, zdl_flags_t flags)
+{
+	flags &= ~ZDL_FLAG_COPYONHL;
+
+	if ((flags ^ w->flags) & ZDL_FLAG_FULLSCREEN) {
+		if (flags & ZDL_FLAG_FULLSCREEN) {
+			w->masked.x = w->x;
+			w->masked.y = w->y;
+			w->masked.width = w->width;
+			w->masked.height = w->height;
+			w->x = w->y = 0;
+			zdl_window_reconfigure(w, w->screen.width, w->screen.height);
+		} else {
+			w->x = w->masked.x;
+			w->y = w->masked.y;
+			zdl_window_reconfigure(w, w->masked.width, w->masked.height);
+		}
+	}
+	w->flags = flags;
+}
+
+zdl_flags_t zdl_window_get_flags(const zdl_window_t w)
+{
+	return w->flags;
+}
+
+void zdl_window_set_size(zdl_window_t w, int width, int height)
+{
+	if (w->flags & ZDL_FLAG_FULLSCREEN) {
+		w->masked.width = width;
+		w->masked.height = height;
+		return;
+	}
+	zdl_window_reconfigure(w, width, height);
+}
+
+void zdl_window_get_size(const zdl_window_t w, int *width, int *height)
+{
+	if (width != NULL)
+		*width = w->width;
+	if (height != NULL)
+		*height = w->height;
+}
+
+void zdl_window_set_position(zdl_window_t w, int x, int y)
+{
+	if (w->flags & ZDL_FLAG_FULLSCREEN) {
+		w->masked.x = x;
+		w->masked.y = y;
+		return;
+	}
+	w->x = x;
+	w->y = y;
+}
+
+void zdl_window_get_position(const zdl_window_t w, int *x, int *y)
+{
+	if (x != NULL)
+		*x = w->x;
+	if (y != NULL)
+		*y = w->y;
+}
+
+static void zdl_window_track_event(zdl_window_t w, struct zdl_event *ev)
+{
+	/* fill in deltas for injected pointer motion, as real backends do */
+	if (ev->type == ZDL_EVENT_MOTION && ev->motion.id == ZDL_MOTION_POINTER &&
+	    ev->motion.d_x == 0 && ev->motion.d_y == 0) {
+		ev->motion.d_x = ev->motion.x - w->lastmotion.x;
+		ev->motion.d_y = ev->motion.y - w->lastmotion.y;
+	}
+	if (ev->type == ZDL_EVENT_MOTION && ev->motion.id == ZDL_MOTION_POINTER) {
+		w->lastmotion.x = ev->motion.x;
+		w->lastmotion.y = ev->motion.y;
+	}
+	zdl_input_update(&w->input, ev);
+}
+
+int zdl_window_poll_event(zdl_window_t w, struct zdl_event *ev)
+{
+	if (zdl_queue_pop(&w->queue, ev, 0))
+		return -1;
+	zdl_window_track_event(w, ev);
+	return 0;
+}
+
+void zdl_window_wait_event(zdl_window_t w, struct zdl_event *ev)
+{
+	zdl_queue_pop(&w->queue, ev, 1);
+	zdl_window_track_event(w, ev);
+}
+
+int zdl_window_inject_event(zdl_window_t w, const struct zdl_event *ev)
+{
+	return zdl_queue_push(&w->queue, ev);
+}
+
+void zdl_window_get_input_state(const zdl_window_t w, struct zdl_input_state *state)
+{
+	*state = w->input;
+}
+
+/* called from the evdev reader thread */
+static int zdl_controller_push(void *user, const struct zdl_event *ev)
+{
+	zdl_window_t w = (zdl_window_t)user;
+
+	/* the queue grows, so nothing is refused and no resync is needed */
+	zdl_queue_push(&w->queue, ev);
+	return 0;
+}
+
+int zdl_window_set_controllers(zdl_window_t w, int enabled)
+{
+	if (!enabled) {
+		zdl_evdev_destroy(w->evdev);
+		w->evdev = NULL;
+		return 0;
+	}
+	if (w->evdev == NULL)
+		w->evdev = zdl_evdev_create(zdl_controller_push, w);
+	return w->evdev != NULL ? 0 : -1;
+}
+
+int zdl_window_get_controller_name(zdl_window_t w, int id, char *name, size_t size)
+{
+	if (w->evdev == NULL)
+		return -1;
+	return zdl_evdev_get_name(w->evdev, id, name, size);
+}
+
+void zdl_window_warp_mouse(zdl_window_t w, int x, int y)
+{
+	struct zdl_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = ZDL_EVENT_MOTION;
+	ev.motion.id = ZDL_MOTION_POINTER;
+	ev.motion.x = x;
+	ev.motion.y = y;
+	zdl_queue_push(&w->queue, &ev);
+}
+
+static void zdl_limiter_clear(zdl_window_t w)
+{
+	struct zdl_limiter *l = &w->limiter;
+	int i;
+
+	for (i = 0; i < ZDL_FRAMES_IN_FLIGHT_MAX; ++i) {
+		if (l->fences[i] != NULL)
+			w->gl.DeleteSync(l->fences[i]);
+		l->fences[i] = NULL;
+	}
+	l->head = 0;
+}
+
+static void zdl_limiter_wait(zdl_window_t w)
+{
+	struct zdl_limiter *l = &w->limiter;
+	GLsync fence = l->fences[l->head];
+
+	/* the slot being reused holds the fence from max frames earlier */
+	if (fence != NULL) {
+		unsigned long long start = zdl_time_ns();
+
+		w->gl.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+				1000000000ULL);
+		w->gl.DeleteSync(fence);
+		w->pacer.waited += zdl_time_ns() - start;
+	}
+
+	l->fences[l->head] = w->gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	l->head = (l->head + 1) % l->max;
+}
+
+int zdl_window_set_max_frames_in_flight(zdl_window_t w, int n)
+{
+	if (n < 0 || n > ZDL_FRAMES_IN_FLIGHT_MAX)
+		return -1;
+	if (n != 0 && !w->gl.has_sync)
+		return -1;
+
+	zdl_limiter_clear(w);
+	w->limiter.max = n;
+	return 0;
+}
+
+int zdl_window_set_render_size(zdl_window_t w, int width, int height, enum zdl_filter filter)
+{
+	/* XXX: only capture would see the difference; the X11 scaler's
+	 * framebuffer blit would port over; not done yet */
+	return (width == 0 && height == 0) ? 0 : -1;
+}
+
+static void zdl_capture_read(zdl_window_t w)
+{
+	struct zdl_capture *c = &w->capture;
+	const struct zdl_gl *gl = &w->gl;
+	int i;
+
+	if (c->pending == ZDL_CAPTURE_RING) {
+		c->dropped++;
+		return;
+	}
+
+	i = (c->head + c->pending) % ZDL_CAPTURE_RING;
+	gl->BindBuffer(GL_PIXEL_PACK_BUFFER, c->slots[i].pbo);
+	if (c->slots[i].width != w->width || c->slots[i].height != w->height) {
+		gl->BufferData(GL_PIXEL_PACK_BUFFER, w->width * w->height * 4,
+				NULL, GL_STREAM_READ);
+		c->slots[i].width = w->width;
+		c->slots[i].height = w->height;
+	}
+	/* BGRA is the native layout, so the driver can DMA without converting;
+	 * any swizzle is done on the CPU when the frame is collected */
+	glReadPixels(0, 0, w->width, w->height, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+	gl->BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	c->slots[i].fence = gl->FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	c->pending++;
+}
+
+int zdl_window_capture_begin(zdl_window_t w, enum zdl_pixel_format format)
+{
+	struct zdl_capture *c = &w->capture;
+	int i;
+
+	if (!w->gl.has_pbo || !w->gl.has_sync)
+		return -1;
+
+	if (!c->active) {
+		for (i = 0; i < ZDL_CAPTURE_RING; ++i) {
+			w->gl.GenBuffers(1, &c->slots[i].pbo);
+			c->slots[i].width = 0;
+			c->slots[i].height = 0;
+		}
+		c->head = 0;
+		c->pending = 0;
+		c->dropped = 0;
+		c->active = 1;
+	}
+	c->format = format;
+	return 0;
+}
+
+int zdl_window_capture_poll(zdl_window_t w, struct zdl_capture_frame *frame)
+{
+	struct zdl_capture *c = &w->capture;
+	const struct zdl_gl *gl = &w->gl;
+	unsigned int ops = ZDL_PIXEL_FLIP_Y;
+	size_t size;
+	void *src;
+	int i;
+
+	if (c->pending == 0)
+		return -1;
+
+	i = c->head;
+	if (gl->ClientWaitSync(c->slots[i].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) ==
+			GL_TIMEOUT_EXPIRED)
+		return -1;
+	gl->DeleteSync(c->slots[i].fence);
+	c->slots[i].fence = NULL;
+	c->head = (c->head + 1) % ZDL_CAPTURE_RING;
+	c->pending--;
+
+	size = c->slots[i].width * c->slots[i].height * 4;
+	if (size > c->size) {
+		void *pixels = zdl_realloc(c->pixels, size);
+		if (pixels == NULL)
+			return -1;
+		c->pixels = pixels;
+		c->size = size;
+	}
+
+	gl->BindBuffer(GL_PIXEL_PACK_BUFFER, c->slots[i].pbo);
+	src = gl->MapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (src == NULL) {
+		gl->BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return -1;
+	}
+	if (c->format == ZDL_PIXEL_RGBA8888)
+		ops |= ZDL_PIXEL_SWAP_RB;
+	zdl_pixel_convert(c->pixels, c->slots[i].width * 4,
+			src, c->slots[i].width * 4,
+			c->slots[i].width, c->slots[i].height, ops);
+	gl->UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	gl->BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	frame->pixels = c->pixels;
+	frame->width = c->slots[i].width;
+	frame->height = c->slots[i].height;
+	frame->stride = c->slots[i].width * 4;
+	frame->format = c->format;
+	frame->dropped = c->dropped;
+	c->dropped = 0;
+	return 0;
+}
+
+void zdl_window_capture_end(zdl_window_t w)
+{
+	struct zdl_capture *c = &w->capture;
+	int i;
+
+	if (!c->active)
+		return;
+
+	for (i = 0; i < ZDL_CAPTURE_RING; ++i) {
+		if (c->slots[i].fence != NULL)
+			w->gl.DeleteSync(c->slots[i].fence);
+		w->gl.DeleteBuffers(1, &c->slots[i].pbo);
+	}
+	zdl_free(c->pixels);
+	memset(c, 0, sizeof(*c));
+}
+
+static void zdl_refresh_wait(zdl_window_t w)
+{
+	unsigned long long period = 1000000000ULL / w->refresh.hz;
+	unsigned long long now = zdl_time_ns();
+	unsigned long long vblank;
+
+	/* block until the next simulated vertical blank, like a vsync'd swap */
+	vblank = now - (now - w->refresh.epoch) % period + period;
+	zdl_sleep_until(vblank);
+}
+
+void zdl_window_swap(zdl_window_t w)
+{
+	if (w->pacer.hz != 0)
+		zdl_pacer_wait(&w->pacer);
+
+	if (w->capture.active)
+		zdl_capture_read(w);
+
+	eglSwapBuffers(w->display, w->surface);
+	glFlush();
+	if (w->refresh.hz != 0)
+		zdl_refresh_wait(w);
+
+	if (w->limiter.max != 0)
+		zdl_limiter_wait(w);
+	zdl_pacer_record(&w->pacer);
+}
+
+int zdl_window_lock_pixels(zdl_window_t w, struct zdl_pixels *pixels)
+{
+	void **buffer = &w->pixels.buffers[w->pixels.current];
+
+	if (!(w->flags & ZDL_FLAG_PIXELS))
+		return -1;
+
+	if (w->pixels.width != w->width || w->pixels.height != w->height) {
+		zdl_free(w->pixels.buffers[0]);
+		zdl_free(w->pixels.buffers[1]);
+		w->pixels.buffers[0] = NULL;
+		w->pixels.buffers[1] = NULL;
+		w->pixels.width = w->width;
+		w->pixels.height = w->height;
+	}
+	if (*buffer == NULL)
+		*buffer = zdl_malloc(w->width * w->height * 4);
+	if (*buffer == NULL)
+		return -1;
+
+	pixels->pixels = *buffer;
+	pixels->width = w->width;
+	pixels->height = w->height;
+	pixels->stride = w->width * 4;
+	pixels->format = ZDL_PIXEL_BGRA8888;
+	return 0;
+}
+
+void zdl_window_unlock_pixels(zdl_window_t w)
+{
+	struct zdl_event ev;
+
+	if (w->pacer.hz != 0)
+		zdl_pacer_wait(&w->pacer);
+	if (w->refresh.hz != 0)
+		zdl_refresh_wait(w);
+
+	ev.type = ZDL_EVENT_PRESENTED;
+	zdl_queue_push(&w->queue, &ev);
+	w->pixels.current ^= 1;
+
+	zdl_pacer_record(&w->pacer);
+}
+
+int zdl_window_swap_with_damage(zdl_window_t w, const struct zdl_rect *rects, int count)
+{
+	/* nothing is presented, so damage does not matter */
+	zdl_window_swap(w);
+	return -1;
+}
+
+void zdl_window_set_target_rate(zdl_window_t w, unsigned int hz)
+{
+	zdl_pacer_set_rate(&w->pacer, hz);
+}
+
+void zdl_window_get_frame_stats(const zdl_window_t w, struct zdl_frame_stats *stats)
+{
+	zdl_pacer_get_stats(&w->pacer, stats);
+}
+
+int zdl_window_set_swap_queue(zdl_window_t w, int depth)
+{
+	/* XXX: the simulated vsync wait could move to a presenter thread with a
+	 * shared context, as on X11; not done yet */
+	return depth == 0 ? 0 : -1;
+}
+
+int zdl_window_swap_ready(zdl_window_t w)
+{
+	return 0;
+}
+
+unsigned int zdl_window_get_framebuffer(zdl_window_t w)
+{
+	return 0;
+}
+
+int zdl_window_is_unredirected(const zdl_window_t w)
+{
+	/* nothing composites a pbuffer */
+	return 1;
+}
+
+const char *const *zdl_vulkan_get_instance_extensions(unsigned int *count)
+{
+	/* XXX: VK_EXT_headless_surface would fit once ZDL_FLAG_NOGL skips the
+	 * pbuffer; not done yet */
+	*count = 0;
+	return NULL;
+}
+
+int zdl_window_create_vulkan_surface(zdl_window_t w, void *instance, const void *allocator, void *surface)
+{
+	return -1;
+}
+
+static int zdl_present_mode_supported(const enum zdl_present_mode *modes, int count,
+		enum zdl_present_mode mode)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (modes[i] == mode)
+			return 1;
+	}
+	return 0;
+}
+
+enum zdl_present_mode zdl_window_choose_present_mode(const zdl_window_t w,
+		const enum zdl_present_mode *modes, int count, int vsync)
+{
+	static const enum zdl_present_mode tearing[] = {
+		ZDL_PRESENT_IMMEDIATE,
+		ZDL_PRESENT_MAILBOX,
+		ZDL_PRESENT_FIFO_RELAXED,
+	};
+	int i;
+
+	if (vsync) {
+		if (zdl_window_is_unredirected(w) &&
+		    zdl_present_mode_supported(modes, count, ZDL_PRESENT_MAILBOX))
+			return ZDL_PRESENT_MAILBOX;
+		return ZDL_PRESENT_FIFO;
+	}
+
+	for (i = 0; i < sizeof(tearing)/sizeof(tearing[0]); ++i) {
+		if (zdl_present_mode_supported(modes, count, tearing[i]))
+			return tearing[i];
+	}
+	return ZDL_PRESENT_FIFO;
+}
+
+union zdl_native_handle zdl_window_native_handle(zdl_window_t w)
+{
+	union zdl_native_handle ret;
+	ret.ptr = (void *)w->surface;
+	return ret;
+}
+
+/* there is no window manager, so the clipboard is shared within the process */
+static pthread_mutex_t zdl_clipboard_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *zdl_clipboard_text;
+static enum zdl_clipboard_format zdl_clipboard_format;
+
+struct zdl_clipboard {
+	zdl_window_t window;
+	void *data;
+	struct zdl_clipboard_data result;
+};
+
+zdl_clipboard_t zdl_clipboard_open(zdl_window_t w)
+{
+	zdl_clipboard_t c;
+
+	c = (zdl_clipboard_t)zdl_calloc(1, sizeof(*c));
+	if (c == NULL)
+		return ZDL_CLIPBOARD_INVALID;
+
+	c->window = w;
+
+	return c;
+}
+
+void zdl_clipboard_close(zdl_clipboard_t c)
+{
+	if (c->data != NULL) {
+		zdl_free(c->data);
+		c->data = NULL;
+	}
+	zdl_free(c);
+}
+
+int zdl_clipboard_write_buffer(zdl_clipboard_t c, enum zdl_clipboard_format format,
+		const void *data, size_t size, zdl_clipboard_release_t release, void *user)
+{
+	char *text;
+
+	if (format != ZDL_CLIPBOARD_URI &&
+	    format != ZDL_CLIPBOARD_TEXT)
+		return -1;
+
+	/* the clipboard is shared between windows, so keep a copy; like a
+	 * system clipboard it outlives them, so it is not allocated through
+	 * the library's hooks */
+	text = (char *)malloc(size + 1);
+	if (text == NULL)
+		return -1;
+	memcpy(text, data, size);
+	text[size] = '\0';
+
+	pthread_mutex_lock(&zdl_clipboard_lock);
+	free(zdl_clipboard_text);
+	zdl_clipboard_text = text;
+	zdl_clipboard_format = format;
+	pthread_mutex_unlock(&zdl_clipboard_lock);
+
+	if (release != NULL)
+		release(user, data);
+	return 0;
+}
+
+int zdl_clipboard_write(zdl_clipboard_t c, const struct zdl_clipboard_data *data)
+{
+	const char *text;
+
+	if (data->format == ZDL_CLIPBOARD_URI)
+		text = data->uri.uri;
+	else if (data->format == ZDL_CLIPBOARD_TEXT)
+		text = data->text.text;
+	else
+		return -1;
+
+	return zdl_clipboard_write_buffer(c, data->format, text, strlen(text), NULL, NULL);
+}
+
+int zdl_clipboard_read(zdl_clipboard_t c, struct zdl_clipboard_data *data)
+{
+	if (c->data != NULL) {
+		zdl_free(c->data);
+		c->data = NULL;
+	}
+
+	pthread_mutex_lock(&zdl_clipboard_lock);
+	if (zdl_clipboard_text != NULL) {
+		c->data = zdl_strdup(zdl_clipboard_text);
+		data->format = zdl_clipboard_format;
+	}
+	pthread_mutex_unlock(&zdl_clipboard_lock);
+
+	if (c->data == NULL)
+		return -1;
+
+	if (data->format == ZDL_CLIPBOARD_URI)
+		data->uri.uri = (const char *)c->data;
+	else
+		data->text.text = (const char *)c->data;
+	return 0;
+}
+
+int zdl_clipboard_read_stream(zdl_clipboard_t c, unsigned int formats,
+		zdl_clipboard_chunk_t chunk, void *user, enum zdl_clipboard_format *format)
+{
+	struct zdl_clipboard_data data;
+	const char *text;
+
+	if (zdl_clipboard_read(c, &data))
+		return -1;
+	if (data.format == ZDL_CLIPBOARD_IMAGE ||
+	    !(formats & ZDL_CLIPBOARD_MASK(data.format)))
+		return -1;
+
+	text = data.format == ZDL_CLIPBOARD_URI ? data.uri.uri : data.text.text;
+	if (format != NULL)
+		*format = data.format;
+	return chunk(user, text, strlen(text));
+}
+
+void zdl_clipboard_set_timeout(zdl_clipboard_t c, unsigned int ms)
+{
+	/* reads never wait on another process */
+}
+
+struct zdl_clipboard_copy {
+	char *buffer;
+	size_t size;
+	size_t length;
+};
+
+static int zdl_clipboard_copy(void *user, const void *data, size_t size)
+{
+	struct zdl_clipboard_copy *cp = (struct zdl_clipboard_copy *)user;
+	size_t n;
+
+	if (cp->length < cp->size) {
+		n = cp->size - cp->length;
+		memcpy(cp->buffer + cp->length, data, n < size ? n : size);
+	}
+	cp->length += size;
+	return 0;
+}
+
+int zdl_clipboard_read_buffer(zdl_clipboard_t c, unsigned int formats,
+		void *buffer, size_t size, size_t *length, enum zdl_clipboard_format *format)
+{
+	struct zdl_clipboard_copy cp;
+
+	cp.buffer = (char *)buffer;
+	cp.size = size;
+	cp.length = 0;
+
+	if (zdl_clipboard_read_stream(c, formats, zdl_clipboard_copy, &cp, format))
+		return -1;
+	if (length != NULL)
+		*length = cp.length;
+	/* leave room for the terminator */
+	if (cp.length >= size)
+		return -1;
+	cp.buffer[cp.length] = '\0';
+	return 0;
+}
+
+int zdl_clipboard_read_async(zdl_clipboard_t c, unsigned int formats)
+{
+	struct zdl_event ev;
+
+	/* complete immediately, the event is delivered on the next poll */
+	ev.type = ZDL_EVENT_CLIPBOARD;
+	ev.clipboard.clipboard = c;
+	ev.clipboard.status = zdl_clipboard_read(c, &c->result);
+	if (ev.clipboard.status == 0 &&
+	    !(formats & ZDL_CLIPBOARD_MASK(c->result.format)))
+		ev.clipboard.status = -1;
+	ev.clipboard.data = ev.clipboard.status == 0 ? &c->result : NULL;
+	return zdl_window_inject_event(c->window, &ev);
+}
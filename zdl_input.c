@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "zdl_input.h"
+
+static int zdl_input_touch_find(const struct zdl_input_state *s, enum zdl_motion_id id)
+{
+	int i;
+
+	for (i = 0; i < s->touch_count; ++i) {
+		if (s->touches[i].id == id)
+			return i;
+	}
+	return -1;
+}
+
+static void zdl_input_touch(struct zdl_input_state *s, const struct zdl_event *ev)
+{
+	int i;
+
+	i = zdl_input_touch_find(s, ev->motion.id);
+	if (ev->motion.flags & ZDL_MOTION_FLAG_FINAL) {
+		if (i < 0)
+			return;
+		/* keep the remaining points in order of arrival */
+		memmove(&s->touches[i], &s->touches[i + 1],
+				(s->touch_count - i - 1) * sizeof(s->touches[0]));
+		s->touch_count--;
+		return;
+	}
+
+	if (i < 0) {
+		if (s->touch_count == ZDL_INPUT_TOUCH_MAX)
+			return;
+		i = s->touch_count++;
+		s->touches[i].id = ev->motion.id;
+	}
+	s->touches[i].x = ev->motion.x;
+	s->touches[i].y = ev->motion.y;
+}
+
+void zdl_input_update(struct zdl_input_state *s, const struct zdl_event *ev)
+{
+	unsigned int bit;
+
+	switch (ev->type) {
+	case ZDL_EVENT_KEYPRESS:
+	case ZDL_EVENT_KEYRELEASE:
+		s->modifiers = ev->key.modifiers;
+		if ((unsigned int)ev->key.sym >= sizeof(s->keys) * 8)
+			break;
+		bit = 1u << (ev->key.sym & 7);
+		if (ev->type == ZDL_EVENT_KEYPRESS)
+			s->keys[ev->key.sym >> 3] |= bit;
+		else
+			s->keys[ev->key.sym >> 3] &= ~bit;
+		break;
+	case ZDL_EVENT_BUTTONPRESS:
+	case ZDL_EVENT_BUTTONRELEASE:
+		s->modifiers = ev->button.modifiers;
+		s->x = ev->button.x;
+		s->y = ev->button.y;
+		if ((unsigned int)ev->button.button >= sizeof(s->buttons) * 8)
+			break;
+		bit = 1u << ev->button.button;
+		if (ev->type == ZDL_EVENT_BUTTONPRESS)
+			s->buttons |= bit;
+		else
+			s->buttons &= ~bit;
+		break;
+	case ZDL_EVENT_MOTION:
+		if (ev->motion.id == ZDL_MOTION_POINTER) {
+			if (!(ev->motion.flags & ZDL_MOTION_FLAG_RELATIVE)) {
+				s->x = ev->motion.x;
+				s->y = ev->motion.y;
+			}
+		} else if (ev->motion.id >= ZDL_MOTION_TOUCH_START &&
+			   ev->motion.id <= ZDL_MOTION_TOUCH_END) {
+			zdl_input_touch(s, ev);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void zdl_input_release_keys(struct zdl_input_state *s)
+{
+	memset(s->keys, 0, sizeof(s->keys));
+}
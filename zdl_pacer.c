@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+#define ZDL_INTERNAL
+#include "zdl.h"
+#include "zdl_pacer.h"
+
+#ifdef _WIN32
+/* Sleep() has millisecond granularity at best */
+#define ZDL_PACER_SPIN_MIN  1000000ULL
+#define ZDL_PACER_SPIN_MAX  4000000ULL
+#define ZDL_PACER_SPIN_INIT (ZDL_PACER_SPIN_MIN * 2)
+#else
+#define ZDL_PACER_SPIN_MIN    50000ULL
+#define ZDL_PACER_SPIN_MAX  2000000ULL
+#define ZDL_PACER_SPIN_INIT (ZDL_PACER_SPIN_MIN * 4)
+#endif
+
+unsigned long long zdl_time_us(void)
+{
+	return zdl_time_ns() / 1000;
+}
+
+void zdl_sleep_until(unsigned long long deadline)
+{
+#ifdef _WIN32
+	unsigned long long now = zdl_time_ns();
+
+	if (now < deadline)
+		Sleep((DWORD)((deadline - now) / 1000000ULL));
+#else
+	struct timespec ts;
+
+	ts.tv_sec = deadline / 1000000000ULL;
+	ts.tv_nsec = deadline % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#endif
+}
+
+void zdl_pacer_set_rate(struct zdl_pacer *p, unsigned int hz)
+{
+	p->hz = hz;
+	p->epoch = zdl_time_ns();
+	p->frame = 0;
+	if (p->spin == 0)
+		p->spin = ZDL_PACER_SPIN_INIT;
+}
+
+void zdl_pacer_wait(struct zdl_pacer *p)
+{
+	unsigned long long deadline;
+	unsigned long long now;
+
+	now = zdl_time_ns();
+	/* deadlines are computed from the epoch rather than accumulated, so
+	 * periods which are not a whole number of nanoseconds do not drift */
+	deadline = p->epoch + (p->frame * 1000000000ULL) / p->hz;
+	if (now > deadline + 1000000000ULL / p->hz) {
+		/* fell behind by more than a frame; don't try to catch up */
+		p->epoch = deadline = now;
+		p->frame = 0;
+	}
+	p->frame++;
+
+	if (now + p->spin < deadline) {
+		unsigned long long wake = deadline - p->spin;
+		unsigned long long late;
+
+		zdl_sleep_until(wake);
+
+		/* track scheduler wake-up latency to size the spin margin */
+		now = zdl_time_ns();
+		late = (now > wake) ? (now - wake) * 2 : 0;
+		if (late < ZDL_PACER_SPIN_MIN)
+			late = ZDL_PACER_SPIN_MIN;
+		if (late > ZDL_PACER_SPIN_MAX)
+			late = ZDL_PACER_SPIN_MAX;
+		p->spin = (p->spin * 7 + late) / 8;
+	}
+
+	while (zdl_time_ns() < deadline);
+}
+
+void zdl_pacer_record(struct zdl_pacer *p)
+{
+	unsigned long long now = zdl_time_ns();
+
+	if (p->last != 0) {
+		p->history[p->head] = (unsigned int)((now - p->last) / 1000);
+		p->waits[p->head] = (unsigned int)(p->waited / 1000);
+		p->head = (p->head + 1) % ZDL_FRAME_HISTORY;
+		if (p->count < ZDL_FRAME_HISTORY)
+			p->count++;
+	}
+	p->last = now;
+	p->waited = 0;
+}
+
+static int zdl_frame_cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+void zdl_pacer_get_stats(const struct zdl_pacer *p, struct zdl_frame_stats *stats)
+{
+	unsigned int sorted[ZDL_FRAME_HISTORY];
+	unsigned long long sum = 0;
+	unsigned long long wsum = 0;
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->target = p->hz ? 1000000 / p->hz : 0;
+	stats->frames = p->count;
+	if (p->count == 0)
+		return;
+
+	for (i = 0; i < p->count; ++i) {
+		sorted[i] = p->history[i];
+		sum += p->history[i];
+		wsum += p->waits[i];
+		if (p->waits[i] > stats->wait_max)
+			stats->wait_max = p->waits[i];
+	}
+	qsort(sorted, p->count, sizeof(sorted[0]), zdl_frame_cmp);
+
+	stats->mean = (unsigned int)(sum / p->count);
+	stats->wait = (unsigned int)(wsum / p->count);
+	stats->p50 = sorted[(p->count * 50) / 100];
+	stats->p90 = sorted[(p->count * 90) / 100];
+	stats->p99 = sorted[(p->count * 99) / 100];
+	stats->max = sorted[p->count - 1];
+}
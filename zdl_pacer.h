@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Internal frame pacing and frame time statistics, shared between backends.
+ * Each backend provides zdl_time_ns() on the clock its events are stamped
+ * with. */
+
+#pragma once
+
+#include "zdl.h"
+
+#define ZDL_FRAME_HISTORY 256
+
+struct zdl_pacer {
+	unsigned int hz;
+	unsigned long long epoch;
+	unsigned long long frame;
+	unsigned long long spin;   /* margin busy-waited after sleeping */
+	unsigned long long last;
+	unsigned long long waited; /* time spent waiting on the GPU this frame */
+	unsigned int history[ZDL_FRAME_HISTORY];
+	unsigned int waits[ZDL_FRAME_HISTORY];
+	unsigned int count;
+	unsigned int head;
+};
+
+/** Get the current time, provided by each backend.
+ * @return Monotonic time, in nanoseconds.
+ */
+unsigned long long zdl_time_ns(void);
+
+/** Sleep until a point in time.
+ * @param deadline Time to wake, from zdl_time_ns().
+ */
+void zdl_sleep_until(unsigned long long deadline);
+
+/** Set the target frame rate, restarting the deadline sequence.
+ * @param p Pacer.
+ * @param hz Frames per second, or 0 to disable pacing.
+ */
+void zdl_pacer_set_rate(struct zdl_pacer *p, unsigned int hz);
+
+/** Wait until the next frame deadline.
+ * @param p Pacer with a non-zero rate.
+ */
+void zdl_pacer_wait(struct zdl_pacer *p);
+
+/** Record the time of a presented frame.
+ * @param p Pacer.
+ */
+void zdl_pacer_record(struct zdl_pacer *p);
+
+/** Compute statistics over the recorded frames.
+ * @param p Pacer.
+ * @param stats Statistics to fill-out.
+ */
+void zdl_pacer_get_stats(const struct zdl_pacer *p, struct zdl_frame_stats *stats);
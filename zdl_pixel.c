@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ZDL_PIXEL_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ZDL_PIXEL_NEON
+#endif
+
+/* AVX2 kernels are built regardless of -march and picked at runtime */
+#if defined(ZDL_PIXEL_SSE2) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ZDL_PIXEL_AVX2
+#define ZDL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include "zdl_pixel.h"
+
+static void zdl_pixel_swap_rb_row(uint32_t *dst, const uint32_t *src, int width)
+{
+	int i = 0;
+
+#if defined(ZDL_PIXEL_SSE2)
+	const __m128i ga = _mm_set1_epi32(0xff00ff00);
+	const __m128i b = _mm_set1_epi32(0x000000ff);
+
+	for (; i + 4 <= width; i += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i rb = _mm_or_si128(
+				_mm_and_si128(_mm_srli_epi32(px, 16), b),
+				_mm_slli_epi32(_mm_and_si128(px, b), 16));
+		_mm_storeu_si128((__m128i *)&dst[i],
+				_mm_or_si128(_mm_and_si128(px, ga), rb));
+	}
+#elif defined(ZDL_PIXEL_NEON)
+	for (; i + 16 <= width; i += 16) {
+		uint8x16x4_t px = vld4q_u8((const uint8_t *)&src[i]);
+		uint8x16_t tmp = px.val[0];
+		px.val[0] = px.val[2];
+		px.val[2] = tmp;
+		vst4q_u8((uint8_t *)&dst[i], px);
+	}
+#endif
+
+	for (; i < width; ++i) {
+		uint32_t px = src[i];
+		dst[i] = (px & 0xff00ff00) | ((px >> 16) & 0xff) | ((px & 0xff) << 16);
+	}
+}
+
+void zdl_pixel_convert(void *dst, int dst_stride,
+		const void *src, int src_stride,
+		int width, int height, unsigned int ops)
+{
+	const unsigned char *s = (const unsigned char *)src;
+	unsigned char *d = (unsigned char *)dst;
+	int y;
+
+	if (ops & ZDL_PIXEL_FLIP_Y) {
+		s += (height - 1) * src_stride;
+		src_stride = -src_stride;
+	}
+
+	for (y = 0; y < height; ++y) {
+		if (ops & ZDL_PIXEL_SWAP_RB)
+			zdl_pixel_swap_rb_row((uint32_t *)d, (const uint32_t *)s, width);
+		else
+			memcpy(d, s, width * 4);
+		s += src_stride;
+		d += dst_stride;
+	}
+}
+
+static inline uint32_t zdl_pixel_swap_rb(uint32_t px)
+{
+	return (px & 0xff00ff00) | ((px >> 16) & 0xff) | ((px & 0xff) << 16);
+}
+
+/* Row kernels expanding pixels [i, width) to opaque ARGB8888. The scalar
+ * versions double as the tails of the vector ones. */
+typedef void (*zdl_pixel_expand_t)(uint32_t *dst, const uint8_t *src,
+		int i, int width, int swap);
+
+static void zdl_pixel_expand32(uint32_t *dst, const uint8_t *src, int i, int width, int swap)
+{
+	uint32_t px;
+
+	for (; i < width; ++i) {
+		memcpy(&px, &src[i * 4], 4);
+		px |= 0xff000000;
+		dst[i] = swap ? zdl_pixel_swap_rb(px) : px;
+	}
+}
+
+static void zdl_pixel_expand24(uint32_t *dst, const uint8_t *src, int i, int width, int swap)
+{
+	uint32_t px;
+
+	/* three bytes at a time, never past the end of the row */
+	for (; i < width; ++i) {
+		px = 0xff000000 |
+			((uint32_t)src[i * 3 + 2] << 16) |
+			((uint32_t)src[i * 3 + 1] << 8) |
+			 (uint32_t)src[i * 3 + 0];
+		dst[i] = swap ? zdl_pixel_swap_rb(px) : px;
+	}
+}
+
+static void zdl_pixel_expand16(uint32_t *dst, const uint8_t *src, int i, int width, int swap)
+{
+	uint32_t r, g, b;
+	uint16_t in;
+
+	/* RGB565, replicating the high bits into the low ones */
+	for (; i < width; ++i) {
+		memcpy(&in, &src[i * 2], 2);
+		r = (in >> 11) & 0x1f;
+		g = (in >> 5) & 0x3f;
+		b = in & 0x1f;
+		r = (r << 3) | (r >> 2);
+		g = (g << 2) | (g >> 4);
+		b = (b << 3) | (b >> 2);
+		if (swap)
+			dst[i] = 0xff000000 | (b << 16) | (g << 8) | r;
+		else
+			dst[i] = 0xff000000 | (r << 16) | (g << 8) | b;
+	}
+}
+
+static void zdl_pixel_expand8(uint32_t *dst, const uint8_t *src, int i, int width, int swap)
+{
+	/* greyscale, swapping is a no-op */
+	for (; i < width; ++i)
+		dst[i] = 0xff000000 | (src[i] * 0x010101u);
+}
+
+#if defined(ZDL_PIXEL_SSE2)
+static void zdl_pixel_expand32_sse2(uint32_t *dst, const uint8_t *src, int i, int width, int swap)
+{
+	const __m128i a = _mm_set1_epi32(0xff000000);
+	const __m128i ga = _mm_set1_epi32(0xff00ff00);
+	const __m128i b = _mm_set1_epi32(0x000000ff);
+	__m128i px;
+
+	for (; i + 4 <= width; i += 4) {
+		px = _mm_loadu_si128((const __m128i *)&src[i * 4]);
+		if (swap)
+			px = _mm_or_si128(_mm_and_si128(px, ga), _mm_or_si128(
+					_mm_and_si128(_mm_srli_epi32(px, 16), b),
+					_mm_slli_epi32(_mm_and_si128(px, b), 16)));
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_or_si128(px, a));
+	}
+	zdl_pixel_expand32(dst, src, i, width, swap);
+}
+
+static void zdl_pixel_expand16_sse2(uint32_t *dst, const uint8_t *src, int i, int width, int swap)
+{
+	const __m128i m5 = _mm_set1_epi16(0x1f);
+	const __m128i m6 = _mm_set1_epi16(0x3f);
+	const __m128i a = _mm_set1_epi16((short)0xff00);
+	__m128i px, r, g, b, lo, hi;
+
+	for (; i + 8 <= width; i += 8) {
+		px = _mm_loadu_si128((const __m128i *)&src[i * 2]);
+		r = _mm_srli_epi16(px, 11);
+		g = _mm_and_si128(_mm_srli_epi16(px, 5), m6);
+		b = _mm_and_si128(px, m5);
+		r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+		b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+		if (swap) {
+			px = r;
+			r = b;
+			b = px;
+		}
+		/* low half GB, high half AR */
+		lo = _mm_or_si128(_mm_slli_epi16(g, 8), b);
+		hi = _mm_or_si128(a, r);
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_unpacklo_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *)&dst[i + 4], _mm_unpackhi_epi16(lo, hi));
+	}
+	zdl_pixel_expand16(dst, src, i, width, swap);
+}
+
+static void zdl_pixel_expand8_sse2(uint32_t *dst, const uint8_t *src, int i, int width, int swap)
+{
+	const __m128i a = _mm_set1_epi8((char)0xff);
+	__m128i px, vv, va;
+
+	for (; i + 16 <= width; i += 16) {
+		px = _mm_loadu_si128((const __m128i *)&src[i]);
+		vv = _mm_unpacklo_epi8(px, px);
+		va = _mm_unpacklo_epi8(px, a);
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_unpacklo_epi16(vv, va));
+		_mm_storeu_si128((__m128i *)&dst[i + 4], _mm_unpackhi_epi16(vv, va));
+		vv = _mm_unpackhi_epi8(px, px);
+		va = _mm_unpackhi_epi8(px, a);
+		_mm_storeu_si128((__m128i *)&dst[i + 8], _mm_unpacklo_epi16(vv, va));
+		_mm_storeu_si128((__m128i *)&dst[i + 12], _mm_unpackhi_epi16(vv, va));
+	}
+	zdl_pixel_expand8(dst, src, i, width, swap);
+}
+#endif
+
+#if defined(ZDL_PIXEL_AVX2)
+ZDL_TARGET_AVX2
+static void zdl_pixel_expand32_avx2(uint32_t *dst, const uint8_t *src, int i, int width, int swap)
+{
+	const __m256i a = _mm256_set1_epi32(0xff000000);
+	const __m256i ga = _mm256_set1_epi32(0xff00ff00);
+	const __m256i b = _mm256_set1_epi32(0x000000ff);
+	__m256i px;
+
+	for (; i + 8 <= width; i += 8) {
+		px = _mm256_loadu_si256((const __m256i *)&src[i * 4]);
+		if (swap)
+			px = _mm256_or_si256(_mm256_and_si256(px, ga), _mm256_or_si256(
+					_mm256_and_si256(_mm256_srli_epi32(px, 16), b),
+					_mm256_slli_epi32(_mm256_and_si256(px, b), 16)));
+		_mm256_storeu_si256((__m256i *)&dst[i], _mm256_or_si256(px, a));
+	}
+	zdl_pixel_expand32(dst, src, i, width, swap);
+}
+
+ZDL_TARGET_AVX2
+static void zdl_pixel_expand24_avx2(uint32_t *dst, const uint8_t *src, int i, int width, int swap)
+{
+	const __m256i a = _mm256_set1_epi32(0xff000000);
+	const __m256i rgb = _mm256_setr_epi8(
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m256i bgr = _mm256_setr_epi8(
+			2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+			2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m256i shuf = swap ? bgr : rgb;
+	__m256i px;
+
+	/* each lane loads 16 bytes for 12, keep the last load inside the row */
+	for (; i + 10 <= width; i += 8) {
+		px = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i *)&src[i * 3])),
+				_mm_loadu_si128((const __m128i *)&src[i * 3 + 12]), 1);
+		px = _mm256_or_si256(_mm256_shuffle_epi8(px, shuf), a);
+		_mm256_storeu_si256((__m256i *)&dst[i], px);
+	}
+	zdl_pixel_expand24(dst, src, i, width, swap);
+}
+
+ZDL_TARGET_AVX2
+static void zdl_pixel_expand16_avx2(uint32_t *dst, const uint8_t *src, int i, int width, int swap)
+{
+	const __m256i m5 = _mm256_set1_epi16(0x1f);
+	const __m256i m6 = _mm256_set1_epi16(0x3f);
+	const __m256i a = _mm256_set1_epi16((short)0xff00);
+	__m256i px, r, g, b, lo, hi;
+
+	for (; i + 16 <= width; i += 16) {
+		px = _mm256_loadu_si256((const __m256i *)&src[i * 2]);
+		r = _mm256_srli_epi16(px, 11);
+		g = _mm256_and_si256(_mm256_srli_epi16(px, 5), m6);
+		b = _mm256_and_si256(px, m5);
+		r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+		g = _mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4));
+		b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+		if (swap) {
+			px = r;
+			r = b;
+			b = px;
+		}
+		lo = _mm256_or_si256(_mm256_slli_epi16(g, 8), b);
+		hi = _mm256_or_si256(a, r);
+		/* unpack works within 128-bit lanes, put the halves back in order */
+		px = _mm256_unpacklo_epi16(lo, hi);
+		hi = _mm256_unpackhi_epi16(lo, hi);
+		_mm256_storeu_si256((__m256i *)&dst[i], _mm256_permute2x128_si256(px, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)&dst[i + 8], _mm256_permute2x128_si256(px, hi, 0x31));
+	}
+	zdl_pixel_expand16(dst, src, i, width, swap);
+}
+#endif
+
+static zdl_pixel_expand_t zdl_pixel_expander(int bpp)
+{
+#if defined(ZDL_PIXEL_AVX2)
+	if (__builtin_cpu_supports("avx2")) {
+		switch (bpp) {
+		case 32: return zdl_pixel_expand32_avx2;
+		case 24: return zdl_pixel_expand24_avx2;
+		case 16: return zdl_pixel_expand16_avx2;
+		}
+	}
+#endif
+#if defined(ZDL_PIXEL_SSE2)
+	switch (bpp) {
+	case 32: return zdl_pixel_expand32_sse2;
+	case 16: return zdl_pixel_expand16_sse2;
+	case  8: return zdl_pixel_expand8_sse2;
+	}
+#endif
+	switch (bpp) {
+	case 32: return zdl_pixel_expand32;
+	case 24: return zdl_pixel_expand24;
+	case 16: return zdl_pixel_expand16;
+	case  8: return zdl_pixel_expand8;
+	}
+	return NULL;
+}
+
+/* layouts with a kernel above, by their masks */
+static const struct {
+	struct zdl_pixel_layout layout;
+	int swap;
+} zdl_pixel_layouts[] = {
+	{ { 32, 0xff0000, 0x00ff00, 0x0000ff }, 0 },
+	{ { 32, 0x0000ff, 0x00ff00, 0xff0000 }, 1 },
+	{ { 24, 0xff0000, 0x00ff00, 0x0000ff }, 0 },
+	{ { 24, 0x0000ff, 0x00ff00, 0xff0000 }, 1 },
+	{ { 16, 0xf800,   0x07e0,   0x001f   }, 0 },
+	{ { 16, 0x001f,   0x07e0,   0xf800   }, 1 },
+};
+
+struct zdl_pixel_channel {
+	uint32_t mask;
+	int shift;
+	uint8_t scale[256];
+};
+
+static int zdl_pixel_channel_init(struct zdl_pixel_channel *c, uint32_t mask)
+{
+	uint32_t v, hi;
+	int bits, s;
+
+	c->mask = mask;
+	c->shift = 0;
+	memset(c->scale, 0, sizeof(c->scale));
+	if (mask == 0)
+		return 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		c->shift++;
+	}
+	/* contiguous and no wider than the 8 bits it expands to */
+	if ((mask & (mask + 1)) != 0 || mask > 0xff)
+		return -1;
+
+	/* replicate the high bits into the low ones, as the RGB565 kernels do */
+	for (bits = 0; (1u << bits) <= mask; ++bits)
+		;
+	for (v = 0; v <= mask; ++v) {
+		hi = v << (8 - bits);
+		c->scale[v] = hi;
+		for (s = bits; s < 8; s += bits)
+			c->scale[v] |= hi >> s;
+	}
+	return 0;
+}
+
+/* any layout, scaling each channel to 8 bits through its mask */
+static void zdl_pixel_expand_masked(uint32_t *dst, const uint8_t *src, int width,
+		int bytes, const struct zdl_pixel_channel *ch)
+{
+	uint32_t px;
+	int i, k;
+
+	for (i = 0; i < width; ++i) {
+		px = 0;
+		for (k = 0; k < bytes; ++k)
+			px |= (uint32_t)src[i * bytes + k] << (8 * k);
+		dst[i] = 0xff000000 |
+			((uint32_t)ch[0].scale[(px & ch[0].mask) >> ch[0].shift] << 16) |
+			((uint32_t)ch[1].scale[(px & ch[1].mask) >> ch[1].shift] << 8) |
+			 (uint32_t)ch[2].scale[(px & ch[2].mask) >> ch[2].shift];
+	}
+}
+
+int zdl_pixel_expand(void *dst, int dst_stride,
+		const void *src, int src_stride,
+		int width, int height, const struct zdl_pixel_layout *layout,
+		unsigned int ops)
+{
+	struct zdl_pixel_channel ch[3];
+	zdl_pixel_expand_t expand = NULL;
+	const uint8_t *s = (const uint8_t *)src;
+	uint8_t *d = (uint8_t *)dst;
+	int bpp = layout->bpp;
+	int swap = 0;
+	int i, y;
+
+	if (bpp == 8 || (layout->red | layout->green | layout->blue) == 0) {
+		/* greyscale, or the default order of the depth */
+		expand = zdl_pixel_expander(bpp);
+		if (expand == NULL)
+			return -1;
+	} else {
+		for (i = 0; i < sizeof(zdl_pixel_layouts)/sizeof(zdl_pixel_layouts[0]); ++i) {
+			if (zdl_pixel_layouts[i].layout.bpp == bpp &&
+			    zdl_pixel_layouts[i].layout.red == layout->red &&
+			    zdl_pixel_layouts[i].layout.green == layout->green &&
+			    zdl_pixel_layouts[i].layout.blue == layout->blue) {
+				expand = zdl_pixel_expander(bpp);
+				swap = zdl_pixel_layouts[i].swap;
+				break;
+			}
+		}
+		if (expand == NULL) {
+			if (bpp != 32 && bpp != 24 && bpp != 16)
+				return -1;
+			if (zdl_pixel_channel_init(&ch[0], layout->red) ||
+			    zdl_pixel_channel_init(&ch[1], layout->green) ||
+			    zdl_pixel_channel_init(&ch[2], layout->blue))
+				return -1;
+		}
+	}
+	if (ops & ZDL_PIXEL_FLIP_Y) {
+		s += (height - 1) * src_stride;
+		src_stride = -src_stride;
+	}
+
+	for (y = 0; y < height; ++y) {
+		if (expand != NULL)
+			expand((uint32_t *)d, s, 0, width, swap);
+		else
+			zdl_pixel_expand_masked((uint32_t *)d, s, width, bpp / 8, ch);
+		s += src_stride;
+		d += dst_stride;
+	}
+	return 0;
+}
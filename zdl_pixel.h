@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Internal pixel conversion helpers shared between backends. */
+
+#pragma once
+
+/** Reverse row order */
+#define ZDL_PIXEL_FLIP_Y  (1 << 0)
+/** Swap the first and third byte of each 32-bit pixel (RGBA <-> BGRA) */
+#define ZDL_PIXEL_SWAP_RB (1 << 1)
+
+/** Copy a block of 32-bit pixels, applying conversion operations.
+ * @param dst Destination pixels.
+ * @param dst_stride Destination row length in bytes.
+ * @param src Source pixels.
+ * @param src_stride Source row length in bytes.
+ * @param width Width in pixels.
+ * @param height Height in rows.
+ * @param ops Mask of ZDL_PIXEL_* operations.
+ */
+void zdl_pixel_convert(void *dst, int dst_stride,
+		const void *src, int src_stride,
+		int width, int height, unsigned int ops);
+
+/** Packed source pixel layout, as described by an X image or visual */
+struct zdl_pixel_layout {
+	int bpp;           /**< Bits per pixel: 32, 24, 16 or 8 */
+	unsigned int red;  /**< Channel masks; all 0 for xRGB or RGB565 */
+	unsigned int green;
+	unsigned int blue;
+};
+
+/** Expand a block of packed pixels to opaque ARGB8888.
+ * Sources are 32, 24 or 16 bpp with any channel masks of up to 8 bits each,
+ * or 8 bpp greyscale, least significant byte first. xRGB, xBGR, RGB565 and
+ * BGR565 have fast paths; other layouts, such as the x555 of depth 15
+ * visuals, are decoded through the masks. When the source is 32 bpp the
+ * destination may alias it, provided no destination row starts after its
+ * source row.
+ * @param dst Destination pixels.
+ * @param dst_stride Destination row length in bytes.
+ * @param src Source pixels.
+ * @param src_stride Source row length in bytes.
+ * @param width Width in pixels.
+ * @param height Height in rows.
+ * @param layout Source pixel layout.
+ * @param ops Mask of ZDL_PIXEL_* operations; only ZDL_PIXEL_FLIP_Y applies,
+ *            as the masks give the channel order.
+ * @return 0 on success, !0 if the layout is not supported.
+ */
+int zdl_pixel_expand(void *dst, int dst_stride,
+		const void *src, int src_stride,
+		int width, int height, const struct zdl_pixel_layout *layout,
+		unsigned int ops);
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "zdl_alloc.h"
+#include "zdl_registry.h"
+
+#define ZDL_REGISTRY_BUCKETS 512
+
+struct zdl_registry_entry {
+	struct zdl_registry_entry *next;
+	unsigned int hash;
+	void *proc;
+	char name[];
+};
+
+struct zdl_registry {
+	struct zdl_registry_entry *extensions[ZDL_REGISTRY_BUCKETS];
+	struct zdl_registry_entry *procs[ZDL_REGISTRY_BUCKETS];
+};
+
+/* FNV-1a */
+static unsigned int zdl_registry_hash(const char *name, size_t len)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static struct zdl_registry_entry *zdl_registry_find(struct zdl_registry_entry *const *table,
+		const char *name, size_t len, unsigned int hash)
+{
+	struct zdl_registry_entry *e;
+
+	for (e = table[hash % ZDL_REGISTRY_BUCKETS]; e != NULL; e = e->next) {
+		if (e->hash == hash && strncmp(e->name, name, len) == 0 &&
+		    e->name[len] == '\0')
+			return e;
+	}
+	return NULL;
+}
+
+static struct zdl_registry_entry *zdl_registry_insert(struct zdl_registry_entry **table,
+		const char *name, size_t len, unsigned int hash)
+{
+	struct zdl_registry_entry *e;
+
+	e = (struct zdl_registry_entry *)zdl_malloc(sizeof(*e) + len + 1);
+	if (e == NULL)
+		return NULL;
+	memcpy(e->name, name, len);
+	e->name[len] = '\0';
+	e->hash = hash;
+	e->proc = NULL;
+	e->next = table[hash % ZDL_REGISTRY_BUCKETS];
+	table[hash % ZDL_REGISTRY_BUCKETS] = e;
+	return e;
+}
+
+struct zdl_registry *zdl_registry_create(void)
+{
+	return (struct zdl_registry *)zdl_calloc(1, sizeof(struct zdl_registry));
+}
+
+static void zdl_registry_clear(struct zdl_registry_entry **table)
+{
+	struct zdl_registry_entry *e;
+	int i;
+
+	for (i = 0; i < ZDL_REGISTRY_BUCKETS; ++i) {
+		while ((e = table[i]) != NULL) {
+			table[i] = e->next;
+			zdl_free(e);
+		}
+	}
+}
+
+void zdl_registry_destroy(struct zdl_registry *r)
+{
+	if (r == NULL)
+		return;
+	zdl_registry_clear(r->extensions);
+	zdl_registry_clear(r->procs);
+	zdl_free(r);
+}
+
+void zdl_registry_add_extensions(struct zdl_registry *r, const char *list)
+{
+	const char *end;
+	unsigned int hash;
+	size_t len;
+
+	if (list == NULL)
+		return;
+
+	for (;;) {
+		while (*list == ' ')
+			list++;
+		if (*list == '\0')
+			break;
+		end = strchr(list, ' ');
+		len = (end != NULL) ? (size_t)(end - list) : strlen(list);
+
+		hash = zdl_registry_hash(list, len);
+		if (zdl_registry_find(r->extensions, list, len, hash) == NULL)
+			zdl_registry_insert(r->extensions, list, len, hash);
+		list += len;
+	}
+}
+
+int zdl_registry_has_extension(const struct zdl_registry *r, const char *name)
+{
+	size_t len = strlen(name);
+
+	if (r == NULL)
+		return 0;
+	return zdl_registry_find(r->extensions, name, len,
+			zdl_registry_hash(name, len)) != NULL;
+}
+
+void *zdl_registry_get_proc(struct zdl_registry *r, const char *name, zdl_proc_loader_t load)
+{
+	struct zdl_registry_entry *e;
+	size_t len = strlen(name);
+	unsigned int hash = zdl_registry_hash(name, len);
+
+	if (r == NULL)
+		return NULL;
+
+	e = zdl_registry_find(r->procs, name, len, hash);
+	if (e == NULL) {
+		e = zdl_registry_insert(r->procs, name, len, hash);
+		if (e == NULL)
+			return load(name);
+		e->proc = load(name);
+	}
+	return e->proc;
+}
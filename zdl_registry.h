@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Internal registry of GL extensions and resolved entry points, shared
+ * between backends. Lookups are O(1); a registry is not thread-safe. */
+
+#pragma once
+
+struct zdl_registry;
+
+/** Entry point lookup, e.g. glXGetProcAddress. */
+typedef void *(*zdl_proc_loader_t)(const char *name);
+
+/** Create an empty registry.
+ * @return Registry, or NULL on allocation failure.
+ */
+struct zdl_registry *zdl_registry_create(void);
+
+/** Destroy a registry.
+ * @param r Registry, may be NULL.
+ */
+void zdl_registry_destroy(struct zdl_registry *r);
+
+/** Add a space separated list of extensions, as returned by glGetString().
+ * @param r Registry.
+ * @param list Extension list, may be NULL.
+ */
+void zdl_registry_add_extensions(struct zdl_registry *r, const char *list);
+
+/** Check whether an extension was added.
+ * @param r Registry, may be NULL.
+ * @param name Extension name.
+ * @return !0 if present, 0 otherwise.
+ */
+int zdl_registry_has_extension(const struct zdl_registry *r, const char *name);
+
+/** Resolve an entry point, caching the result (including failure).
+ * @param r Registry, may be NULL.
+ * @param name Entry point name.
+ * @param load Lookup used on the first request for @p name.
+ * @return Entry point address, or NULL.
+ */
+void *zdl_registry_get_proc(struct zdl_registry *r, const char *name, zdl_proc_loader_t load);
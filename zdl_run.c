@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2012, Courtney Cavin
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+
+#define ZDL_INTERNAL
+#include "zdl.h"
+
+#define ZDL_RUN_UPDATE_HZ 60
+#define ZDL_RUN_MAX_UPDATES 5
+
+struct zdl_runner {
+	const struct zdl_run_callbacks *cb;
+	struct zdl_run_stats *stats;
+	unsigned long long busy; /* total time spent in updates */
+	int hidden;
+};
+
+/* returns !0 to stop */
+static int zdl_run_event(struct zdl_runner *r, const struct zdl_event *ev)
+{
+	switch (ev->type) {
+	case ZDL_EVENT_HIDE:
+		r->hidden = 1;
+		break;
+	case ZDL_EVENT_EXPOSE:
+		/* not RECONFIGURE: X configures unmapped windows too */
+		r->hidden = 0;
+		break;
+	default:
+		break;
+	}
+
+	if (r->cb->event != NULL)
+		return r->cb->event(r->cb->user, ev);
+	return ev->type == ZDL_EVENT_EXIT || ev->type == ZDL_EVENT_ERROR;
+}
+
+static void zdl_run_update(struct zdl_runner *r, double dt)
+{
+	struct zdl_run_stats *s = r->stats;
+	unsigned long long start;
+	unsigned int took;
+
+	start = zdl_time_us();
+	if (r->cb->update != NULL)
+		r->cb->update(r->cb->user, dt);
+	took = (unsigned int)(zdl_time_us() - start);
+
+	r->busy += took;
+	s->updates++;
+	s->update_mean = (unsigned int)(r->busy / s->updates);
+	if (took > s->update_max)
+		s->update_max = took;
+}
+
+int zdl_run(zdl_window_t w, const struct zdl_run_callbacks *callbacks,
+		const struct zdl_run_config *config)
+{
+	static const struct zdl_run_config defaults;
+	struct zdl_run_stats stats = { 0 };
+	unsigned long long step;
+	unsigned long long prev;
+	unsigned long long acc;
+	unsigned long long now;
+	unsigned int max_updates;
+	unsigned int n;
+	struct zdl_event ev;
+	struct zdl_runner r;
+
+	if (config == NULL)
+		config = &defaults;
+	step = 1000000ULL / (config->update_hz ? config->update_hz : ZDL_RUN_UPDATE_HZ);
+	max_updates = config->max_updates ? config->max_updates : ZDL_RUN_MAX_UPDATES;
+	if (config->target_hz != 0)
+		zdl_window_set_target_rate(w, config->target_hz);
+
+	r.cb = callbacks;
+	r.stats = (config->stats != NULL) ? config->stats : &stats;
+	r.busy = 0;
+	r.hidden = 0;
+	*r.stats = stats;
+
+	acc = 0;
+	prev = zdl_time_us();
+	for (;;) {
+		for (n = 0; config->max_events == 0 || n < config->max_events; ++n) {
+			if (zdl_window_poll_event(w, &ev) != 0)
+				break;
+			if (zdl_run_event(&r, &ev))
+				return 0;
+		}
+
+		/* nothing to draw; sleep until shown, without catching up after */
+		if (r.hidden) {
+			zdl_window_wait_event(w, &ev);
+			if (zdl_run_event(&r, &ev))
+				return 0;
+			prev = zdl_time_us();
+			continue;
+		}
+
+		now = zdl_time_us();
+		acc += now - prev;
+		prev = now;
+		for (n = 0; acc >= step && n < max_updates; ++n) {
+			zdl_run_update(&r, (double)step / 1000000.);
+			acc -= step;
+		}
+		if (acc >= step) {
+			r.stats->overruns++;
+			r.stats->dropped += acc - acc % step;
+			acc %= step;
+		}
+
+		if (callbacks->render != NULL)
+			callbacks->render(callbacks->user, (double)acc / step);
+		zdl_window_swap(w);
+		r.stats->frames++;
+	}
+}
@@ -36,6 +36,10 @@
 #define ZDL_INTERNAL
 #define ZDL_NO_WINMAIN
 #include "zdl.h"
+#include "zdl_alloc.h"
+#include "zdl_input.h"
+#include "zdl_pacer.h"
+#include "zdl_registry.h"
 
 struct zdl_queue_item {
 	struct zdl_event data;
@@ -45,12 +49,13 @@ struct zdl_queue_item {
 struct zdl_queue {
 	struct zdl_queue_item *head;
 	struct zdl_queue_item *tail;
+	struct zdl_queue_item *spare;
 	HANDLE lock;
 };
 
 void zdl_queue_create(struct zdl_queue *q)
 {
-	q->head = q->tail = NULL;
+	q->head = q->tail = q->spare = NULL;
 	q->lock = CreateMutex(NULL, FALSE, NULL);
 }
 
@@ -58,10 +63,20 @@ void zdl_queue_push(struct zdl_queue *q, struct zdl_event *ev)
 {
 	struct zdl_queue_item *item;
 
-	item = (struct zdl_queue_item *)calloc(1, sizeof(*item));
+	WaitForSingleObject(q->lock, INFINITE);
+	item = q->spare;
+	if (item != NULL) {
+		q->spare = item->next;
+	} else {
+		item = (struct zdl_queue_item *)zdl_malloc(sizeof(*item));
+		if (item == NULL) {
+			ReleaseMutex(q->lock);
+			return;
+		}
+	}
 	item->data = *ev;
+	item->next = NULL;
 
-	WaitForSingleObject(q->lock, INFINITE);
 	if (q->tail != NULL) {
 		q->tail->next = item;
 		q->tail = item;
@@ -83,7 +98,9 @@ int zdl_queue_pop(struct zdl_queue *q, struct zdl_event *ev)
 			q->tail = NULL;
 
 		*ev = item->data;
-		free(item);
+		/* nodes are kept for reuse rather than freed */
+		item->next = q->spare;
+		q->spare = item;
 		ReleaseMutex(q->lock);
 		return 0;
 	}
@@ -114,17 +131,43 @@ void zdl_queue_smash_reconfigure(struct zdl_queue *q, struct zdl_event *ev)
 
 void zdl_queue_destroy(struct zdl_queue *q)
 {
+	struct zdl_queue_item *item;
 	struct zdl_event ev;
+
 	while (zdl_queue_pop(q, &ev) == 0);
+	while ((item = q->spare) != NULL) {
+		q->spare = item->next;
+		zdl_free(item);
+	}
 	CloseHandle(q->lock);
 }
 
+/* GL 3.2 / GL_ARB_sync, newer than the gl.h shipped with Windows */
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+typedef struct __GLsync *GLsync;
+typedef unsigned __int64 GLuint64;
+#define GL_SYNC_FLUSH_COMMANDS_BIT    0x00000001
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+
+#define ZDL_FRAMES_IN_FLIGHT_MAX 8
+
+struct zdl_limiter {
+	GLsync (APIENTRY *FenceSync)(GLenum condition, GLbitfield flags);
+	GLenum (APIENTRY *ClientWaitSync)(GLsync sync, GLbitfield flags, GLuint64 timeout);
+	void (APIENTRY *DeleteSync)(GLsync sync);
+	int max;
+	int head;
+	GLsync fences[ZDL_FRAMES_IN_FLIGHT_MAX];
+};
+
 struct zdl_window {
 	int width;
 	int height;
 	int x, y;
 	zdl_flags_t flags;
 	zdl_keymod_t modifiers;
+	int minimized;
 	struct {
 		int x, y;
 		int width, height;
@@ -139,8 +182,17 @@ struct zdl_window {
 
 	HGLRC hRContext;
 	HDC hDeviceContext;
+	struct zdl_registry *registry;
 	struct zdl_queue queue;
 	struct { int x, y; } lastmotion[(ZDL_MOTION_HOVER_END - ZDL_MOTION_TOUCH_START) + 1];
+	struct zdl_input_state input;
+	struct zdl_pacer pacer;
+	struct zdl_limiter limiter;
+
+	struct {
+		TOUCHINPUT *inputs;
+		int size;
+	} touch;
 };
 
 #define MOUSEEVENTF_PENTOUCH_MASK 0xFFFFFF00
@@ -292,6 +344,57 @@ static int zdl_translate(zdl_window_t w, WPARAM wParam, LPARAM lParam, struct zd
 	return 0;
 }
 
+static void *zdl_wgl_get_proc(const char *name)
+{
+	PROC proc = wglGetProcAddress(name);
+
+	/* GL 1.1 entry points are only exported by opengl32 itself */
+	if (proc == NULL || proc == (PROC)1 || proc == (PROC)2 ||
+	    proc == (PROC)3 || proc == (PROC)-1)
+		proc = GetProcAddress(GetModuleHandle(TEXT("opengl32.dll")), name);
+	return (void *)proc;
+}
+
+static void zdl_gl_load(zdl_window_t w)
+{
+	const char *(WINAPI *GetExtensionsString)(HDC);
+	struct zdl_limiter *l = &w->limiter;
+	const char *version;
+	int major, minor;
+
+	w->registry = zdl_registry_create();
+	zdl_registry_add_extensions(w->registry, (const char *)glGetString(GL_EXTENSIONS));
+
+	GetExtensionsString = (const char *(WINAPI *)(HDC))zdl_registry_get_proc(
+			w->registry, "wglGetExtensionsStringARB", zdl_wgl_get_proc);
+	if (GetExtensionsString != NULL)
+		zdl_registry_add_extensions(w->registry,
+				GetExtensionsString(w->hDeviceContext));
+
+	version = (const char *)glGetString(GL_VERSION);
+	if (version == NULL || sscanf(version, "%d.%d", &major, &minor) != 2)
+		major = minor = 0;
+	if (major > 3 || (major == 3 && minor >= 2) ||
+	    zdl_registry_has_extension(w->registry, "GL_ARB_sync")) {
+		l->FenceSync = (GLsync (APIENTRY *)(GLenum, GLbitfield))
+			zdl_registry_get_proc(w->registry, "glFenceSync", zdl_wgl_get_proc);
+		l->ClientWaitSync = (GLenum (APIENTRY *)(GLsync, GLbitfield, GLuint64))
+			zdl_registry_get_proc(w->registry, "glClientWaitSync", zdl_wgl_get_proc);
+		l->DeleteSync = (void (APIENTRY *)(GLsync))
+			zdl_registry_get_proc(w->registry, "glDeleteSync", zdl_wgl_get_proc);
+	}
+}
+
+int zdl_gl_has_extension(const zdl_window_t w, const char *name)
+{
+	return zdl_registry_has_extension(w->registry, name);
+}
+
+void *zdl_gl_get_proc(zdl_window_t w, const char *name)
+{
+	return zdl_registry_get_proc(w->registry, name, zdl_wgl_get_proc);
+}
+
 static void zdl_gl_setup(zdl_window_t w, HWND hwnd)
 {
 	PIXELFORMATDESCRIPTOR pfd = { 
@@ -306,14 +409,35 @@ static void zdl_gl_setup(zdl_window_t w, HWND hwnd)
 	format = ChoosePixelFormat(w->hDeviceContext, &pfd);
 	SetPixelFormat(w->hDeviceContext, format, &pfd);
 	w->hRContext = wglCreateContext(w->hDeviceContext);
-	if (!wglMakeCurrent(w->hDeviceContext, w->hRContext))
+	if (!wglMakeCurrent(w->hDeviceContext, w->hRContext)) {
 		fprintf(stderr, "Unable to make GL context (%d)\n", GetLastError());
+		return;
+	}
+	zdl_gl_load(w);
+}
+
+static void zdl_limiter_clear(zdl_window_t w)
+{
+	struct zdl_limiter *l = &w->limiter;
+	int i;
+
+	for (i = 0; i < ZDL_FRAMES_IN_FLIGHT_MAX; ++i) {
+		if (l->fences[i] != NULL)
+			l->DeleteSync(l->fences[i]);
+		l->fences[i] = NULL;
+	}
+	l->head = 0;
 }
 
 static void zdl_gl_teardown(zdl_window_t w)
 {
+	/* the fences and entry points go with the context */
+	zdl_limiter_clear(w);
+	memset(&w->limiter, 0, sizeof(w->limiter));
 	wglMakeCurrent(w->hDeviceContext, NULL);
 	wglDeleteContext(w->hRContext);
+	zdl_registry_destroy(w->registry);
+	w->registry = NULL;
 }
 
 static void zdl_handle_touch(zdl_window_t w, HTOUCHINPUT touch, int count)
@@ -322,14 +446,18 @@ static void zdl_handle_touch(zdl_window_t w, HTOUCHINPUT touch, int count)
 	TOUCHINPUT *ti;
 	int i;
 
-	ti = (TOUCHINPUT *)malloc(count * sizeof(*ti));
-	if (ti == NULL)
-		return;
+	/* grown to the largest contact count seen, never shrunk */
+	if (count > w->touch.size) {
+		ti = (TOUCHINPUT *)zdl_realloc(w->touch.inputs, count * sizeof(*ti));
+		if (ti == NULL)
+			return;
+		w->touch.inputs = ti;
+		w->touch.size = count;
+	}
+	ti = w->touch.inputs;
 
-	if (!GetTouchInputInfo(touch, count, ti, sizeof(TOUCHINPUT))) {
-		free(ti);
+	if (!GetTouchInputInfo(touch, count, ti, sizeof(TOUCHINPUT)))
 		return;
-	}
 
 	for (i = 0;  i < count; ++i) {
 		if (ti[i].dwFlags & TOUCHEVENTF_PALM)
@@ -347,17 +475,17 @@ static void zdl_handle_touch(zdl_window_t w, HTOUCHINPUT touch, int count)
 		w->lastmotion[ev.motion.id].x = ev.motion.x;
 		w->lastmotion[ev.motion.id].y = ev.motion.y;
 		ev.motion.flags = 0;
+		ev.motion.history.count = 0;
 		if (ti[i].dwFlags & TOUCHEVENTF_DOWN) {
 			ev.motion.flags |= ZDL_MOTION_FLAG_INITIAL;
 		} else if (ti[i].dwFlags & TOUCHEVENTF_MOVE) {
 		} else if (ti[i].dwFlags & TOUCHEVENTF_UP) {
-			ev.motion.flags |= ZDL_MOTION_FLAG_INITIAL;
+			ev.motion.flags |= ZDL_MOTION_FLAG_FINAL;
 		}
 		zdl_queue_push(&w->queue, &ev);
 	}
 
 	CloseTouchInputHandle(touch);
-	free(ti);
 }
 
 static LRESULT CALLBACK zdl_WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
@@ -377,7 +505,8 @@ static LRESULT CALLBACK zdl_WndProc(HWND hwnd, UINT message, WPARAM wParam, LPAR
 	case WM_CREATE:
 		w = *(zdl_window_t *)lParam;
 		SetWindowLongPtr(hwnd, 0, (LONG_PTR)w);
-		zdl_gl_setup(w, hwnd);
+		if (!(w->flags & ZDL_FLAG_NOGL))
+			zdl_gl_setup(w, hwnd);
 		break;
 	case WM_CHAR:
 		ev.key.unicode = wParam;
@@ -409,6 +538,8 @@ static LRESULT CALLBACK zdl_WndProc(HWND hwnd, UINT message, WPARAM wParam, LPAR
 		ev.motion.d_y = (ev.motion.y - w->lastmotion[0].y);
 		w->lastmotion[0].x = ev.motion.x;
 		w->lastmotion[0].y = ev.motion.y;
+		/* XXX: GetMouseMovePointsEx() for ZDL_FLAG_MOTION_HISTORY */
+		ev.motion.history.count = 0;
 		zdl_queue_push(&w->queue, &ev);
 		break;
 	case WM_MOUSEWHEEL:
@@ -483,17 +614,43 @@ static LRESULT CALLBACK zdl_WndProc(HWND hwnd, UINT message, WPARAM wParam, LPAR
 		}
 		break;
 	case WM_SIZE:
+		/* minimizing reports a 0x0 size and no WM_SHOWWINDOW */
+		if (wParam == SIZE_MINIMIZED) {
+			if (!w->minimized) {
+				w->minimized = 1;
+				ev.type = ZDL_EVENT_HIDE;
+				zdl_queue_push(&w->queue, &ev);
+			}
+			break;
+		}
 		ev.type = ZDL_EVENT_RECONFIGURE;
 		ev.reconfigure.width  = (lParam >>  0) & 0xffff;
 		ev.reconfigure.height = (lParam >> 16) & 0xffff;
-		if (ev.reconfigure.width == w->width && ev.reconfigure.height == w->height)
-			break;
-		zdl_queue_smash_reconfigure(&w->queue, &ev);
-		w->width  = ev.reconfigure.width;
-		w->height = ev.reconfigure.height;
+		if (ev.reconfigure.width != w->width || ev.reconfigure.height != w->height) {
+			zdl_queue_smash_reconfigure(&w->queue, &ev);
+			w->width  = ev.reconfigure.width;
+			w->height = ev.reconfigure.height;
+		}
+		if (w->minimized) {
+			w->minimized = 0;
+			ev.type = ZDL_EVENT_EXPOSE;
+			ev.expose.count = 0;
+			ev.expose.rects = NULL;
+			ev.expose.bounds.x = 0;
+			ev.expose.bounds.y = 0;
+			ev.expose.bounds.width = w->width;
+			ev.expose.bounds.height = w->height;
+			zdl_queue_push(&w->queue, &ev);
+		}
 		break;
 	case WM_SHOWWINDOW:
-		ev.type = (wParam == FALSE) ? ZDL_EVENT_EXPOSE : ZDL_EVENT_HIDE;
+		ev.type = (wParam == FALSE) ? ZDL_EVENT_HIDE : ZDL_EVENT_EXPOSE;
+		ev.expose.count = 0;
+		ev.expose.rects = NULL;
+		ev.expose.bounds.x = 0;
+		ev.expose.bounds.y = 0;
+		ev.expose.bounds.width = w->width;
+		ev.expose.bounds.height = w->height;
 		zdl_queue_push(&w->queue, &ev);
 		break;
 	case WM_CLOSE:
@@ -502,7 +659,8 @@ static LRESULT CALLBACK zdl_WndProc(HWND hwnd, UINT message, WPARAM wParam, LPAR
 		DestroyWindow(hwnd);
 		break;
 	case WM_DESTROY:
-		zdl_gl_teardown(w);
+		if (w->hRContext != NULL)
+			zdl_gl_teardown(w);
 		PostQuitMessage(0);
 		break;
 	default:
@@ -552,7 +710,7 @@ zdl_window_t zdl_window_create(int width, int height, zdl_flags_t flags)
 	zdl_window_t w;
 	HINSTANCE hInstance;
 
-	w = (zdl_window_t)calloc(1, sizeof(*w));
+	w = (zdl_window_t)zdl_calloc(1, sizeof(*w));
 	if (w == NULL)
 		return ZDL_WINDOW_INVALID;
 
@@ -574,7 +732,7 @@ zdl_window_t zdl_window_create(int width, int height, zdl_flags_t flags)
 	
 	if (!RegisterClassEx(&w->wcex)) {
 		fprintf(stderr, "Unable to register class\n");
-		free(w);
+		zdl_free(w);
 		return ZDL_WINDOW_INVALID;
 	}
 
@@ -597,7 +755,7 @@ zdl_window_t zdl_window_create(int width, int height, zdl_flags_t flags)
 
 	if (!w->window) {
 		fprintf(stderr, "Unable to create window (0x%08x)\n", GetLastError());
-		free(w);
+		zdl_free(w);
 		return ZDL_WINDOW_INVALID;
 	}
 
@@ -619,14 +777,19 @@ void zdl_window_destroy(zdl_window_t w)
 	DestroyWindow(w->window);
 
 	zdl_queue_destroy(&w->queue);
-	free(w);
+	zdl_free(w->touch.inputs);
+	zdl_free(w);
 }
 
 void zdl_window_set_flags(zdl_window_t w, zdl_flags_t flags)
 {
-	zdl_flags_t chg = flags ^ w->flags;
+	zdl_flags_t chg;
 	int width, height, x, y;
 
+	/* creation-only flags */
+	flags = (flags & ~ZDL_FLAG_NOGL) | (w->flags & ZDL_FLAG_NOGL);
+	chg = flags ^ w->flags;
+
 	if (chg == ZDL_FLAG_NONE)
 		return;
 
@@ -664,6 +827,8 @@ void zdl_window_set_flags(zdl_window_t w, zdl_flags_t flags)
 	if (chg & ZDL_FLAG_NOCURSOR)
 		ShowCursor(!(flags & ZDL_FLAG_NOCURSOR));
 
+	/* XXX: ZDL_FLAG_POINTERLOCK (ClipCursor() and WM_INPUT deltas) */
+
 	w->flags = flags;
 
 	ShowWindow(w->window, SW_SHOW);
@@ -755,6 +920,7 @@ static int zdl_window_read_event(zdl_window_t w, struct zdl_event *ev)
 			}
 		}
 	}
+	zdl_input_update(&w->input, ev);
 	return 0;
 }
 
@@ -785,6 +951,31 @@ void zdl_window_wait_event(zdl_window_t w, struct zdl_event *ev)
 	}
 }
 
+int zdl_window_inject_event(zdl_window_t w, const struct zdl_event *ev)
+{
+	struct zdl_event copy = *ev;
+
+	zdl_queue_push(&w->queue, &copy);
+	return 0;
+}
+
+void zdl_window_get_input_state(const zdl_window_t w, struct zdl_input_state *state)
+{
+	*state = w->input;
+}
+
+int zdl_window_set_controllers(zdl_window_t w, int enabled)
+{
+	/* XXX: XInput only reports state, so events would come from diffing
+	 * XInputGetState() packet numbers each poll; not done yet */
+	return enabled ? -1 : 0;
+}
+
+int zdl_window_get_controller_name(zdl_window_t w, int id, char *name, size_t size)
+{
+	return -1;
+}
+
 void zdl_window_warp_mouse(zdl_window_t w, int x, int y)
 {
 	RECT rect = {
@@ -798,9 +989,120 @@ void zdl_window_warp_mouse(zdl_window_t w, int x, int y)
 	SetCursorPos(rect.left + x, rect.top + y);
 }
 
+unsigned long long zdl_time_ns(void)
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (unsigned long long)(now.QuadPart / freq.QuadPart) * 1000000000ULL +
+		((now.QuadPart % freq.QuadPart) * 1000000000ULL) / freq.QuadPart;
+}
+
+static void zdl_limiter_wait(zdl_window_t w)
+{
+	struct zdl_limiter *l = &w->limiter;
+	GLsync fence = l->fences[l->head];
+
+	/* the slot being reused holds the fence from max frames earlier */
+	if (fence != NULL) {
+		unsigned long long start = zdl_time_ns();
+
+		l->ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+				1000000000ULL);
+		l->DeleteSync(fence);
+		w->pacer.waited += zdl_time_ns() - start;
+	}
+
+	l->fences[l->head] = l->FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	l->head = (l->head + 1) % l->max;
+}
+
 void zdl_window_swap(zdl_window_t w)
 {
+	if (w->hRContext == NULL)
+		return;
+	if (w->pacer.hz != 0)
+		zdl_pacer_wait(&w->pacer);
 	SwapBuffers(w->hDeviceContext);
+	if (w->limiter.max != 0)
+		zdl_limiter_wait(w);
+	zdl_pacer_record(&w->pacer);
+}
+
+int zdl_window_swap_with_damage(zdl_window_t w, const struct zdl_rect *rects, int count)
+{
+	/* XXX: WGL has no partial presentation; present the whole surface */
+	zdl_window_swap(w);
+	return -1;
+}
+
+void zdl_window_set_target_rate(zdl_window_t w, unsigned int hz)
+{
+	zdl_pacer_set_rate(&w->pacer, hz);
+}
+
+void zdl_window_get_frame_stats(const zdl_window_t w, struct zdl_frame_stats *stats)
+{
+	zdl_pacer_get_stats(&w->pacer, stats);
+}
+
+int zdl_window_set_max_frames_in_flight(zdl_window_t w, int n)
+{
+	struct zdl_limiter *l = &w->limiter;
+
+	if (n < 0 || n > ZDL_FRAMES_IN_FLIGHT_MAX)
+		return -1;
+	if (n != 0 && (l->FenceSync == NULL || l->ClientWaitSync == NULL ||
+		       l->DeleteSync == NULL))
+		return -1;
+
+	zdl_limiter_clear(w);
+	l->max = n;
+	return 0;
+}
+
+int zdl_window_set_swap_queue(zdl_window_t w, int depth)
+{
+	/* XXX: a presenter thread needs its own WGL context sharing objects with
+	 * hRContext through wglShareLists(); not done yet */
+	return (depth == 0) ? 0 : -1;
+}
+
+int zdl_window_swap_ready(zdl_window_t w)
+{
+	return 0;
+}
+
+unsigned int zdl_window_get_framebuffer(zdl_window_t w)
+{
+	return 0;
+}
+
+int zdl_window_set_render_size(zdl_window_t w, int width, int height, enum zdl_filter filter)
+{
+	/* XXX: needs glBlitFramebuffer and the framebuffer object entry points
+	 * loaded through the registry, as the X11 scaler does; not done yet */
+	return (width == 0 && height == 0) ? 0 : -1;
+}
+
+int zdl_window_capture_begin(zdl_window_t w, enum zdl_pixel_format format)
+{
+	/* XXX: not implemented yet; the X11 readback ring would port over once
+	 * glMapBufferRange and the pixel buffer entry points are loaded through
+	 * the registry alongside the limiter's sync objects */
+	return -1;
+}
+
+int zdl_window_capture_poll(zdl_window_t w, struct zdl_capture_frame *frame)
+{
+	return -1;
+}
+
+void zdl_window_capture_end(zdl_window_t w)
+{
 }
 
 void zdl_window_set_title(zdl_window_t w, const char *icon, const char *name)
@@ -816,6 +1118,124 @@ void zdl_window_set_title(zdl_window_t w, const char *icon, const char *name)
 	SetWindowText(w->window, name);
 }
 
+int zdl_window_lock_pixels(zdl_window_t w, struct zdl_pixels *pixels)
+{
+	/* XXX: a DIB section presented with StretchDIBits() would do, with
+	 * ZDL_FLAG_PIXELS skipping zdl_gl_setup(); not done yet */
+	return -1;
+}
+
+void zdl_window_unlock_pixels(zdl_window_t w)
+{
+}
+
+int zdl_window_is_unredirected(const zdl_window_t w)
+{
+	/* XXX: DWM does not say whether it is bypassed */
+	return 0;
+}
+
+#define ZDL_VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR 1000009000
+
+/* from vulkan_win32.h, so the Vulkan headers are not needed to build */
+struct zdl_vk_win32_surface_create_info {
+	int sType;
+	const void *pNext;
+	unsigned int flags;
+	HINSTANCE hinstance;
+	HWND hwnd;
+};
+
+typedef void (WINAPI *zdl_vk_void_function)(void);
+typedef zdl_vk_void_function (WINAPI *zdl_vk_get_instance_proc_addr)(void *instance, const char *name);
+typedef int (WINAPI *zdl_vk_create_win32_surface)(void *instance,
+		const struct zdl_vk_win32_surface_create_info *info,
+		const void *allocator, void *surface);
+
+const char *const *zdl_vulkan_get_instance_extensions(unsigned int *count)
+{
+	static const char *const extensions[] = {
+		"VK_KHR_surface",
+		"VK_KHR_win32_surface",
+	};
+
+	*count = sizeof(extensions)/sizeof(extensions[0]);
+	return extensions;
+}
+
+int zdl_window_create_vulkan_surface(zdl_window_t w, void *instance, const void *allocator, void *surface)
+{
+	static HMODULE loader;
+	struct zdl_vk_win32_surface_create_info info;
+	zdl_vk_get_instance_proc_addr get_proc;
+	zdl_vk_create_win32_surface create;
+
+	if (w->hRContext != NULL) {
+		fprintf(stderr, "Vulkan surface on a GL window; use ZDL_FLAG_NOGL\n");
+		return -1;
+	}
+
+	if (loader == NULL)
+		loader = LoadLibrary(_T("vulkan-1.dll"));
+	if (loader == NULL) {
+		fprintf(stderr, "Unable to load Vulkan (%d)\n", GetLastError());
+		return -1;
+	}
+
+	get_proc = (zdl_vk_get_instance_proc_addr)GetProcAddress(loader, "vkGetInstanceProcAddr");
+	if (get_proc == NULL)
+		return -1;
+	create = (zdl_vk_create_win32_surface)get_proc(instance, "vkCreateWin32SurfaceKHR");
+	if (create == NULL) {
+		fprintf(stderr, "VK_KHR_win32_surface not enabled on instance\n");
+		return -1;
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.sType = ZDL_VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+	info.hinstance = w->wcex.hInstance;
+	info.hwnd = w->window;
+
+	/* VK_SUCCESS is 0 */
+	return create(instance, &info, allocator, surface) == 0 ? 0 : -1;
+}
+
+static int zdl_present_mode_supported(const enum zdl_present_mode *modes, int count,
+		enum zdl_present_mode mode)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (modes[i] == mode)
+			return 1;
+	}
+	return 0;
+}
+
+enum zdl_present_mode zdl_window_choose_present_mode(const zdl_window_t w,
+		const enum zdl_present_mode *modes, int count, int vsync)
+{
+	static const enum zdl_present_mode tearing[] = {
+		ZDL_PRESENT_IMMEDIATE,
+		ZDL_PRESENT_MAILBOX,
+		ZDL_PRESENT_FIFO_RELAXED,
+	};
+	int i;
+
+	if (vsync) {
+		if (zdl_window_is_unredirected(w) &&
+		    zdl_present_mode_supported(modes, count, ZDL_PRESENT_MAILBOX))
+			return ZDL_PRESENT_MAILBOX;
+		return ZDL_PRESENT_FIFO;
+	}
+
+	for (i = 0; i < sizeof(tearing)/sizeof(tearing[0]); ++i) {
+		if (zdl_present_mode_supported(modes, count, tearing[i]))
+			return tearing[i];
+	}
+	return ZDL_PRESENT_FIFO;
+}
+
 union zdl_native_handle zdl_window_native_handle(zdl_window_t w)
 {
 	union zdl_native_handle ret;
@@ -830,6 +1250,7 @@ int zdl_win32_entry(int (* main)(int, char **))
 {
 	char *argv[256];
 	const char *cmdline = (const char *)GetCommandLineA();
+	/* not routed through zdl_malloc(): main() may change the hooks */
 	char *dup = _strdup(cmdline);
 	char *tok;
 	int rc, i;
@@ -851,7 +1272,9 @@ int zdl_win32_entry(int (* main)(int, char **))
 }
 
 struct zdl_clipboard {
+	zdl_window_t window;
 	char *text;
+	struct zdl_clipboard_data result;
 };
 
 zdl_clipboard_t zdl_clipboard_open(zdl_window_t w)
@@ -861,10 +1284,12 @@ zdl_clipboard_t zdl_clipboard_open(zdl_window_t w)
 	if (OpenClipboard(w->window) == FALSE)
 		return ZDL_CLIPBOARD_INVALID;
 
-	c = (zdl_clipboard_t)calloc(1, sizeof(*c));
+	c = (zdl_clipboard_t)zdl_calloc(1, sizeof(*c));
 	if (c == NULL)
 		return ZDL_CLIPBOARD_INVALID;
 
+	c->window = w;
+
 	return c;
 }
 
@@ -872,29 +1297,22 @@ void zdl_clipboard_close(zdl_clipboard_t c)
 {
 	CloseClipboard();
 
-	if (c->text != NULL)
-		free(c->text);
-	free(c);
+	zdl_free(c->text);
+	zdl_free(c);
 }
 
-int zdl_clipboard_write(zdl_clipboard_t c, const struct zdl_clipboard_data *data)
+int zdl_clipboard_write_buffer(zdl_clipboard_t c, enum zdl_clipboard_format format,
+		const void *data, size_t size, zdl_clipboard_release_t release, void *user)
 {
 	LPTSTR  lptstrCopy;
 	HGLOBAL hglbCopy;
-	const char *ptr;
-	int len;
+	const char *ptr = (const char *)data;
+	size_t len = size;
 
-	if (data->format != ZDL_CLIPBOARD_URI &&
-	    data->format != ZDL_CLIPBOARD_TEXT)
+	if (format != ZDL_CLIPBOARD_URI &&
+	    format != ZDL_CLIPBOARD_TEXT)
 		return -1;
 
-	if (data->format == ZDL_CLIPBOARD_URI)
-		ptr = data->uri.uri;
-	else if (data->format == ZDL_CLIPBOARD_TEXT)
-		ptr = data->text.text;
-
-	len = strlen(ptr);
-
 	hglbCopy = GlobalAlloc(GMEM_MOVEABLE, (len + 1));
     if (hglbCopy == NULL)
 		return -1;
@@ -911,18 +1329,34 @@ int zdl_clipboard_write(zdl_clipboard_t c, const struct zdl_clipboard_data *data
 	GlobalUnlock(hglbCopy);
 
 	SetClipboardData(CF_TEXT, hglbCopy);
+
+	/* the system owns a copy now */
+	if (release != NULL)
+		release(user, data);
 	return 0;
 }
 
+int zdl_clipboard_write(zdl_clipboard_t c, const struct zdl_clipboard_data *data)
+{
+	const char *ptr;
+
+	if (data->format == ZDL_CLIPBOARD_URI)
+		ptr = data->uri.uri;
+	else if (data->format == ZDL_CLIPBOARD_TEXT)
+		ptr = data->text.text;
+	else
+		return -1;
+
+	return zdl_clipboard_write_buffer(c, data->format, ptr, strlen(ptr), NULL, NULL);
+}
+
 int zdl_clipboard_read(zdl_clipboard_t c, struct zdl_clipboard_data *data)
 {
 	LPTSTR  lptstrCopy;
 	HGLOBAL hglbCopy;
 
-	if (c->text != NULL) {
-		free(c->text);
-		c->text = NULL;
-	}
+	zdl_free(c->text);
+	c->text = NULL;
 
 	if (!IsClipboardFormatAvailable(CF_TEXT))
 		return -1;
@@ -935,11 +1369,90 @@ int zdl_clipboard_read(zdl_clipboard_t c, struct zdl_clipboard_data *data)
 	if (lptstrCopy == NULL)
 		return -1;
 
-	c->text = _strdup(lptstrCopy);
+	c->text = zdl_strdup(lptstrCopy);
 	GlobalUnlock(hglbCopy);
+	if (c->text == NULL)
+		return -1;
 
 	data->format = ZDL_CLIPBOARD_TEXT;
 	data->text.text = c->text;
 
 	return 0;
 }
+
+int zdl_clipboard_read_stream(zdl_clipboard_t c, unsigned int formats,
+		zdl_clipboard_chunk_t chunk, void *user, enum zdl_clipboard_format *format)
+{
+	struct zdl_clipboard_data data;
+	const char *text;
+
+	if (zdl_clipboard_read(c, &data))
+		return -1;
+	if (data.format == ZDL_CLIPBOARD_IMAGE ||
+	    !(formats & ZDL_CLIPBOARD_MASK(data.format)))
+		return -1;
+
+	text = data.format == ZDL_CLIPBOARD_URI ? data.uri.uri : data.text.text;
+	if (format != NULL)
+		*format = data.format;
+	return chunk(user, text, strlen(text));
+}
+
+void zdl_clipboard_set_timeout(zdl_clipboard_t c, unsigned int ms)
+{
+	/* reads never wait on another process */
+}
+
+struct zdl_clipboard_copy {
+	char *buffer;
+	size_t size;
+	size_t length;
+};
+
+static int zdl_clipboard_copy(void *user, const void *data, size_t size)
+{
+	struct zdl_clipboard_copy *cp = (struct zdl_clipboard_copy *)user;
+	size_t n;
+
+	if (cp->length < cp->size) {
+		n = cp->size - cp->length;
+		memcpy(cp->buffer + cp->length, data, n < size ? n : size);
+	}
+	cp->length += size;
+	return 0;
+}
+
+int zdl_clipboard_read_buffer(zdl_clipboard_t c, unsigned int formats,
+		void *buffer, size_t size, size_t *length, enum zdl_clipboard_format *format)
+{
+	struct zdl_clipboard_copy cp;
+
+	cp.buffer = (char *)buffer;
+	cp.size = size;
+	cp.length = 0;
+
+	if (zdl_clipboard_read_stream(c, formats, zdl_clipboard_copy, &cp, format))
+		return -1;
+	if (length != NULL)
+		*length = cp.length;
+	/* leave room for the terminator */
+	if (cp.length >= size)
+		return -1;
+	cp.buffer[cp.length] = '\0';
+	return 0;
+}
+
+int zdl_clipboard_read_async(zdl_clipboard_t c, unsigned int formats)
+{
+	struct zdl_event ev;
+
+	/* complete immediately, the event is delivered on the next poll */
+	ev.type = ZDL_EVENT_CLIPBOARD;
+	ev.clipboard.clipboard = c;
+	ev.clipboard.status = zdl_clipboard_read(c, &c->result);
+	if (ev.clipboard.status == 0 &&
+	    !(formats & ZDL_CLIPBOARD_MASK(c->result.format)))
+		ev.clipboard.status = -1;
+	ev.clipboard.data = ev.clipboard.status == 0 ? &c->result : NULL;
+	return zdl_window_inject_event(c->window, &ev);
+}
@@ -30,26 +30,204 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#include <sys/time.h>
+#include <errno.h>
+#include <time.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/cursorfont.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xfixes.h>
+#ifdef ZDL_HAVE_XI2
+#include <X11/extensions/XInput2.h>
+#endif
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <GL/glx.h>
 #include <GL/gl.h>
+#include <GL/glext.h>
 
 #include "zdl.h"
+#include "zdl_alloc.h"
+#include "zdl_evdev.h"
+#include "zdl_input.h"
+#include "zdl_pacer.h"
+#include "zdl_pixel.h"
+#include "zdl_registry.h"
+
+#define ZDL_TOUCH_SLOTS 32
+
+enum zdl_touch_state {
+	ZDL_TOUCH_FREE,
+	ZDL_TOUCH_ACTIVE,
+	ZDL_TOUCH_ENDED, /* reported final, waiting for XI_TouchEnd */
+};
+
+struct zdl_touch {
+	unsigned int id;
+	enum zdl_touch_state state;
+	int x, y;
+};
+
+#define ZDL_FRAMES_IN_FLIGHT_MAX 8
+
+struct zdl_limiter {
+	int max;
+	int head;
+	GLsync fences[ZDL_FRAMES_IN_FLIGHT_MAX];
+};
+
+#define ZDL_CAPTURE_RING 3
+
+struct zdl_capture {
+	int active;
+	enum zdl_pixel_format format;
+	int head;
+	int pending;
+	unsigned int dropped;
+	struct {
+		GLuint pbo;
+		GLsync fence;
+		int width, height;
+	} slots[ZDL_CAPTURE_RING];
+	void *pixels;
+	size_t size;
+};
+
+struct zdl_gl {
+	struct zdl_registry *registry;
+	int major, minor;
+
+	int has_fbo;
+	int has_sync;
+	int has_copy_sub_buffer;
+	int has_pbo;
+
+	PFNGLGENFRAMEBUFFERSPROC GenFramebuffers;
+	PFNGLDELETEFRAMEBUFFERSPROC DeleteFramebuffers;
+	PFNGLBINDFRAMEBUFFERPROC BindFramebuffer;
+	PFNGLFRAMEBUFFERRENDERBUFFERPROC FramebufferRenderbuffer;
+	PFNGLCHECKFRAMEBUFFERSTATUSPROC CheckFramebufferStatus;
+	PFNGLGENRENDERBUFFERSPROC GenRenderbuffers;
+	PFNGLDELETERENDERBUFFERSPROC DeleteRenderbuffers;
+	PFNGLBINDRENDERBUFFERPROC BindRenderbuffer;
+	PFNGLRENDERBUFFERSTORAGEPROC RenderbufferStorage;
+	PFNGLBLITFRAMEBUFFERPROC BlitFramebuffer;
+
+	PFNGLFENCESYNCPROC FenceSync;
+	PFNGLCLIENTWAITSYNCPROC ClientWaitSync;
+	PFNGLWAITSYNCPROC WaitSync;
+	PFNGLDELETESYNCPROC DeleteSync;
+
+	PFNGLGENBUFFERSPROC GenBuffers;
+	PFNGLDELETEBUFFERSPROC DeleteBuffers;
+	PFNGLBINDBUFFERPROC BindBuffer;
+	PFNGLBUFFERDATAPROC BufferData;
+	PFNGLMAPBUFFERRANGEPROC MapBufferRange;
+	PFNGLUNMAPBUFFERPROC UnmapBuffer;
+
+	PFNGLXCOPYSUBBUFFERMESAPROC CopySubBuffer;
+	void (*SwapInterval)(int);
+};
+
+struct zdl_target {
+	GLuint fbo;
+	GLuint color;
+	GLuint depth;
+	int width, height;
+	unsigned int storage; /* bumped whenever color is reallocated */
+	/* framebuffers are not shared, so the presenter blits through its own,
+	 * on the shared color renderbuffer */
+	GLuint present_fbo;
+	unsigned int present_storage;
+	struct {
+		int width, height;
+	} present;
+	GLenum filter;
+	GLsync rendered;
+	GLsync released;
+	int busy;
+};
+
+#define ZDL_SWAP_QUEUE_MAX 8
+#define ZDL_INJECT_MAX 32
+#define ZDL_CONTROLLER_QUEUE 256
+#define ZDL_CONTROLLER_HOTPLUG 32 /* slots only added and removed events may use */
+
+struct zdl_presenter {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	GLXContext context;
+	int running;
+	int count;
+	int current;
+	int head;
+	int queued;
+	int queue[ZDL_SWAP_QUEUE_MAX + 1];
+	struct zdl_target targets[ZDL_SWAP_QUEUE_MAX + 1];
+};
+
+struct zdl_surface {
+	XImage *image;
+	XShmSegmentInfo shm;
+	int busy;
+};
+
+#define ZDL_TRANSFER_MAX 8
+#define ZDL_OWNED_TARGETS 6
+#define ZDL_SELECTIONS 3
+
+/* tracked selection, caching the last read while its owner is unchanged */
+struct zdl_selection {
+	Atom atom;
+	Window owner;
+	int known;
+	int valid;
+	unsigned int formats;
+	struct zdl_clipboard_data data;
+	void *buffer;
+};
+
+/* incoming selection data, collected or streamed to a chunk callback */
+struct zdl_sink {
+	zdl_clipboard_chunk_t chunk;
+	void *user;
+	char *data;
+	size_t size;
+	size_t alloc;
+};
+
+/* outgoing INCR transfer */
+struct zdl_transfer {
+	Window requestor;
+	Atom property;
+	Atom type;
+	const char *data;
+	size_t size;
+	size_t offset;
+};
 
 struct zdl_window {
 	Display *display;
 	int mapped;
 	int eatpaste;
 	int eatconfig;
+	int obscured;
 	int screen;
 	int x, y;
 	int width, height;
 	struct {
 		int x, y;
 	} lastconfig;
+	struct {
+		int x, y;
+	} offset;      /* position within the parent, from real ConfigureNotify */
 	struct {
 		int x, y;
 		int width, height;
@@ -57,21 +235,146 @@ struct zdl_window {
 	zdl_flags_t flags;
 
 	Window root;
+	Window parent;  /* window manager frame once reparented */
 	Window window;
 	Colormap colormap;
 	GLXContext context;
+	XVisualInfo *visual;
+	struct zdl_gl gl;
+
+	struct {
+		struct zdl_rect *rects;
+		struct zdl_rect bounds;
+		int count;
+		int size;
+		int open;
+	} expose;
+
+	struct {
+		int *x, *y;
+		unsigned int *time;
+		int count;
+		int size;
+	} history;
+
+	struct {
+		struct zdl_event events[ZDL_INJECT_MAX];
+		int head;
+		int count;
+	} injected;
+
+	/* filled by the evdev reader thread */
+	struct {
+		struct zdl_evdev *evdev;
+		pthread_mutex_t lock;
+		struct zdl_event events[ZDL_CONTROLLER_QUEUE];
+		int head;
+		int count;
+		int refused; /* input was refused; resync once drained */
+		int wake[2]; /* readable while events are queued */
+	} controllers;
 
 	struct { int x, y; } lastmotion;
+	struct zdl_input_state input;
+
+	struct {
+		int opcode; /* XI2 major opcode, 0 without XI2 */
+		int minor;  /* XI2 minor version */
+	} xi;
+
+	struct {
+		int grabbed;
+		int x, y;             /* last confined position without XI2 */
+		unsigned long serial; /* request of the last recentring warp */
+		double rx, ry;        /* fractional raw motion carried over */
+	} lock;
+
+	/* XI2 touch sequences, the slot index being the motion id offset */
+	struct zdl_touch touches[ZDL_TOUCH_SLOTS];
+
 	unsigned int modifiers;
 	unsigned int modifiers_to;
 	Atom wm_delete_window;
-	struct zdl_clipboard_data clipboard;
+	Atom xa_incr;
+
+	/* owned selection, with its conversions precomputed */
+	struct {
+		const char *data;
+		size_t size;
+		char *latin1; /* served for STRING, which ICCCM defines as Latin-1 */
+		size_t latin1_size;
+		Pixmap pixmap;
+		Atom utf8;
+		Atom targets[ZDL_OWNED_TARGETS];
+		Atom types[ZDL_OWNED_TARGETS];
+		int ntargets;
+		zdl_clipboard_release_t release;
+		void *user;
+	} clipboard;
+
+	struct {
+		struct zdl_transfer list[ZDL_TRANSFER_MAX];
+		int count;
+	} transfers;
+
+	struct {
+		int fixes; /* XFixes event base, 0 without change tracking */
+		struct zdl_selection list[ZDL_SELECTIONS];
+	} selections;
+
+	struct {
+		struct zdl_clipboard *clipboard;
+		Atom board;
+		int target;
+		unsigned int formats;
+		unsigned long long deadline;
+		int incr;
+		struct zdl_sink sink;
+	} paste;
+
+	struct zdl_pacer pacer;
+	struct zdl_limiter limiter;
+	struct zdl_capture capture;
+	struct zdl_presenter presenter;
+
+	struct {
+		struct zdl_target target;
+		int width, height;
+		GLenum filter;
+	} scaler;
+
+	struct {
+		GC gc;
+		int shm;
+		int completion;
+		int current;
+		struct zdl_surface buffers[2];
+	} pixels;
 };
 
 #define MWM_HINTS_DECORATIONS   (1L << 1)
 #define MWM_DECOR_ALL           (1L << 0)
 #define MWM_DECOR_RESIZEH       (1L << 2)
 
+static void zdl_window_render_size(const zdl_window_t w, int *width, int *height)
+{
+	if (w->scaler.width != 0) {
+		*width = w->scaler.width;
+		*height = w->scaler.height;
+	} else {
+		*width = w->width;
+		*height = w->height;
+	}
+}
+
+static void zdl_window_scale_pointer(const zdl_window_t w, int *x, int *y)
+{
+	if (w->scaler.width == 0)
+		return;
+	*x = (*x * w->scaler.width) / w->width;
+	*y = (*y * w->scaler.height) / w->height;
+}
+
 static Bool wait_for_map_notify(Display *d, XEvent *e, char *arg)
 {
 	if ((e->type == MapNotify) && (e->xmap.window == (Window)arg))
@@ -117,6 +420,28 @@ static void zdl_window_set_wm_state(zdl_window_t w, zdl_flags_t flags)
 	}
 }
 
+static void zdl_window_set_compositor_hints(zdl_window_t w, int width, int height, zdl_flags_t flags)
+{
+	Atom property;
+	unsigned long bypass;
+	unsigned long region[4];
+
+	/* 1 asks the compositor to unredirect us, 0 leaves it to decide */
+	bypass = (flags & ZDL_FLAG_FULLSCREEN) && !(flags & ZDL_FLAG_NOBYPASS);
+	property = XInternAtom(w->display, "_NET_WM_BYPASS_COMPOSITOR", False);
+	XChangeProperty(w->display, w->window, property, XA_CARDINAL,
+			32, PropModeReplace, (unsigned char *)&bypass, 1);
+
+	/* the visual has no alpha, so every pixel of the window is opaque */
+	region[0] = 0;
+	region[1] = 0;
+	region[2] = width;
+	region[3] = height;
+	property = XInternAtom(w->display, "_NET_WM_OPAQUE_REGION", False);
+	XChangeProperty(w->display, w->window, property, XA_CARDINAL,
+			32, PropModeReplace, (unsigned char *)region, 4);
+}
+
 static void zdl_window_set_hints(zdl_window_t w, int width, int height, zdl_flags_t flags)
 {
 	XSizeHints *hints = XAllocSizeHints();
@@ -170,28 +495,354 @@ static void zdl_window_set_hints(zdl_window_t w, int width, int height, zdl_flag
 				32, PropModeReplace, (unsigned char *)&mwm_hints,
 				sizeof(mwm_hints) / sizeof(long));
 	}
+	zdl_window_set_compositor_hints(w, width, height, flags);
 
 	XFree(hints);
 }
 
 static int zdl_window_set_swap_interval(zdl_window_t w, int on)
 {
-	const char *ext = glXQueryExtensionsString(w->display, 0);
-	void (*swap)(int) = NULL;
+	if (w->gl.SwapInterval) {
+		w->gl.SwapInterval(on ? 1 : 0);
+		return 0;
+	}
+	return -1;
+}
+
+static const struct {
+	const char *name;
+	size_t offset;
+} zdl_gl_procs[] = {
+	{ "glGenFramebuffers",         offsetof(struct zdl_gl, GenFramebuffers) },
+	{ "glDeleteFramebuffers",      offsetof(struct zdl_gl, DeleteFramebuffers) },
+	{ "glBindFramebuffer",         offsetof(struct zdl_gl, BindFramebuffer) },
+	{ "glFramebufferRenderbuffer", offsetof(struct zdl_gl, FramebufferRenderbuffer) },
+	{ "glCheckFramebufferStatus",  offsetof(struct zdl_gl, CheckFramebufferStatus) },
+	{ "glGenRenderbuffers",        offsetof(struct zdl_gl, GenRenderbuffers) },
+	{ "glDeleteRenderbuffers",     offsetof(struct zdl_gl, DeleteRenderbuffers) },
+	{ "glBindRenderbuffer",        offsetof(struct zdl_gl, BindRenderbuffer) },
+	{ "glRenderbufferStorage",     offsetof(struct zdl_gl, RenderbufferStorage) },
+	{ "glBlitFramebuffer",         offsetof(struct zdl_gl, BlitFramebuffer) },
+	{ "glFenceSync",               offsetof(struct zdl_gl, FenceSync) },
+	{ "glClientWaitSync",          offsetof(struct zdl_gl, ClientWaitSync) },
+	{ "glWaitSync",                offsetof(struct zdl_gl, WaitSync) },
+	{ "glDeleteSync",              offsetof(struct zdl_gl, DeleteSync) },
+	{ "glGenBuffers",              offsetof(struct zdl_gl, GenBuffers) },
+	{ "glDeleteBuffers",           offsetof(struct zdl_gl, DeleteBuffers) },
+	{ "glBindBuffer",              offsetof(struct zdl_gl, BindBuffer) },
+	{ "glBufferData",              offsetof(struct zdl_gl, BufferData) },
+	{ "glMapBufferRange",          offsetof(struct zdl_gl, MapBufferRange) },
+	{ "glUnmapBuffer",             offsetof(struct zdl_gl, UnmapBuffer) },
+	{ "glXCopySubBufferMESA",      offsetof(struct zdl_gl, CopySubBuffer) },
+};
+
+static int zdl_gl_supported(zdl_window_t w, int major, int minor, const char *ext)
+{
+	if (w->gl.major > major || (w->gl.major == major && w->gl.minor >= minor))
+		return 1;
+	return zdl_registry_has_extension(w->gl.registry, ext);
+}
+
+static void *zdl_glx_get_proc(const char *name)
+{
+	return (void *)glXGetProcAddress((const GLubyte *)name);
+}
+
+static void zdl_gl_load(zdl_window_t w)
+{
+	struct zdl_registry *r;
+	const char *version;
+	int i;
 
-	if (strstr(ext, "GLX_SGI_swap_control") != NULL) {
-		swap = (void (*)(int))glXGetProcAddress((const GLubyte*)"glXSwapIntervalSGI");
-	} else if (strstr(ext, "GLX_MESA_swap_control") != NULL) {
-		swap = (void (*)(int))glXGetProcAddress((const GLubyte*)"glXSwapIntervalMESA");
+	w->gl.registry = r = zdl_registry_create();
+	zdl_registry_add_extensions(r, glXQueryExtensionsString(w->display, w->screen));
+	zdl_registry_add_extensions(r, (const char *)glGetString(GL_EXTENSIONS));
+
+	version = (const char *)glGetString(GL_VERSION);
+	if (version == NULL || sscanf(version, "%d.%d", &w->gl.major, &w->gl.minor) != 2)
+		w->gl.major = w->gl.minor = 0;
+
+	for (i = 0; i < sizeof(zdl_gl_procs)/sizeof(zdl_gl_procs[0]); ++i) {
+		void **proc = (void **)((char *)&w->gl + zdl_gl_procs[i].offset);
+		*proc = zdl_registry_get_proc(r, zdl_gl_procs[i].name, zdl_glx_get_proc);
 	}
 
-	if (swap) {
-		swap(on ? 1 : 0);
-		return 0;
+	if (zdl_registry_has_extension(r, "GLX_SGI_swap_control"))
+		w->gl.SwapInterval = (void (*)(int))zdl_registry_get_proc(r,
+				"glXSwapIntervalSGI", zdl_glx_get_proc);
+	else if (zdl_registry_has_extension(r, "GLX_MESA_swap_control"))
+		w->gl.SwapInterval = (void (*)(int))zdl_registry_get_proc(r,
+				"glXSwapIntervalMESA", zdl_glx_get_proc);
+
+	w->gl.has_fbo = zdl_gl_supported(w, 3, 0, "GL_ARB_framebuffer_object") &&
+			w->gl.BlitFramebuffer != NULL;
+	w->gl.has_sync = zdl_gl_supported(w, 3, 2, "GL_ARB_sync") &&
+			w->gl.FenceSync != NULL;
+	/* the loader returns a stub for any name, so glMapBufferRange needs
+	 * its own version or extension check */
+	w->gl.has_pbo = zdl_gl_supported(w, 3, 0, "GL_ARB_pixel_buffer_object") &&
+			zdl_gl_supported(w, 3, 0, "GL_ARB_map_buffer_range") &&
+			w->gl.MapBufferRange != NULL;
+	w->gl.has_copy_sub_buffer = w->gl.CopySubBuffer != NULL &&
+		zdl_registry_has_extension(r, "GLX_MESA_copy_sub_buffer");
+}
+
+int zdl_gl_has_extension(const zdl_window_t w, const char *name)
+{
+	return zdl_registry_has_extension(w->gl.registry, name);
+}
+
+void *zdl_gl_get_proc(zdl_window_t w, const char *name)
+{
+	return zdl_registry_get_proc(w->gl.registry, name, zdl_glx_get_proc);
+}
+
+static int zdl_shm_failed;
+
+static int zdl_shm_error(Display *d, XErrorEvent *e)
+{
+	zdl_shm_failed = 1;
+	return 0;
+}
+
+static void zdl_pixels_init(zdl_window_t w)
+{
+	w->pixels.gc = XCreateGC(w->display, w->window, 0, NULL);
+	/* images are always little-endian, which Xlib converts for XPutImage,
+	 * but a shared image must match the server's byte order */
+	w->pixels.shm = XShmQueryExtension(w->display) &&
+		ImageByteOrder(w->display) == LSBFirst;
+	if (w->pixels.shm)
+		w->pixels.completion = XShmGetEventBase(w->display) + ShmCompletion;
+}
+
+static void zdl_surface_fini(zdl_window_t w, struct zdl_surface *s)
+{
+	if (s->image == NULL)
+		return;
+
+	if (s->shm.shmaddr != NULL) {
+		XShmDetach(w->display, &s->shm);
+		XSync(w->display, False);
+		shmdt(s->shm.shmaddr);
+	} else {
+		/* XPutImage fallback data came from zdl_malloc(), not Xlib */
+		zdl_free(s->image->data);
+	}
+	s->image->data = NULL;
+	XDestroyImage(s->image);
+	memset(s, 0, sizeof(*s));
+}
+
+static int zdl_surface_init_shm(zdl_window_t w, struct zdl_surface *s, int width, int height)
+{
+	int (*handler)(Display *, XErrorEvent *);
+
+	s->image = XShmCreateImage(w->display, w->visual->visual, w->visual->depth,
+			ZPixmap, NULL, &s->shm, width, height);
+	if (s->image == NULL)
+		return -1;
+
+	s->shm.shmid = shmget(IPC_PRIVATE, s->image->bytes_per_line * height,
+			IPC_CREAT | 0600);
+	if (s->shm.shmid < 0)
+		goto err_image;
+	s->shm.shmaddr = s->image->data = shmat(s->shm.shmid, NULL, 0);
+	/* mark for removal now, so the segment cannot outlive the process */
+	shmctl(s->shm.shmid, IPC_RMID, NULL);
+	if (s->shm.shmaddr == (char *)-1)
+		goto err_image;
+	s->shm.readOnly = True;
+
+	/* attaching fails on remote displays, which can only be told by trying */
+	XSync(w->display, False);
+	zdl_shm_failed = 0;
+	handler = XSetErrorHandler(zdl_shm_error);
+	XShmAttach(w->display, &s->shm);
+	XSync(w->display, False);
+	XSetErrorHandler(handler);
+	if (zdl_shm_failed) {
+		shmdt(s->shm.shmaddr);
+		goto err_image;
 	}
+	return 0;
+
+err_image:
+	s->image->data = NULL;
+	XDestroyImage(s->image);
+	memset(s, 0, sizeof(*s));
 	return -1;
 }
 
+static int zdl_surface_init(zdl_window_t w, struct zdl_surface *s, int width, int height)
+{
+	char *data;
+
+	if (w->pixels.shm) {
+		if (zdl_surface_init_shm(w, s, width, height) == 0)
+			return 0;
+		fprintf(stderr, "MIT-SHM unavailable, falling back to XPutImage\n");
+		w->pixels.shm = 0;
+	}
+
+	s->image = XCreateImage(w->display, w->visual->visual, w->visual->depth,
+			ZPixmap, 0, NULL, width, height, 32, 0);
+	if (s->image == NULL)
+		return -1;
+	s->image->byte_order = LSBFirst;
+	data = (char *)zdl_malloc(s->image->bytes_per_line * height);
+	if (data == NULL) {
+		XDestroyImage(s->image);
+		s->image = NULL;
+		return -1;
+	}
+	s->image->data = data;
+	return 0;
+}
+
+struct zdl_completion {
+	int type;
+	ShmSeg shmseg;
+};
+
+static Bool wait_for_completion(Display *d, XEvent *e, char *arg)
+{
+	struct zdl_completion *c = (struct zdl_completion *)arg;
+
+	if (e->type == c->type && ((XShmCompletionEvent *)e)->shmseg == c->shmseg)
+		return True;
+	return False;
+}
+
+static void zdl_surface_wait(zdl_window_t w, struct zdl_surface *s)
+{
+	struct zdl_completion c;
+	XEvent event;
+
+	if (!s->busy)
+		return;
+
+	c.type = w->pixels.completion;
+	c.shmseg = s->shm.shmseg;
+	XIfEvent(w->display, &event, wait_for_completion, (char *)&c);
+	s->busy = 0;
+}
+
+static void zdl_selections_init(zdl_window_t w)
+{
+	int error;
+	int i;
+
+	w->selections.list[0].atom = XA_PRIMARY;
+	w->selections.list[1].atom = XA_SECONDARY;
+	w->selections.list[2].atom = XInternAtom(w->display, "CLIPBOARD", False);
+
+	if (!XFixesQueryExtension(w->display, &w->selections.fixes, &error)) {
+		w->selections.fixes = 0;
+		return;
+	}
+
+	for (i = 0; i < ZDL_SELECTIONS; ++i) {
+		XFixesSelectSelectionInput(w->display, w->window,
+				w->selections.list[i].atom,
+				XFixesSetSelectionOwnerNotifyMask |
+				XFixesSelectionWindowDestroyNotifyMask |
+				XFixesSelectionClientCloseNotifyMask);
+	}
+}
+
+static void zdl_pointer_init(zdl_window_t w)
+{
+#ifdef ZDL_HAVE_XI2
+	int event, error;
+	int major = 2, minor = 2;
+
+	if (XQueryExtension(w->display, "XInputExtension", &w->xi.opcode, &event, &error) &&
+	    XIQueryVersion(w->display, &major, &minor) == Success) {
+		w->xi.minor = minor;
+		return;
+	}
+	w->xi.opcode = 0;
+#endif
+}
+
+static void zdl_touch_init(zdl_window_t w)
+{
+#ifdef ZDL_HAVE_XI2
+	unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+	XIEventMask mask;
+
+	if (w->xi.opcode == 0 || w->xi.minor < 2)
+		return;
+
+	/* selecting ownership gets touch events delivered while a window
+	 * manager grab still holds the sequence, instead of after it */
+	memset(bits, 0, sizeof(bits));
+	XISetMask(bits, XI_TouchBegin);
+	XISetMask(bits, XI_TouchUpdate);
+	XISetMask(bits, XI_TouchEnd);
+	XISetMask(bits, XI_TouchOwnership);
+	mask.deviceid = XIAllMasterDevices;
+	mask.mask_len = sizeof(bits);
+	mask.mask = bits;
+	XISelectEvents(w->display, w->window, &mask, 1);
+#endif
+}
+
+static void zdl_pointer_select_raw(zdl_window_t w, int enable)
+{
+#ifdef ZDL_HAVE_XI2
+	unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+	XIEventMask mask;
+
+	if (w->xi.opcode == 0)
+		return;
+
+	/* raw events are only ever delivered to the root window */
+	memset(bits, 0, sizeof(bits));
+	if (enable)
+		XISetMask(bits, XI_RawMotion);
+	mask.deviceid = XIAllMasterDevices;
+	mask.mask_len = sizeof(bits);
+	mask.mask = bits;
+	XISelectEvents(w->display, w->root, &mask, 1);
+#endif
+}
+
+static void zdl_pointer_center(zdl_window_t w)
+{
+	w->lock.x = w->width / 2;
+	w->lock.y = w->height / 2;
+	w->lock.serial = NextRequest(w->display);
+	XWarpPointer(w->display, None, w->window, 0, 0, 0, 0, w->lock.x, w->lock.y);
+}
+
+/* fails until the window is viewable, so this is retried on focus */
+static void zdl_pointer_grab(zdl_window_t w)
+{
+	w->lock.grabbed = XGrabPointer(w->display, w->window, True,
+			ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
+			GrabModeAsync, GrabModeAsync, w->window, None,
+			CurrentTime) == GrabSuccess;
+	if (w->lock.grabbed && w->xi.opcode == 0)
+		zdl_pointer_center(w);
+}
+
+static void zdl_pointer_lock(zdl_window_t w, int locked)
+{
+	if (locked) {
+		w->lock.rx = 0;
+		w->lock.ry = 0;
+		zdl_pointer_select_raw(w, 1);
+		zdl_pointer_grab(w);
+	} else {
+		zdl_pointer_select_raw(w, 0);
+		if (w->lock.grabbed)
+			XUngrabPointer(w->display, CurrentTime);
+		w->lock.grabbed = 0;
+	}
+}
+
 static int zdl_window_reconfigure(zdl_window_t w, int width, int height, zdl_flags_t flags)
 {
 	unsigned int valuelist[6];
@@ -200,26 +851,42 @@ static int zdl_window_reconfigure(zdl_window_t w, int width, int height, zdl_fla
 	XVisualInfo *vi;
 	XEvent event;
 
-	valuelist[0] = GLX_RGBA;
-	valuelist[1] = GLX_DOUBLEBUFFER;
-	valuelist[2] = GLX_USE_GL;
-	valuelist[3] = GLX_DEPTH_SIZE;
-	valuelist[4] = 8;
-	valuelist[5] = None;
+	if (flags & (ZDL_FLAG_PIXELS | ZDL_FLAG_NOGL)) {
+		XVisualInfo tmpl;
+		int count;
 
-	vi = glXChooseVisual(w->display, w->screen, (int *)valuelist);
-	if (vi == NULL) {
-		fprintf(stderr, "Unable to choose appropriate X visual\n");
-		return -1;
-	}
+		tmpl.visualid = XVisualIDFromVisual(XDefaultVisual(w->display, w->screen));
+		vi = XGetVisualInfo(w->display, VisualIDMask, &tmpl, &count);
+		if (vi == NULL || vi->class != TrueColor) {
+			fprintf(stderr, "Default X visual is not TrueColor\n");
+			if (vi != NULL)
+				XFree(vi);
+			return -1;
+		}
+		w->context = NULL;
+	} else {
+		valuelist[0] = GLX_RGBA;
+		valuelist[1] = GLX_DOUBLEBUFFER;
+		valuelist[2] = GLX_USE_GL;
+		valuelist[3] = GLX_DEPTH_SIZE;
+		valuelist[4] = 8;
+		valuelist[5] = None;
+
+		vi = glXChooseVisual(w->display, w->screen, (int *)valuelist);
+		if (vi == NULL) {
+			fprintf(stderr, "Unable to choose appropriate X visual\n");
+			return -1;
+		}
 
-	w->context = glXCreateContext(w->display, vi, None, GL_TRUE);
-	if (w->context == NULL) {
-		fprintf(stderr, "Unable to create GLX context\n");
-		return -1;
+		w->context = glXCreateContext(w->display, vi, None, GL_TRUE);
+		if (w->context == NULL) {
+			fprintf(stderr, "Unable to create GLX context\n");
+			return -1;
+		}
 	}
 
 	w->root = XRootWindow(w->display, vi->screen);
+	w->parent = w->root;
 	w->colormap = XCreateColormap(w->display, w->root, vi->visual, AllocNone);
 
 	swa.colormap = w->colormap;
@@ -231,7 +898,8 @@ static int zdl_window_reconfigure(zdl_window_t w, int width, int height, zdl_fla
 				ButtonPressMask     | ButtonReleaseMask |
 				EnterWindowMask     | LeaveWindowMask   |
 				PointerMotionMask   | ExposureMask      |
-				StructureNotifyMask | FocusChangeMask;
+				StructureNotifyMask | FocusChangeMask   |
+				PropertyChangeMask  | VisibilityChangeMask;
 	valuemask =	CWBackPixel |
 			CWBorderPixel |
 			CWOverrideRedirect |
@@ -246,16 +914,23 @@ static int zdl_window_reconfigure(zdl_window_t w, int width, int height, zdl_fla
 	if (flags & ZDL_FLAG_FULLSCREEN)
 		XMoveWindow(w->display, w->window, 0, 0);
 
-	XFree(vi);
+	w->visual = vi;
 
-	if (!glXMakeCurrent(w->display, w->window, w->context)) {
+	if (flags & ZDL_FLAG_PIXELS) {
+		zdl_pixels_init(w);
+	} else if (flags & ZDL_FLAG_NOGL) {
+		/* rendering is entirely up to the application */
+	} else if (!glXMakeCurrent(w->display, w->window, w->context)) {
 		fprintf(stderr, "Unable to make context current\n");
 		XFreeColormap(w->display, w->colormap);
 		XDestroyWindow(w->display, w->window);
 		glXDestroyContext(w->display, w->context);
+		XFree(w->visual);
 		return -1;
+	} else {
+		zdl_gl_load(w);
+		zdl_window_set_swap_interval(w, 0);
 	}
-	zdl_window_set_swap_interval(w, 0);
 
 	XMapWindow(w->display, w->window);
 	XSetWMProtocols(w->display, w->window, &w->wm_delete_window, 1);
@@ -266,18 +941,29 @@ static int zdl_window_reconfigure(zdl_window_t w, int width, int height, zdl_fla
 	return 0;
 }
 
+static pthread_once_t zdl_xlib_once = PTHREAD_ONCE_INIT;
+
+/* the swap presenter thread shares the display connection; this has to
+ * precede any other Xlib call in the process */
+static void zdl_xlib_init(void)
+{
+	XInitThreads();
+}
+
 zdl_window_t zdl_window_create(int width, int height, zdl_flags_t flags)
 {
 	zdl_window_t w;
 
-	w = (zdl_window_t)calloc(1, sizeof(*w));
+	w = (zdl_window_t)zdl_calloc(1, sizeof(*w));
 	if (w == NULL)
 		return ZDL_WINDOW_INVALID;
 
+	pthread_once(&zdl_xlib_once, zdl_xlib_init);
+
 	w->display = XOpenDisplay(0);
 	if (w->display == NULL) {
 		fprintf(stderr, "Unable to open X display\n");
-		free(w);
+		zdl_free(w);
 		return ZDL_WINDOW_INVALID;
 	}
 
@@ -290,6 +976,7 @@ zdl_window_t zdl_window_create(int width, int height, zdl_flags_t flags)
 
 
 	w->wm_delete_window = XInternAtom(w->display, "WM_DELETE_WINDOW", False);
+	w->xa_incr = XInternAtom(w->display, "INCR", False);
 
 	if (flags & ZDL_FLAG_FULLSCREEN) {
 		width = XDisplayWidth(w->display, w->screen);
@@ -303,10 +990,13 @@ zdl_window_t zdl_window_create(int width, int height, zdl_flags_t flags)
 
 	if (zdl_window_reconfigure(w, width, height, flags)) {
 		XCloseDisplay(w->display);
-		free(w);
+		zdl_free(w);
 		return ZDL_WINDOW_INVALID;
 	}
 
+	zdl_selections_init(w);
+	zdl_pointer_init(w);
+	zdl_touch_init(w);
 	zdl_window_set_flags(w, flags);
 
 	return w;
@@ -314,19 +1004,50 @@ zdl_window_t zdl_window_create(int width, int height, zdl_flags_t flags)
 
 void zdl_window_destroy(zdl_window_t w)
 {
+	int i;
+
+	zdl_window_set_controllers(w, 0);
+	zdl_window_capture_end(w);
+	zdl_window_set_max_frames_in_flight(w, 0);
+	zdl_window_set_swap_queue(w, 0);
+	zdl_window_set_render_size(w, 0, 0, ZDL_FILTER_NEAREST);
+	if (w->flags & ZDL_FLAG_PIXELS) {
+		zdl_surface_wait(w, &w->pixels.buffers[0]);
+		zdl_surface_wait(w, &w->pixels.buffers[1]);
+		zdl_surface_fini(w, &w->pixels.buffers[0]);
+		zdl_surface_fini(w, &w->pixels.buffers[1]);
+		XFreeGC(w->display, w->pixels.gc);
+	}
 	XFreeColormap(w->display, w->colormap);
-	glXMakeCurrent(w->display, None, NULL);
+	if (w->context != NULL)
+		glXMakeCurrent(w->display, None, NULL);
 	XDestroyWindow(w->display, w->window);
-	glXDestroyContext(w->display, w->context);
+	if (w->context != NULL)
+		glXDestroyContext(w->display, w->context);
+	XFree(w->visual);
+	zdl_registry_destroy(w->gl.registry);
 	XCloseDisplay(w->display);
-	if (w->clipboard.text.text != NULL)
-		free((void *)w->clipboard.text.text);
-	free(w);
+	zdl_free(w->expose.rects);
+	zdl_free(w->history.x);
+	zdl_free(w->history.y);
+	zdl_free(w->history.time);
+	/* a clipboard pixmap went with the connection */
+	if (w->clipboard.release != NULL)
+		w->clipboard.release(w->clipboard.user, w->clipboard.data);
+	zdl_free(w->paste.sink.data);
+	for (i = 0; i < ZDL_SELECTIONS; ++i)
+		zdl_free(w->selections.list[i].buffer);
+	zdl_free(w);
 }
 
 void zdl_window_set_flags(zdl_window_t w, zdl_flags_t flags)
 {
-	zdl_flags_t chg = flags ^ w->flags;
+	zdl_flags_t chg;
+
+	/* creation-only flags */
+	flags = (flags & ~(ZDL_FLAG_PIXELS | ZDL_FLAG_NOGL)) |
+		(w->flags & (ZDL_FLAG_PIXELS | ZDL_FLAG_NOGL));
+	chg = flags ^ w->flags;
 
 	if (chg & ZDL_FLAG_FULLSCREEN) {
 		int x, y, width, height;
@@ -360,6 +1081,12 @@ void zdl_window_set_flags(zdl_window_t w, zdl_flags_t flags)
 		XMoveWindow(w->display, w->window, w->x, w->y);
 	}
 
+	if (chg & ZDL_FLAG_NOBYPASS)
+		zdl_window_set_compositor_hints(w, w->width, w->height, flags);
+
+	if (chg & ZDL_FLAG_POINTERLOCK)
+		zdl_pointer_lock(w, flags & ZDL_FLAG_POINTERLOCK);
+
 	if (chg & ZDL_FLAG_NOCURSOR) {
 		Cursor cursor;
 
@@ -420,7 +1147,7 @@ void zdl_window_set_position(zdl_window_t w, int x, int y)
 	if (!(w->flags & ZDL_FLAG_FULLSCREEN)) {
 		w->x = x;
 		w->y = y;
-		XMoveWindow(w->display, w->x, w->y, w->height);
+		XMoveWindow(w->display, w->window, w->x, w->y);
 	} else {
 		w->masked.x = x;
 		w->masked.y = y;
@@ -692,239 +1419,2018 @@ static int zdl_window_translate(zdl_window_t w, int down, XKeyEvent *event, stru
 	return 0;
 }
 
-static int zdl_window_read_event(zdl_window_t w, struct zdl_event *ev)
+static void zdl_window_expose_add(zdl_window_t w, XExposeEvent *event)
 {
-	static const enum zdl_button button_map[] = {
-		[Button1] = ZDL_BUTTON_LEFT,
-		[Button2] = ZDL_BUTTON_MIDDLE,
-		[Button3] = ZDL_BUTTON_RIGHT,
-		[Button4] = ZDL_BUTTON_MWUP,
-		[Button5] = ZDL_BUTTON_MWDOWN,
-	};
-	XEvent resp;
-	XEvent event;
-	int rc;
-
-	XNextEvent(w->display, &event);
+	struct zdl_rect *r;
+	int x0, y0, x1, y1;
+
+	if (!w->expose.open) {
+		w->expose.open = 1;
+		w->expose.count = 0;
+	} else if (w->expose.count < 0) {
+		/* previous allocation failed; whole window is exposed */
+		return;
+	}
 
-	rc = 0;
+	if (w->expose.count == w->expose.size) {
+		int size = w->expose.size ? w->expose.size * 2 : 8;
 
-	switch (event.type) {
-	case KeyPress:
-		ev->type = ZDL_EVENT_KEYPRESS;
-		rc = zdl_window_translate(w, 1, &event.xkey, ev);
-		break;
-	case KeyRelease:
-		ev->type = ZDL_EVENT_KEYRELEASE;
-		if (XEventsQueued(w->display, QueuedAfterReading)) {
-			XEvent nev;
-			XPeekEvent(w->display, &nev);
-			if (nev.type == KeyPress &&
-			    nev.xkey.time == event.xkey.time &&
-			    nev.xkey.keycode == event.xkey.keycode) {
-				rc = -1;
-				if (!(w->flags & ZDL_FLAG_KEYREPEAT))
-					XNextEvent(w->display, &nev);
-			}
-		}
-		if (rc != -1)
-			rc = zdl_window_translate(w, 0, &event.xkey, ev);
-		break;
-	case ButtonPress:
-		if (w->flags & ZDL_FLAG_CLIPBOARD && event.xbutton.button == 2) {
-			ev->type = ZDL_EVENT_PASTE;
-			w->eatpaste = 1;
-		} else {
-			ev->type = ZDL_EVENT_BUTTONPRESS;
-			ev->button.x = event.xbutton.x;
-			ev->button.y = event.xbutton.y;
-			ev->button.modifiers = w->modifiers;
-			ev->button.button = button_map[event.xbutton.button];
-		}
-		break;
-	case ButtonRelease:
-		if (w->eatpaste && event.xbutton.button == 2) {
-			w->eatpaste = 0;
-			rc = -1;
-		} else {
-			ev->type = ZDL_EVENT_BUTTONRELEASE;
-			ev->button.x = event.xbutton.x;
-			ev->button.y = event.xbutton.y;
-			ev->button.modifiers = w->modifiers;
-			ev->button.button = button_map[event.xbutton.button];
-		}
-		break;
-	case MotionNotify:
-		ev->type = ZDL_EVENT_MOTION;
-		ev->motion.id = ZDL_MOTION_POINTER;
-		ev->motion.flags = ZDL_MOTION_FLAG_NONE;
-		ev->motion.x = event.xmotion.x;
-		ev->motion.y = event.xmotion.y;
-		ev->motion.d_x = (ev->motion.x - w->lastmotion.x);
-		ev->motion.d_y = (ev->motion.y - w->lastmotion.y);
-		w->lastmotion.x = ev->motion.x;
-		w->lastmotion.y = ev->motion.y;
-		break;
-	case FocusIn:
-		zdl_window_update_modifiers(w);
-		rc = -1;
-		break;
-	case EnterNotify:
-		ev->type = ZDL_EVENT_GAINFOCUS;
-		w->lastmotion.x = event.xcrossing.x;
-		w->lastmotion.y = event.xcrossing.y;
-		break;
-	case LeaveNotify:
-		ev->type = ZDL_EVENT_LOSEFOCUS;
-		break;
-	case ConfigureNotify:
-		if (event.xconfigure.window != w->window) {
-			rc = -1;
-			break;
+		r = (struct zdl_rect *)zdl_realloc(w->expose.rects, size * sizeof(*r));
+		if (r == NULL) {
+			w->expose.count = -1;
+			return;
 		}
+		w->expose.rects = r;
+		w->expose.size = size;
+	}
 
-		if ((event.xconfigure.width  == w->width) &&
-		    (event.xconfigure.height == w->height) &&
-		    (event.xconfigure.x == w->lastconfig.x) &&
-		    (event.xconfigure.y == w->lastconfig.y)) {
-			rc = -1;
-			break;
+	r = &w->expose.rects[w->expose.count++];
+	r->x = event->x;
+	r->y = event->y;
+	r->width = event->width;
+	r->height = event->height;
+
+	if (w->expose.count == 1) {
+		w->expose.bounds = *r;
+		return;
+	}
+
+	x0 = (r->x < w->expose.bounds.x) ? r->x : w->expose.bounds.x;
+	y0 = (r->y < w->expose.bounds.y) ? r->y : w->expose.bounds.y;
+	x1 = w->expose.bounds.x + w->expose.bounds.width;
+	y1 = w->expose.bounds.y + w->expose.bounds.height;
+	if (r->x + r->width > x1)  x1 = r->x + r->width;
+	if (r->y + r->height > y1) y1 = r->y + r->height;
+	w->expose.bounds.x = x0;
+	w->expose.bounds.y = y0;
+	w->expose.bounds.width = x1 - x0;
+	w->expose.bounds.height = y1 - y0;
+}
+
+static int zdl_window_history_grow(zdl_window_t w)
+{
+	int size = w->history.size ? w->history.size * 2 : 64;
+	void *p;
+
+	if ((p = zdl_realloc(w->history.x, size * sizeof(int))) == NULL)
+		return -1;
+	w->history.x = (int *)p;
+	if ((p = zdl_realloc(w->history.y, size * sizeof(int))) == NULL)
+		return -1;
+	w->history.y = (int *)p;
+	if ((p = zdl_realloc(w->history.time, size * sizeof(unsigned int))) == NULL)
+		return -1;
+	w->history.time = (unsigned int *)p;
+	w->history.size = size;
+	return 0;
+}
+
+static void zdl_window_history_add(zdl_window_t w, int x, int y, Time time)
+{
+	if (w->history.count == w->history.size && zdl_window_history_grow(w)) {
+		/* out of memory; the newest sample replaces the last one */
+		if (w->history.count == 0)
+			return;
+		w->history.count--;
+	}
+	w->history.x[w->history.count] = x;
+	w->history.y[w->history.count] = y;
+	w->history.time[w->history.count] = time;
+	w->history.count++;
+}
+
+static void zdl_window_history_motion(zdl_window_t w, XMotionEvent *event)
+{
+	int x = event->x, y = event->y;
+
+	zdl_window_scale_pointer(w, &x, &y);
+	zdl_window_history_add(w, x, y, event->time);
+}
+
+static void zdl_pointer_relative(struct zdl_event *ev, const zdl_window_t w)
+{
+	ev->type = ZDL_EVENT_MOTION;
+	ev->motion.id = ZDL_MOTION_POINTER;
+	ev->motion.flags = ZDL_MOTION_FLAG_RELATIVE;
+	ev->motion.x = w->lastmotion.x;
+	ev->motion.y = w->lastmotion.y;
+	ev->motion.history.count = 0;
+}
+
+/* pointer lock without XI2: report motion of the confined pointer,
+ * recentring it before it can stop at an edge */
+static int zdl_pointer_motion(zdl_window_t w, XMotionEvent *event, struct zdl_event *ev)
+{
+	int d_x, d_y;
+
+	/* XI2 raw events carry the motion */
+	if (w->xi.opcode != 0)
+		return -1;
+
+	/* drop motion generated before the last warp was processed, which
+	 * is relative to where the pointer was rather than the centre */
+	if ((long)(event->serial - w->lock.serial) < 0)
+		return -1;
+
+	d_x = event->x - w->lock.x;
+	d_y = event->y - w->lock.y;
+	w->lock.x = event->x;
+	w->lock.y = event->y;
+	if (abs(event->x - w->width / 2) > w->width / 4 ||
+	    abs(event->y - w->height / 2) > w->height / 4)
+		zdl_pointer_center(w);
+	if (d_x == 0 && d_y == 0)
+		return -1;
+
+	zdl_pointer_relative(ev, w);
+	ev->motion.d_x = d_x;
+	ev->motion.d_y = d_y;
+	return 0;
+}
+
+#ifdef ZDL_HAVE_XI2
+/* integer device delta of a raw event, carrying fractions over */
+static void zdl_pointer_raw_delta(zdl_window_t w, const XIRawEvent *raw, int *d_x, int *d_y)
+{
+	const double *value = raw->raw_values;
+	double x = 0, y = 0;
+	int i;
+
+	/* values are packed for the valuators set in the mask */
+	for (i = 0; i < 2 && i < raw->valuators.mask_len * 8; ++i) {
+		if (!XIMaskIsSet(raw->valuators.mask, i))
+			continue;
+		if (i == 0)
+			x = *value++;
+		else
+			y = *value++;
+	}
+
+	x += w->lock.rx;
+	y += w->lock.ry;
+	*d_x = (int)x;
+	*d_y = (int)y;
+	w->lock.rx = x - *d_x;
+	w->lock.ry = y - *d_y;
+}
+
+static int zdl_pointer_raw(zdl_window_t w, XEvent *event, struct zdl_event *ev)
+{
+	int fold = (w->flags & ZDL_FLAG_MOTION_HISTORY) != 0;
+	int sum_x = 0, sum_y = 0;
+	int d_x, d_y;
+	XEvent nev;
+
+	w->history.count = 0;
+	for (;;) {
+		if (XGetEventData(w->display, &event->xcookie)) {
+			XIRawEvent *raw = (XIRawEvent *)event->xcookie.data;
+
+			zdl_pointer_raw_delta(w, raw, &d_x, &d_y);
+			if (fold && (d_x != 0 || d_y != 0))
+				zdl_window_history_add(w, d_x, d_y, raw->time);
+			sum_x += d_x;
+			sum_y += d_y;
+			XFreeEventData(w->display, &event->xcookie);
 		}
 
-		if (w->eatconfig) {
-			w->eatconfig--;
-			rc = -1;
+		/* raw events arrive at the device rate; fold the queued ones */
+		if (!fold || !XEventsQueued(w->display, QueuedAfterReading))
 			break;
-		}
+		XPeekEvent(w->display, &nev);
+		if (nev.type != GenericEvent ||
+		    nev.xcookie.extension != w->xi.opcode ||
+		    nev.xcookie.evtype != XI_RawMotion)
+			break;
+		XNextEvent(w->display, event);
+	}
 
-		if ((event.xconfigure.x != w->lastconfig.x) ||
-		    (event.xconfigure.y != w->lastconfig.y)) {
-			if (event.xconfigure.send_event == False) {
-				Window ret;
-				XTranslateCoordinates(w->display,
-						w->window, w->root,
-						0, 0, &w->x, &w->y, &ret);
-			} else {
-				w->x = event.xconfigure.x;
-				w->y = event.xconfigure.y;
-			}
-		}
+	/* e.g. wheels reporting smooth scrolling on other valuators */
+	if (sum_x == 0 && sum_y == 0)
+		return -1;
 
-		w->lastconfig.x = event.xconfigure.x;
-		w->lastconfig.y = event.xconfigure.y;
+	zdl_pointer_relative(ev, w);
+	ev->motion.d_x = sum_x;
+	ev->motion.d_y = sum_y;
+	if (fold) {
+		ev->motion.history.count = w->history.count;
+		ev->motion.history.x = w->history.x;
+		ev->motion.history.y = w->history.y;
+		ev->motion.history.time = w->history.time;
+	}
+	return 0;
+}
 
-		ev->type = ZDL_EVENT_RECONFIGURE;
-		ev->reconfigure.width =  event.xconfigure.width;
-		ev->reconfigure.height = event.xconfigure.height;
-		w->width = ev->reconfigure.width;
-		w->height = ev->reconfigure.height;
+static struct zdl_touch *zdl_touch_find(zdl_window_t w, unsigned int id)
+{
+	int i;
+
+	for (i = 0; i < ZDL_TOUCH_SLOTS; ++i) {
+		if (w->touches[i].state != ZDL_TOUCH_FREE && w->touches[i].id == id)
+			return &w->touches[i];
+	}
+	return NULL;
+}
+
+static int zdl_touch_event(zdl_window_t w, int type, const XIDeviceEvent *de,
+		struct zdl_event *ev)
+{
+	struct zdl_touch *t;
+	int x, y;
+	int i;
+
+	t = zdl_touch_find(w, de->detail);
+	x = (int)de->event_x;
+	y = (int)de->event_y;
+	zdl_window_scale_pointer(w, &x, &y);
+
+	ev->motion.flags = ZDL_MOTION_FLAG_NONE;
+	switch (type) {
+	case XI_TouchBegin:
+		if (t != NULL)
+			return -1;
+		/* lowest free slot, so ids stay small like Android's */
+		for (i = 0; i < ZDL_TOUCH_SLOTS; ++i) {
+			if (w->touches[i].state == ZDL_TOUCH_FREE)
+				break;
+		}
+		if (i == ZDL_TOUCH_SLOTS)
+			return -1;
+		t = &w->touches[i];
+		t->id = de->detail;
+		t->state = ZDL_TOUCH_ACTIVE;
+		t->x = x;
+		t->y = y;
+		ev->motion.flags = ZDL_MOTION_FLAG_INITIAL;
 		break;
-	case Expose:
-		ev->type = ZDL_EVENT_EXPOSE;
+	case XI_TouchUpdate:
+		if (t == NULL || t->state != ZDL_TOUCH_ACTIVE)
+			return -1;
+		/* the touch is over, but its end is held until ownership is
+		 * settled; report it now */
+		if (de->flags & XITouchPendingEnd) {
+			t->state = ZDL_TOUCH_ENDED;
+			ev->motion.flags = ZDL_MOTION_FLAG_FINAL;
+		}
 		break;
-	case ClientMessage:
-		if (event.xclient.data.l[0] == w->wm_delete_window) {
-			ev->type = ZDL_EVENT_EXIT;
-			break;
-		} else {
-			rc = -1;
+	case XI_TouchEnd:
+		if (t == NULL)
+			return -1;
+		if (t->state == ZDL_TOUCH_ENDED) {
+			t->state = ZDL_TOUCH_FREE;
+			return -1;
 		}
+		/* also sent when another client accepted the sequence */
+		t->state = ZDL_TOUCH_FREE;
+		ev->motion.flags = ZDL_MOTION_FLAG_FINAL;
 		break;
-	case SelectionRequest:
-		if (w->clipboard.text.text == NULL) {
-			resp.xselection.property = None;
-		} else if (event.xselectionrequest.target == XA_STRING) {
-			XChangeProperty(w->display,
-				event.xselectionrequest.requestor,
-				event.xselectionrequest.property,
-				XA_STRING, 8, PropModeReplace,
-				(unsigned char *)w->clipboard.text.text,
-				strlen(w->clipboard.text.text));
-			resp.xselection.property = event.xselectionrequest.property;
-		} else {
-			resp.xselection.property = None;
+	default:
+		return -1;
+	}
+
+	ev->type = ZDL_EVENT_MOTION;
+	ev->motion.id = (enum zdl_motion_id)(ZDL_MOTION_TOUCH_START + (t - w->touches));
+	ev->motion.x = x;
+	ev->motion.y = y;
+	ev->motion.d_x = x - t->x;
+	ev->motion.d_y = y - t->y;
+	ev->motion.history.count = 0;
+	t->x = x;
+	t->y = y;
+	return 0;
+}
+
+static int zdl_window_xi_event(zdl_window_t w, XEvent *event, struct zdl_event *ev)
+{
+	XGenericEventCookie *cookie = &event->xcookie;
+	int rc = -1;
+
+	if (cookie->extension != w->xi.opcode)
+		return -1;
+
+	switch (cookie->evtype) {
+	case XI_RawMotion:
+		if ((w->flags & ZDL_FLAG_POINTERLOCK) && w->lock.grabbed)
+			rc = zdl_pointer_raw(w, event, ev);
+		break;
+	case XI_TouchBegin:
+	case XI_TouchUpdate:
+	case XI_TouchEnd:
+		if (XGetEventData(w->display, cookie)) {
+			rc = zdl_touch_event(w, cookie->evtype,
+					(const XIDeviceEvent *)cookie->data, ev);
+			XFreeEventData(w->display, cookie);
 		}
-		resp.xselection.type = SelectionNotify;
-		resp.xselection.display = event.xselectionrequest.display;
-		resp.xselection.requestor = event.xselectionrequest.requestor;
-		resp.xselection.selection = event.xselectionrequest.selection;
-		resp.xselection.target = event.xselectionrequest.target;
-		resp.xselection.time = event.xselectionrequest.time;
-		XSendEvent(w->display, event.xselectionrequest.requestor,
-				0, 0, &resp);
-		rc = -1;
 		break;
 	default:
-		rc = -1;
+		/* XI_TouchOwnership: sequences are never rejected, so
+		 * becoming the owner changes nothing */
 		break;
 	}
-
 	return rc;
 }
+#endif
 
-static int zdl_window_pop_modifiers(zdl_window_t w, struct zdl_event *ev)
+#define ZDL_CLIPBOARD_TIMEOUT 1000
+/* 32-bit units fetched per XGetWindowProperty */
+#define ZDL_PROPERTY_CHUNK 65536
+
+enum {
+	ZDL_ATOM_TARGETS,
+	ZDL_ATOM_TARGET0,
+};
+
+static const struct {
+	const char *name;
+	enum zdl_clipboard_format format;
+} zdl_clipboard_targets[] = {
+	/* text formats */
+	{ "UTF8_STRING",   ZDL_CLIPBOARD_TEXT },
+	{ "C_STRING",      ZDL_CLIPBOARD_TEXT },
+	{ "text/unicode",  ZDL_CLIPBOARD_TEXT },
+	{ "STRING",        ZDL_CLIPBOARD_TEXT },
+	{ "COMPOUND_TEXT", ZDL_CLIPBOARD_TEXT },
+	{ "TEXT",          ZDL_CLIPBOARD_TEXT },
+	/* uri formats */
+	{ "text/uri-list", ZDL_CLIPBOARD_URI },
+	/* image formats */
+	{ "PIXMAP",        ZDL_CLIPBOARD_IMAGE },
+};
+
+#define ZDL_CLIPBOARD_NTARGETS \
+	(sizeof(zdl_clipboard_targets)/sizeof(zdl_clipboard_targets[0]))
+
+struct zdl_clipboard {
+	zdl_window_t window;
+	unsigned int timeout;
+	struct zdl_clipboard_data result;
+	Atom atoms[ZDL_ATOM_TARGET0 + ZDL_CLIPBOARD_NTARGETS];
+};
+
+static unsigned long long zdl_time_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static int zdl_sink_write(struct zdl_sink *s, const void *data, size_t size, size_t hint)
+{
+	size_t need;
+	char *tmp;
+
+	if (s->chunk != NULL)
+		return size == 0 ? 0 : s->chunk(s->user, data, size);
+
+	/* hint is the number of bytes known to follow */
+	need = s->size + size + hint + 1;
+	if (need > s->alloc) {
+		if (need < s->alloc * 2)
+			need = s->alloc * 2;
+		tmp = (char *)zdl_realloc(s->data, need);
+		if (tmp == NULL)
+			return -1;
+		s->data = tmp;
+		s->alloc = need;
+	}
+	if (size > 0)
+		memcpy(s->data + s->size, data, size);
+	s->size += size;
+	s->data[s->size] = '\0';
+	return 0;
+}
+
+/* Read a property by offset into a sink and delete it. An INCR property is
+ * deleted unread, which tells the owner to start sending chunks; a missing
+ * property reports type None. */
+static int zdl_read_property(zdl_window_t w, Atom property, Atom *type,
+		struct zdl_sink *sink, size_t *size)
+{
+	unsigned long nitems;
+	unsigned long left;
+	unsigned char *ret;
+	long offset = 0;
+	size_t unit;
+	int format;
+	int rc;
+
+	*size = 0;
+	do {
+		rc = XGetWindowProperty(w->display, w->window,
+				property, offset, ZDL_PROPERTY_CHUNK, False,
+				AnyPropertyType, type, &format,
+				&nitems, &left, &ret);
+		if (rc != Success)
+			return -1;
+		if (*type == None) {
+			if (ret != NULL)
+				XFree(ret);
+			return 0;
+		}
+
+		if (*type == w->xa_incr) {
+			/* the value is a lower bound on the total size */
+			if (nitems > 0)
+				zdl_sink_write(sink, NULL, 0, *(long *)ret);
+			XFree(ret);
+			break;
+		}
+
+		/* 32-bit items are returned as longs */
+		unit = format == 32 ? sizeof(long) : format / 8;
+		rc = zdl_sink_write(sink, ret, nitems * unit, left / (format / 8) * unit);
+		XFree(ret);
+		if (rc)
+			return -1;
+		*size += nitems * unit;
+		offset += ZDL_PROPERTY_CHUNK;
+	} while (left != 0);
+
+	XDeleteProperty(w->display, w->window, property);
+	return 0;
+}
+
+static struct zdl_selection *zdl_selection_find(zdl_window_t w, Atom atom)
 {
-	unsigned int chg;
 	int i;
 
-	if (w->modifiers == w->modifiers_to)
+	for (i = 0; i < ZDL_SELECTIONS; ++i) {
+		if (w->selections.list[i].atom == atom)
+			return &w->selections.list[i];
+	}
+	return NULL;
+}
+
+/* first selection with an owner; tracked owners need no round trip */
+static struct zdl_selection *zdl_selection_owned(zdl_window_t w)
+{
+	struct zdl_selection *sel;
+	int i;
+
+	for (i = 0; i < ZDL_SELECTIONS; ++i) {
+		sel = &w->selections.list[i];
+		if (!sel->known) {
+			sel->owner = XGetSelectionOwner(w->display, sel->atom);
+			sel->known = w->selections.fixes != 0;
+		}
+		if (sel->owner != None)
+			return sel;
+	}
+	return NULL;
+}
+
+static int zdl_selection_changed(zdl_window_t w, const XFixesSelectionNotifyEvent *event)
+{
+	struct zdl_selection *sel = zdl_selection_find(w, event->selection);
+
+	if (sel == NULL)
 		return -1;
 
-	chg = w->modifiers ^ w->modifiers_to;
+	/* the cached buffer stays valid until the next read replaces it */
+	sel->owner = event->owner;
+	sel->known = 1;
+	sel->valid = 0;
+	return 0;
+}
 
-	for (i = 0; i < sizeof(w->modifiers) * 8; ++i) {
-		if (!(chg & (1 << i)))
-			continue;
-		if (w->modifiers_to & (1 << i)) {
-			w->modifiers |= (1 << i);
-			ev->type = ZDL_EVENT_KEYPRESS;
-		} else {
-			w->modifiers &= ~(1 << i);
-			ev->type = ZDL_EVENT_KEYRELEASE;
+/* apply owner changes already received, so a read never hits a stale cache */
+static void zdl_selection_sync(zdl_window_t w)
+{
+	struct zdl_event ev;
+	XEvent event;
+
+	if (w->selections.fixes == 0)
+		return;
+
+	while (XCheckTypedWindowEvent(w->display, w->window,
+			w->selections.fixes + XFixesSelectionNotify, &event)) {
+		if (zdl_selection_changed(w, (XFixesSelectionNotifyEvent *)&event) == 0) {
+			ev.type = ZDL_EVENT_CLIPBOARD_CHANGED;
+			zdl_window_inject_event(w, &ev);
 		}
-		ev->key.sym = zdl_window_keysym(1 << i);
-		if (ev->key.sym != (enum zdl_keysym)-1) {
-			ev->key.scancode = 0;
-			ev->key.unicode = 0;
-			ev->key.modifiers = w->modifiers;
-			return 0;
+	}
+}
+
+/* keep a converted read, caching it if changes are tracked */
+static void zdl_selection_store(zdl_window_t w, struct zdl_selection *sel,
+		unsigned int formats, const struct zdl_clipboard_data *data, void *buffer)
+{
+	zdl_free(sel->buffer);
+	sel->buffer = buffer;
+	sel->data = *data;
+	sel->formats = formats;
+	sel->valid = w->selections.fixes != 0;
+}
+
+/* pick the most preferred target offered by the owner */
+static int zdl_clipboard_pick(zdl_clipboard_t c, const Atom *offered, int count,
+		unsigned int formats)
+{
+	int i, j;
+
+	for (i = 0; i < ZDL_CLIPBOARD_NTARGETS; ++i) {
+		if (!(formats & ZDL_CLIPBOARD_MASK(zdl_clipboard_targets[i].format)))
+			continue;
+		for (j = 0; j < count; ++j) {
+			if (offered[j] == c->atoms[ZDL_ATOM_TARGET0 + i])
+				return i;
 		}
 	}
 	return -1;
 }
 
+/* convert received data into *buffer, taking ownership of the sink's buffer */
+static int zdl_clipboard_convert(zdl_clipboard_t c, int target,
+		struct zdl_sink *sink, struct zdl_clipboard_data *data, void **buffer)
+{
+	switch (zdl_clipboard_targets[target].format) {
+	case ZDL_CLIPBOARD_IMAGE: {
+		struct zdl_pixel_layout layout;
+		unsigned int *pixels;
+		unsigned int d0;
+		unsigned int w, h;
+		XImage *image;
+		Window root;
+		int d1;
+
+		if (sink->size < sizeof(Pixmap))
+			return -1;
+		XGetGeometry(c->window->display, ((Pixmap *)sink->data)[0],
+				&root, &d1, &d1, &w, &h,
+				&d0, &d0);
+		image = XGetImage(c->window->display, ((Pixmap *)sink->data)[0], 0, 0,
+				w, h, AllPlanes, ZPixmap);
+		if (image == NULL)
+			return -1;
+		/* image->data belongs to Xlib's allocator, so always convert into
+		 * our own buffer rather than in place */
+		pixels = (unsigned int *)zdl_malloc((size_t)w * h * 4);
+		if (pixels == NULL) {
+			XDestroyImage(image);
+			return -1;
+		}
+		layout.bpp = image->bits_per_pixel;
+		layout.red = image->red_mask;
+		layout.green = image->green_mask;
+		layout.blue = image->blue_mask;
+		if (zdl_pixel_expand(pixels, w * 4, image->data, image->bytes_per_line,
+				w, h, &layout, 0)) {
+			zdl_free(pixels);
+			XDestroyImage(image);
+			return -1;
+		}
+		XDestroyImage(image);
+		data->format = ZDL_CLIPBOARD_IMAGE;
+		data->image.pixels = pixels;
+		data->image.width = w;
+		data->image.height = h;
+		*buffer = (void *)pixels;
+		} break;
+	default:
+		if (sink->data == NULL)
+			return -1;
+		data->format = zdl_clipboard_targets[target].format;
+		*buffer = sink->data;
+		sink->data = NULL;
+		if (data->format == ZDL_CLIPBOARD_URI)
+			data->uri.uri = (const char *)*buffer;
+		else
+			data->text.text = (const char *)*buffer;
+		break;
+	}
+
+	return 0;
+}
+
+static int zdl_clipboard_complete(zdl_window_t w, int status, struct zdl_event *ev)
+{
+	zdl_clipboard_t c = w->paste.clipboard;
+	void *buffer;
+
+	if (status == 0)
+		status = zdl_clipboard_convert(c, w->paste.target, &w->paste.sink,
+				&c->result, &buffer);
+	if (status == 0)
+		zdl_selection_store(w, zdl_selection_find(w, w->paste.board),
+				w->paste.formats, &c->result, buffer);
+	zdl_free(w->paste.sink.data);
+	memset(&w->paste.sink, 0, sizeof(w->paste.sink));
+	w->paste.clipboard = NULL;
+	w->paste.incr = 0;
+
+	ev->type = ZDL_EVENT_CLIPBOARD;
+	ev->clipboard.clipboard = c;
+	ev->clipboard.status = status;
+	ev->clipboard.data = status == 0 ? &c->result : NULL;
+	return 0;
+}
+
+/* advance an outstanding asynchronous read on SelectionNotify */
+static int zdl_clipboard_notify(zdl_window_t w, const XSelectionEvent *event, struct zdl_event *ev)
+{
+	zdl_clipboard_t c = w->paste.clipboard;
+	struct zdl_sink targets = { 0 };
+	int target = -1;
+	size_t size;
+	Atom type;
+
+	if (c == NULL || event->selection != w->paste.board)
+		return -1;
+
+	if (event->property == None)
+		return zdl_clipboard_complete(w, -1, ev);
+
+	if (event->target != c->atoms[ZDL_ATOM_TARGETS]) {
+		if (zdl_read_property(w, event->property, &type, &w->paste.sink, &size) ||
+		    type == None)
+			return zdl_clipboard_complete(w, -1, ev);
+		if (type != w->xa_incr)
+			return zdl_clipboard_complete(w, 0, ev);
+		/* the data follows in chunks, see zdl_clipboard_property() */
+		w->paste.incr = 1;
+		w->paste.deadline = zdl_time_ms() + c->timeout;
+		return -1;
+	}
+
+	if (zdl_read_property(w, event->property, &type, &targets, &size) == 0)
+		target = zdl_clipboard_pick(c, (Atom *)targets.data,
+				size / sizeof(Atom), w->paste.formats);
+	zdl_free(targets.data);
+	if (target < 0)
+		return zdl_clipboard_complete(w, -1, ev);
+
+	/* request actual data */
+	w->paste.target = target;
+	XConvertSelection(w->display,
+			w->paste.board, c->atoms[ZDL_ATOM_TARGET0 + target],
+			w->paste.board, w->window, CurrentTime);
+	XFlush(w->display);
+	return -1;
+}
+
+/* PropertyNotify is selected on a foreign requestor while it has transfers
+ * outstanding; our own window always has it selected */
+static void zdl_transfer_select(zdl_window_t w, Window requestor, long mask)
+{
+	int i;
+
+	if (requestor == w->window)
+		return;
+	for (i = 0; i < w->transfers.count; ++i) {
+		if (w->transfers.list[i].requestor == requestor)
+			return;
+	}
+	XSelectInput(w->display, requestor, mask);
+}
+
+static void zdl_transfer_next(zdl_window_t w, int i)
+{
+	struct zdl_transfer *t = &w->transfers.list[i];
+	size_t chunk = t->size - t->offset;
+	size_t max = XMaxRequestSize(w->display) * 4 - 64;
+
+	if (chunk > max)
+		chunk = max;
+	XChangeProperty(w->display, t->requestor, t->property, t->type, 8,
+			PropModeReplace, (const unsigned char *)t->data + t->offset, chunk);
+	t->offset += chunk;
+
+	/* the zero-length chunk terminates the transfer */
+	if (chunk == 0) {
+		Window requestor = t->requestor;
+
+		w->transfers.list[i] = w->transfers.list[--w->transfers.count];
+		zdl_transfer_select(w, requestor, NoEventMask);
+	}
+}
+
+static void zdl_transfer_cancel(zdl_window_t w)
+{
+	while (w->transfers.count > 0) {
+		w->transfers.count--;
+		zdl_transfer_select(w, w->transfers.list[w->transfers.count].requestor,
+				NoEventMask);
+	}
+}
+
+/* store data on the requestor's property, using INCR when it does not fit
+ * in a single request */
+static int zdl_transfer_start(zdl_window_t w, Window requestor, Atom property,
+		Atom type, const char *data, size_t size)
+{
+	struct zdl_transfer *t;
+	long incr = size;
+
+	if (size <= XMaxRequestSize(w->display) * 4 - 64) {
+		XChangeProperty(w->display, requestor, property, type, 8,
+				PropModeReplace, (const unsigned char *)data, size);
+		return 0;
+	}
+
+	if (w->transfers.count == ZDL_TRANSFER_MAX)
+		return -1;
+
+	/* each deletion by the requestor asks for the next chunk */
+	zdl_transfer_select(w, requestor, PropertyChangeMask);
+
+	t = &w->transfers.list[w->transfers.count++];
+	t->requestor = requestor;
+	t->property = property;
+	t->type = type;
+	t->data = data;
+	t->size = size;
+	t->offset = 0;
+
+	XChangeProperty(w->display, requestor, property, w->xa_incr, 32,
+			PropModeReplace, (unsigned char *)&incr, 1);
+	return 0;
+}
+
+/* answer a SelectionRequest with a single property change, or start INCR */
+static Atom zdl_clipboard_serve(zdl_window_t w, const XSelectionRequestEvent *req)
+{
+	/* obsolete requestors leave the property to the owner */
+	Atom property = req->property != None ? req->property : req->target;
+	int i;
+
+	for (i = 0; i < w->clipboard.ntargets; ++i) {
+		if (w->clipboard.targets[i] == req->target)
+			break;
+	}
+	if (i == w->clipboard.ntargets)
+		return None;
+
+	if (i == 0) {
+		/* TARGETS */
+		XChangeProperty(w->display, req->requestor, property,
+				XA_ATOM, 32, PropModeReplace,
+				(unsigned char *)w->clipboard.targets,
+				w->clipboard.ntargets);
+	} else if (w->clipboard.types[i] == XA_PIXMAP) {
+		XChangeProperty(w->display, req->requestor, property,
+				XA_PIXMAP, 32, PropModeReplace,
+				(unsigned char *)&w->clipboard.pixmap, 1);
+	} else if (w->clipboard.types[i] == XA_STRING) {
+		if (zdl_transfer_start(w, req->requestor, property, XA_STRING,
+				w->clipboard.latin1, w->clipboard.latin1_size))
+			return None;
+	} else if (zdl_transfer_start(w, req->requestor, property,
+				w->clipboard.types[i], w->clipboard.data,
+				w->clipboard.size)) {
+		return None;
+	}
+	return property;
+}
+
+/* drive INCR transfers in both directions on PropertyNotify */
+static int zdl_clipboard_property(zdl_window_t w, const XPropertyEvent *event, struct zdl_event *ev)
+{
+	zdl_clipboard_t c = w->paste.clipboard;
+	size_t size;
+	Atom type;
+	int i;
+
+	if (event->state == PropertyDelete) {
+		for (i = 0; i < w->transfers.count; ++i) {
+			if (w->transfers.list[i].requestor == event->window &&
+			    w->transfers.list[i].property == event->atom) {
+				zdl_transfer_next(w, i);
+				break;
+			}
+		}
+		return -1;
+	}
+
+	if (c == NULL || !w->paste.incr ||
+	    event->window != w->window || event->atom != w->paste.board)
+		return -1;
+
+	if (zdl_read_property(w, event->atom, &type, &w->paste.sink, &size))
+		return zdl_clipboard_complete(w, -1, ev);
+	/* already consumed */
+	if (type == None)
+		return -1;
+
+	w->paste.deadline = zdl_time_ms() + c->timeout;
+	if (size != 0)
+		return -1;
+	return zdl_clipboard_complete(w, 0, ev);
+}
+
+/* fail an outstanding asynchronous read once its deadline passes */
+static int zdl_clipboard_expire(zdl_window_t w, struct zdl_event *ev)
+{
+	if (w->paste.clipboard == NULL || zdl_time_ms() < w->paste.deadline)
+		return -1;
+
+	zdl_clipboard_complete(w, -1, ev);
+	return 0;
+}
+
+/* sleep until the connection or a controller has something to read, but
+ * not past the deadline of an outstanding paste */
+static void zdl_window_block(zdl_window_t w)
+{
+	unsigned long long now;
+	struct pollfd pfd[2];
+	int timeout = -1;
+	int n = 1;
+
+	if (w->paste.clipboard != NULL) {
+		now = zdl_time_ms();
+		if (now >= w->paste.deadline)
+			return;
+		timeout = (int)(w->paste.deadline - now);
+	}
+
+	pfd[0].fd = ConnectionNumber(w->display);
+	pfd[0].events = POLLIN;
+	if (w->controllers.evdev != NULL) {
+		pfd[1].fd = w->controllers.wake[0];
+		pfd[1].events = POLLIN;
+		n = 2;
+	}
+	poll(pfd, n, timeout);
+}
+
+/* apply one ConfigureNotify, tracking the position in root coordinates
+ * without asking the server */
+static void zdl_window_configure(zdl_window_t w, const XConfigureEvent *e)
+{
+	if ((e->width  == w->width) &&
+	    (e->height == w->height) &&
+	    (e->x == w->lastconfig.x) &&
+	    (e->y == w->lastconfig.y))
+		return;
+
+	if (w->eatconfig) {
+		w->eatconfig--;
+		return;
+	}
+
+	if (e->send_event || w->parent == w->root) {
+		/* synthetic events from the window manager are in root
+		 * coordinates (ICCCM 4.1.5), as are real ones when not reparented */
+		w->x = e->x;
+		w->y = e->y;
+	} else {
+		/* relative to the frame; moving the frame itself is followed
+		 * by a synthetic event */
+		w->x += e->x - w->offset.x;
+		w->y += e->y - w->offset.y;
+	}
+	if (!e->send_event) {
+		w->offset.x = e->x;
+		w->offset.y = e->y;
+	}
+
+	w->lastconfig.x = e->x;
+	w->lastconfig.y = e->y;
+	w->width = e->width;
+	w->height = e->height;
+}
+
+struct zdl_configure_fold {
+	Window window;
+	int reparented;
+};
+
+/* matches queued ConfigureNotify events up to the first ReparentNotify,
+ * which changes how the ones after it are read; the queue is scanned in
+ * order, so the flag holds for the rest of the scan */
+static Bool zdl_configure_foldable(Display *d, XEvent *e, char *arg)
+{
+	struct zdl_configure_fold *f = (struct zdl_configure_fold *)arg;
+
+	if (e->type == ReparentNotify && e->xreparent.window == f->window)
+		f->reparented = 1;
+	return !f->reparented && e->type == ConfigureNotify &&
+		e->xconfigure.window == f->window;
+}
+
+static int zdl_window_read_event(zdl_window_t w, struct zdl_event *ev)
+{
+	static const enum zdl_button button_map[] = {
+		[Button1] = ZDL_BUTTON_LEFT,
+		[Button2] = ZDL_BUTTON_MIDDLE,
+		[Button3] = ZDL_BUTTON_RIGHT,
+		[Button4] = ZDL_BUTTON_MWUP,
+		[Button5] = ZDL_BUTTON_MWDOWN,
+	};
+	XEvent resp;
+	XEvent event;
+	int rc;
+
+	XNextEvent(w->display, &event);
+
+	rc = 0;
+
+	switch (event.type) {
+	case KeyPress:
+		ev->type = ZDL_EVENT_KEYPRESS;
+		rc = zdl_window_translate(w, 1, &event.xkey, ev);
+		break;
+	case KeyRelease:
+		ev->type = ZDL_EVENT_KEYRELEASE;
+		if (XEventsQueued(w->display, QueuedAfterReading)) {
+			XEvent nev;
+			XPeekEvent(w->display, &nev);
+			if (nev.type == KeyPress &&
+			    nev.xkey.time == event.xkey.time &&
+			    nev.xkey.keycode == event.xkey.keycode) {
+				rc = -1;
+				if (!(w->flags & ZDL_FLAG_KEYREPEAT))
+					XNextEvent(w->display, &nev);
+			}
+		}
+		if (rc != -1)
+			rc = zdl_window_translate(w, 0, &event.xkey, ev);
+		break;
+	case ButtonPress:
+		if (w->flags & ZDL_FLAG_CLIPBOARD && event.xbutton.button == 2) {
+			ev->type = ZDL_EVENT_PASTE;
+			w->eatpaste = 1;
+		} else {
+			ev->type = ZDL_EVENT_BUTTONPRESS;
+			ev->button.x = event.xbutton.x;
+			ev->button.y = event.xbutton.y;
+			zdl_window_scale_pointer(w, &ev->button.x, &ev->button.y);
+			ev->button.modifiers = w->modifiers;
+			ev->button.button = button_map[event.xbutton.button];
+		}
+		break;
+	case ButtonRelease:
+		if (w->eatpaste && event.xbutton.button == 2) {
+			w->eatpaste = 0;
+			rc = -1;
+		} else {
+			ev->type = ZDL_EVENT_BUTTONRELEASE;
+			ev->button.x = event.xbutton.x;
+			ev->button.y = event.xbutton.y;
+			zdl_window_scale_pointer(w, &ev->button.x, &ev->button.y);
+			ev->button.modifiers = w->modifiers;
+			ev->button.button = button_map[event.xbutton.button];
+		}
+		break;
+	case MotionNotify:
+		if ((w->flags & ZDL_FLAG_POINTERLOCK) && w->lock.grabbed) {
+			rc = zdl_pointer_motion(w, &event.xmotion, ev);
+			break;
+		}
+		ev->type = ZDL_EVENT_MOTION;
+		ev->motion.id = ZDL_MOTION_POINTER;
+		ev->motion.flags = ZDL_MOTION_FLAG_NONE;
+		ev->motion.history.count = 0;
+		if (w->flags & ZDL_FLAG_MOTION_HISTORY) {
+			/* fold all queued motion into this event, keeping each
+			 * sample; without PointerMotionHintMask the server
+			 * reports every one, so XGetMotionEvents() is not needed */
+			w->history.count = 0;
+			zdl_window_history_motion(w, &event.xmotion);
+			while (XEventsQueued(w->display, QueuedAfterReading)) {
+				XEvent nev;
+				XPeekEvent(w->display, &nev);
+				if (nev.type != MotionNotify ||
+				    nev.xmotion.window != event.xmotion.window)
+					break;
+				XNextEvent(w->display, &event);
+				zdl_window_history_motion(w, &event.xmotion);
+			}
+			ev->motion.history.count = w->history.count;
+			ev->motion.history.x = w->history.x;
+			ev->motion.history.y = w->history.y;
+			ev->motion.history.time = w->history.time;
+		}
+		ev->motion.x = event.xmotion.x;
+		ev->motion.y = event.xmotion.y;
+		zdl_window_scale_pointer(w, &ev->motion.x, &ev->motion.y);
+		ev->motion.d_x = (ev->motion.x - w->lastmotion.x);
+		ev->motion.d_y = (ev->motion.y - w->lastmotion.y);
+		w->lastmotion.x = ev->motion.x;
+		w->lastmotion.y = ev->motion.y;
+		break;
+	case FocusIn:
+		zdl_window_update_modifiers(w);
+		if (w->flags & ZDL_FLAG_POINTERLOCK)
+			zdl_pointer_lock(w, 1);
+		rc = -1;
+		break;
+	case FocusOut:
+		/* key releases now go elsewhere */
+		zdl_input_release_keys(&w->input);
+		/* free the pointer and stop taking raw motion meant for other
+		 * clients; FocusIn locks again */
+		if (w->flags & ZDL_FLAG_POINTERLOCK)
+			zdl_pointer_lock(w, 0);
+		rc = -1;
+		break;
+	case EnterNotify:
+		ev->type = ZDL_EVENT_GAINFOCUS;
+		w->lastmotion.x = event.xcrossing.x;
+		w->lastmotion.y = event.xcrossing.y;
+		zdl_window_scale_pointer(w, &w->lastmotion.x, &w->lastmotion.y);
+		break;
+	case LeaveNotify:
+		ev->type = ZDL_EVENT_LOSEFOCUS;
+		break;
+	case UnmapNotify:
+		/* iconified; mapping again brings an Expose */
+		if (event.xunmap.window != w->window) {
+			rc = -1;
+			break;
+		}
+		w->obscured = 0;
+		/* X releases a grab on a window that is no longer viewable */
+		w->lock.grabbed = 0;
+		ev->type = ZDL_EVENT_HIDE;
+		break;
+	case VisibilityNotify:
+		/* only without a compositor; redirected windows always read as
+		 * unobscured */
+		if (event.xvisibility.window != w->window) {
+			rc = -1;
+			break;
+		}
+		if (event.xvisibility.state == VisibilityFullyObscured) {
+			w->obscured = 1;
+			ev->type = ZDL_EVENT_HIDE;
+		} else if (w->obscured) {
+			/* backing store may spare the Expose, so redraw anyway */
+			w->obscured = 0;
+			ev->type = ZDL_EVENT_EXPOSE;
+			ev->expose.count = 0;
+			ev->expose.rects = NULL;
+			ev->expose.bounds.x = 0;
+			ev->expose.bounds.y = 0;
+			ev->expose.bounds.width = w->width;
+			ev->expose.bounds.height = w->height;
+		} else {
+			rc = -1;
+		}
+		break;
+	case ConfigureNotify: {
+		struct zdl_configure_fold fold;
+		int x = w->x, y = w->y;
+		int width = w->width, height = w->height;
+
+		if (event.xconfigure.window != w->window) {
+			rc = -1;
+			break;
+		}
+
+		/* an interactive resize queues a storm of these; fold them so
+		 * only the final geometry is reported */
+		zdl_window_configure(w, &event.xconfigure);
+		for (;;) {
+			fold.window = w->window;
+			fold.reparented = 0;
+			if (!XCheckIfEvent(w->display, &event, zdl_configure_foldable,
+					(char *)&fold))
+				break;
+			zdl_window_configure(w, &event.xconfigure);
+		}
+
+		if ((w->width  == width) &&
+		    (w->height == height) &&
+		    (w->x == x) && (w->y == y)) {
+			rc = -1;
+			break;
+		}
+
+		if ((w->width != width) || (w->height != height))
+			zdl_window_set_compositor_hints(w, w->width, w->height, w->flags);
+
+		ev->type = ZDL_EVENT_RECONFIGURE;
+		ev->reconfigure.width =  w->width;
+		ev->reconfigure.height = w->height;
+		} break;
+	case ReparentNotify:
+		if (event.xreparent.window == w->window) {
+			w->parent = event.xreparent.parent;
+			w->offset.x = event.xreparent.x;
+			w->offset.y = event.xreparent.y;
+		}
+		rc = -1;
+		break;
+	case Expose:
+		/* coalesce the whole series into a single event */
+		zdl_window_expose_add(w, &event.xexpose);
+		if (event.xexpose.count > 0) {
+			rc = -1;
+			break;
+		}
+		w->expose.open = 0;
+
+		ev->type = ZDL_EVENT_EXPOSE;
+		if (w->expose.count > 0) {
+			ev->expose.count = w->expose.count;
+			ev->expose.rects = w->expose.rects;
+			ev->expose.bounds = w->expose.bounds;
+		} else {
+			ev->expose.count = 0;
+			ev->expose.rects = NULL;
+			ev->expose.bounds.x = 0;
+			ev->expose.bounds.y = 0;
+			ev->expose.bounds.width = w->width;
+			ev->expose.bounds.height = w->height;
+		}
+		break;
+	case ClientMessage:
+		if (event.xclient.data.l[0] == w->wm_delete_window) {
+			ev->type = ZDL_EVENT_EXIT;
+			break;
+		} else {
+			rc = -1;
+		}
+		break;
+	case SelectionRequest:
+		resp.xselection.property = zdl_clipboard_serve(w, &event.xselectionrequest);
+		resp.xselection.type = SelectionNotify;
+		resp.xselection.display = event.xselectionrequest.display;
+		resp.xselection.requestor = event.xselectionrequest.requestor;
+		resp.xselection.selection = event.xselectionrequest.selection;
+		resp.xselection.target = event.xselectionrequest.target;
+		resp.xselection.time = event.xselectionrequest.time;
+		XSendEvent(w->display, event.xselectionrequest.requestor,
+				0, 0, &resp);
+		rc = -1;
+		break;
+	case SelectionNotify:
+		rc = zdl_clipboard_notify(w, &event.xselection, ev);
+		break;
+	case PropertyNotify:
+		rc = zdl_clipboard_property(w, &event.xproperty, ev);
+		break;
+#ifdef ZDL_HAVE_XI2
+	case GenericEvent:
+		rc = zdl_window_xi_event(w, &event, ev);
+		break;
+#endif
+	default:
+		rc = -1;
+		if (w->selections.fixes &&
+		    event.type == w->selections.fixes + XFixesSelectionNotify) {
+			if (zdl_selection_changed(w, (XFixesSelectionNotifyEvent *)&event) == 0) {
+				ev->type = ZDL_EVENT_CLIPBOARD_CHANGED;
+				rc = 0;
+			}
+		}
+		if (w->pixels.shm && event.type == w->pixels.completion) {
+			XShmCompletionEvent *done = (XShmCompletionEvent *)&event;
+			int i;
+
+			for (i = 0; i < 2; ++i) {
+				struct zdl_surface *s = &w->pixels.buffers[i];
+				if (s->busy && s->shm.shmseg == done->shmseg) {
+					s->busy = 0;
+					ev->type = ZDL_EVENT_PRESENTED;
+					rc = 0;
+				}
+			}
+		}
+		break;
+	}
+
+	return rc;
+}
+
+static int zdl_window_pop_modifiers(zdl_window_t w, struct zdl_event *ev)
+{
+	unsigned int chg;
+	int i;
+
+	if (w->modifiers == w->modifiers_to)
+		return -1;
+
+	chg = w->modifiers ^ w->modifiers_to;
+
+	for (i = 0; i < sizeof(w->modifiers) * 8; ++i) {
+		if (!(chg & (1 << i)))
+			continue;
+		if (w->modifiers_to & (1 << i)) {
+			w->modifiers |= (1 << i);
+			ev->type = ZDL_EVENT_KEYPRESS;
+		} else {
+			w->modifiers &= ~(1 << i);
+			ev->type = ZDL_EVENT_KEYRELEASE;
+		}
+		ev->key.sym = zdl_window_keysym(1 << i);
+		if (ev->key.sym != (enum zdl_keysym)-1) {
+			ev->key.scancode = 0;
+			ev->key.unicode = 0;
+			ev->key.modifiers = w->modifiers;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+
+static int zdl_window_pop_injected(zdl_window_t w, struct zdl_event *ev)
+{
+	if (w->injected.count == 0)
+		return -1;
+	*ev = w->injected.events[w->injected.head];
+	w->injected.head = (w->injected.head + 1) % ZDL_INJECT_MAX;
+	w->injected.count--;
+	return 0;
+}
+
+/* called from the evdev reader thread */
+static int zdl_controller_push(void *user, const struct zdl_event *ev)
+{
+	zdl_window_t w = (zdl_window_t)user;
+	int room, tail;
+
+	pthread_mutex_lock(&w->controllers.lock);
+	/* refuse rather than drop queued events, which could be a button
+	 * release; the reader reports the current state once drained */
+	room = ZDL_CONTROLLER_QUEUE - w->controllers.count;
+	if (room == 0 || (room <= ZDL_CONTROLLER_HOTPLUG &&
+	    ev->type != ZDL_EVENT_CONTROLLER_ADDED &&
+	    ev->type != ZDL_EVENT_CONTROLLER_REMOVED)) {
+		w->controllers.refused = 1;
+		pthread_mutex_unlock(&w->controllers.lock);
+		return -1;
+	}
+	tail = (w->controllers.head + w->controllers.count) % ZDL_CONTROLLER_QUEUE;
+	w->controllers.events[tail] = *ev;
+	if (w->controllers.count++ == 0) {
+		while (write(w->controllers.wake[1], "", 1) < 0 && errno == EINTR);
+	}
+	pthread_mutex_unlock(&w->controllers.lock);
+	return 0;
+}
+
+static int zdl_window_pop_controller(zdl_window_t w, struct zdl_event *ev)
+{
+	char buf[16];
+	int resync = 0;
+	int rc = -1;
+
+	if (w->controllers.evdev == NULL)
+		return -1;
+
+	pthread_mutex_lock(&w->controllers.lock);
+	if (w->controllers.count != 0) {
+		*ev = w->controllers.events[w->controllers.head];
+		w->controllers.head = (w->controllers.head + 1) % ZDL_CONTROLLER_QUEUE;
+		w->controllers.count--;
+		rc = 0;
+	}
+	if (w->controllers.count == 0) {
+		while (read(w->controllers.wake[0], buf, sizeof(buf)) > 0);
+		resync = w->controllers.refused;
+		w->controllers.refused = 0;
+	}
+	pthread_mutex_unlock(&w->controllers.lock);
+	if (resync)
+		zdl_evdev_resync(w->controllers.evdev);
+	return rc;
+}
+
+static int zdl_window_pending_event(zdl_window_t w, struct zdl_event *ev)
+{
+	if (zdl_window_pop_injected(w, ev) == 0)
+		return 0;
+	if (zdl_window_pop_controller(w, ev) == 0)
+		return 0;
+	return zdl_window_pop_modifiers(w, ev);
+}
+
+int zdl_window_inject_event(zdl_window_t w, const struct zdl_event *ev)
+{
+	int tail;
+
+	if (w->injected.count == ZDL_INJECT_MAX)
+		return -1;
+	tail = (w->injected.head + w->injected.count) % ZDL_INJECT_MAX;
+	w->injected.events[tail] = *ev;
+	w->injected.count++;
+	return 0;
+}
+
+int zdl_window_poll_event(zdl_window_t w, struct zdl_event *ev)
+{
+	int rc;
+
+	rc = zdl_window_pending_event(w, ev);
+	while (rc != 0 && XPending(w->display))
+		rc = zdl_window_read_event(w, ev);
+	if (rc != 0)
+		rc = zdl_clipboard_expire(w, ev);
+	if (rc == 0)
+		zdl_input_update(&w->input, ev);
+	return rc;
+}
+
+void zdl_window_wait_event(zdl_window_t w, struct zdl_event *ev)
+{
+	while (zdl_window_pending_event(w, ev) != 0) {
+		if (!XPending(w->display)) {
+			if (zdl_clipboard_expire(w, ev) == 0)
+				break;
+			zdl_window_block(w);
+			continue;
+		}
+		if (zdl_window_read_event(w, ev) == 0)
+			break;
+	}
+	zdl_input_update(&w->input, ev);
+}
+
+void zdl_window_get_input_state(const zdl_window_t w, struct zdl_input_state *state)
+{
+	*state = w->input;
+}
+
+int zdl_window_set_controllers(zdl_window_t w, int enabled)
+{
+	if (!enabled) {
+		if (w->controllers.evdev == NULL)
+			return 0;
+		zdl_evdev_destroy(w->controllers.evdev);
+		w->controllers.evdev = NULL;
+		w->controllers.count = 0;
+		pthread_mutex_destroy(&w->controllers.lock);
+		close(w->controllers.wake[0]);
+		close(w->controllers.wake[1]);
+		return 0;
+	}
+
+	if (w->controllers.evdev != NULL)
+		return 0;
+	if (pipe(w->controllers.wake) < 0)
+		return -1;
+	fcntl(w->controllers.wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(w->controllers.wake[0], F_SETFD, FD_CLOEXEC);
+	fcntl(w->controllers.wake[1], F_SETFD, FD_CLOEXEC);
+	pthread_mutex_init(&w->controllers.lock, NULL);
+	w->controllers.head = 0;
+	w->controllers.count = 0;
+	w->controllers.refused = 0;
+
+	/* the reader thread may push before this returns */
+	w->controllers.evdev = zdl_evdev_create(zdl_controller_push, w);
+	if (w->controllers.evdev == NULL) {
+		pthread_mutex_destroy(&w->controllers.lock);
+		close(w->controllers.wake[0]);
+		close(w->controllers.wake[1]);
+		return -1;
+	}
+	return 0;
+}
+
+int zdl_window_get_controller_name(zdl_window_t w, int id, char *name, size_t size)
+{
+	if (w->controllers.evdev == NULL)
+		return -1;
+	return zdl_evdev_get_name(w->controllers.evdev, id, name, size);
+}
+
+void zdl_window_warp_mouse(zdl_window_t w, int x, int y)
+{
+	if (w->scaler.width != 0) {
+		x = (x * w->width) / w->scaler.width;
+		y = (y * w->height) / w->scaler.height;
+	}
+	XWarpPointer(w->display, None, w->window, 0, 0, 0, 0, x, y);
+}
+
+unsigned long long zdl_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int zdl_target_resize(zdl_window_t w, struct zdl_target *t, int width, int height)
+{
+	const struct zdl_gl *gl = &w->gl;
+
+	gl->BindRenderbuffer(GL_RENDERBUFFER, t->color);
+	gl->RenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	gl->BindRenderbuffer(GL_RENDERBUFFER, t->depth);
+	gl->RenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	gl->BindRenderbuffer(GL_RENDERBUFFER, 0);
+	t->width = width;
+	t->height = height;
+	t->storage++;
+
+	gl->BindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+	if (gl->CheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		return -1;
+	return 0;
+}
+
+static int zdl_target_init(zdl_window_t w, struct zdl_target *t, int width, int height)
+{
+	const struct zdl_gl *gl = &w->gl;
+
+	memset(t, 0, sizeof(*t));
+	gl->GenFramebuffers(1, &t->fbo);
+	gl->GenRenderbuffers(1, &t->color);
+	gl->GenRenderbuffers(1, &t->depth);
+
+	gl->BindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+	gl->FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_RENDERBUFFER, t->color);
+	gl->FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+			GL_RENDERBUFFER, t->depth);
+
+	return zdl_target_resize(w, t, width, height);
+}
+
+static void zdl_target_fini(zdl_window_t w, struct zdl_target *t)
+{
+	const struct zdl_gl *gl = &w->gl;
+
+	if (t->rendered != NULL)
+		gl->DeleteSync(t->rendered);
+	if (t->released != NULL)
+		gl->DeleteSync(t->released);
+	gl->DeleteFramebuffers(1, &t->fbo);
+	gl->DeleteRenderbuffers(1, &t->color);
+	gl->DeleteRenderbuffers(1, &t->depth);
+	memset(t, 0, sizeof(*t));
+}
+
+/* in the presenter context; reattaching picks up storage reallocated by
+ * the other context */
+static void zdl_presenter_bind(zdl_window_t w, struct zdl_target *t)
+{
+	const struct zdl_gl *gl = &w->gl;
+
+	if (t->present_fbo == 0)
+		gl->GenFramebuffers(1, &t->present_fbo);
+	gl->BindFramebuffer(GL_READ_FRAMEBUFFER, t->present_fbo);
+	if (t->present_storage != t->storage) {
+		gl->FramebufferRenderbuffer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				GL_RENDERBUFFER, t->color);
+		t->present_storage = t->storage;
+	}
+}
+
+static void *zdl_presenter_thread(void *arg)
+{
+	zdl_window_t w = (zdl_window_t)arg;
+	struct zdl_presenter *p = &w->presenter;
+	const struct zdl_gl *gl = &w->gl;
+	int i;
+
+	glXMakeCurrent(w->display, w->window, p->context);
+	zdl_window_set_swap_interval(w, 0);
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		struct zdl_target *t;
+
+		while (p->running && p->queued == 0)
+			pthread_cond_wait(&p->cond, &p->lock);
+		if (p->queued == 0)
+			break;
+
+		t = &p->targets[p->queue[p->head]];
+		p->head = (p->head + 1) % p->count;
+		p->queued--;
+		pthread_mutex_unlock(&p->lock);
+
+		gl->WaitSync(t->rendered, 0, GL_TIMEOUT_IGNORED);
+		gl->DeleteSync(t->rendered);
+		t->rendered = NULL;
+
+		zdl_presenter_bind(w, t);
+		gl->BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		gl->BlitFramebuffer(0, 0, t->width, t->height,
+				0, 0, t->present.width, t->present.height,
+				GL_COLOR_BUFFER_BIT, t->filter);
+		glXSwapBuffers(w->display, w->window);
+
+		/* the target may be rendered into again once the blit is done */
+		t->released = gl->FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+
+		pthread_mutex_lock(&p->lock);
+		t->busy = 0;
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	gl->BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	for (i = 0; i < p->count; ++i) {
+		struct zdl_target *t = &p->targets[i];
+
+		if (t->present_fbo != 0)
+			gl->DeleteFramebuffers(1, &t->present_fbo);
+		t->present_fbo = 0;
+	}
+	glXMakeCurrent(w->display, None, NULL);
+	return NULL;
+}
+
+static struct zdl_target *zdl_presenter_free_target(struct zdl_presenter *p)
+{
+	int i;
+
+	for (i = 0; i < p->count; ++i) {
+		if (!p->targets[i].busy)
+			return &p->targets[i];
+	}
+	return NULL;
+}
+
+static void zdl_presenter_acquire(zdl_window_t w)
+{
+	struct zdl_presenter *p = &w->presenter;
+	const struct zdl_gl *gl = &w->gl;
+	struct zdl_target *t;
+	int width, height;
+
+	pthread_mutex_lock(&p->lock);
+	while ((t = zdl_presenter_free_target(p)) == NULL)
+		pthread_cond_wait(&p->cond, &p->lock);
+	t->busy = 1;
+	p->current = t - p->targets;
+	pthread_mutex_unlock(&p->lock);
+
+	if (t->released != NULL) {
+		gl->WaitSync(t->released, 0, GL_TIMEOUT_IGNORED);
+		gl->DeleteSync(t->released);
+		t->released = NULL;
+	}
+
+	zdl_window_render_size(w, &width, &height);
+	if (t->width != width || t->height != height)
+		zdl_target_resize(w, t, width, height);
+	gl->BindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+}
+
+static void zdl_presenter_submit(zdl_window_t w)
+{
+	struct zdl_presenter *p = &w->presenter;
+	struct zdl_target *t = &p->targets[p->current];
+
+	t->rendered = w->gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	pthread_mutex_lock(&p->lock);
+	t->present.width = w->width;
+	t->present.height = w->height;
+	t->filter = w->scaler.width != 0 ? w->scaler.filter : GL_NEAREST;
+	p->queue[(p->head + p->queued) % p->count] = p->current;
+	p->queued++;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+
+	zdl_presenter_acquire(w);
+}
+
+static void zdl_presenter_stop(zdl_window_t w)
+{
+	struct zdl_presenter *p = &w->presenter;
+	int i;
+
+	pthread_mutex_lock(&p->lock);
+	p->running = 0;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	pthread_join(p->thread, NULL);
+
+	w->gl.BindFramebuffer(GL_FRAMEBUFFER, w->scaler.target.fbo);
+	for (i = 0; i < p->count; ++i)
+		zdl_target_fini(w, &p->targets[i]);
+	p->count = 0;
+
+	glXDestroyContext(w->display, p->context);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+}
+
+int zdl_window_set_swap_queue(zdl_window_t w, int depth)
+{
+	struct zdl_presenter *p = &w->presenter;
+	int width, height;
+	int i;
+
+	if (depth < 0 || depth > ZDL_SWAP_QUEUE_MAX)
+		return -1;
+
+	if (p->running)
+		zdl_presenter_stop(w);
+	if (depth == 0)
+		return 0;
+
+	if (!w->gl.has_fbo || !w->gl.has_sync)
+		return -1;
+
+	p->context = glXCreateContext(w->display, w->visual, w->context, GL_TRUE);
+	if (p->context == NULL)
+		return -1;
+
+	zdl_window_render_size(w, &width, &height);
+	p->count = depth + 1;
+	for (i = 0; i < p->count; ++i) {
+		if (zdl_target_init(w, &p->targets[i], width, height))
+			break;
+	}
+	if (i != p->count) {
+		p->count = i + 1;
+		goto err_targets;
+	}
+
+	p->head = 0;
+	p->queued = 0;
+	p->running = 1;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	zdl_presenter_acquire(w);
+
+	if (pthread_create(&p->thread, NULL, zdl_presenter_thread, w)) {
+		p->running = 0;
+		pthread_cond_destroy(&p->cond);
+		pthread_mutex_destroy(&p->lock);
+		goto err_targets;
+	}
+
+	return 0;
+
+err_targets:
+	w->gl.BindFramebuffer(GL_FRAMEBUFFER, w->scaler.target.fbo);
+	for (i = 0; i < p->count; ++i)
+		zdl_target_fini(w, &p->targets[i]);
+	p->count = 0;
+	glXDestroyContext(w->display, p->context);
+	return -1;
+}
+
+int zdl_window_swap_ready(zdl_window_t w)
+{
+	struct zdl_presenter *p = &w->presenter;
+	struct zdl_target *t;
+
+	if (!p->running)
+		return 0;
+
+	pthread_mutex_lock(&p->lock);
+	t = zdl_presenter_free_target(p);
+	pthread_mutex_unlock(&p->lock);
+
+	if (t == NULL)
+		return -1;
+	if (t->released != NULL &&
+	    w->gl.ClientWaitSync(t->released, 0, 0) == GL_TIMEOUT_EXPIRED)
+		return -1;
+	return 0;
+}
+
+unsigned int zdl_window_get_framebuffer(zdl_window_t w)
+{
+	struct zdl_presenter *p = &w->presenter;
+
+	if (!p->running)
+		return w->scaler.target.fbo;
+	return p->targets[p->current].fbo;
+}
+
+int zdl_window_set_render_size(zdl_window_t w, int width, int height, enum zdl_filter filter)
+{
+	struct zdl_presenter *p = &w->presenter;
+	struct zdl_target *t = &w->scaler.target;
+	int rc = 0;
+
+	if (width < 0 || height < 0 || (width == 0) != (height == 0))
+		return -1;
+	if (width == 0 && w->scaler.width == 0)
+		return 0;
+	if (width != 0 && !w->gl.has_fbo)
+		return -1;
+
+	if (width == 0) {
+		if (w->scaler.width != 0)
+			zdl_target_fini(w, t);
+	} else if (w->scaler.width == 0) {
+		if (zdl_target_init(w, t, width, height)) {
+			zdl_target_fini(w, t);
+			width = height = 0;
+			rc = -1;
+		}
+	} else if (zdl_target_resize(w, t, width, height)) {
+		zdl_target_fini(w, t);
+		width = height = 0;
+		rc = -1;
+	}
+
+	w->scaler.width = width;
+	w->scaler.height = height;
+	w->scaler.filter = (filter == ZDL_FILTER_LINEAR) ? GL_LINEAR : GL_NEAREST;
+
+	if (p->running) {
+		/* the acquired target is resized here; the rest as they are reused */
+		zdl_window_render_size(w, &width, &height);
+		zdl_target_resize(w, &p->targets[p->current], width, height);
+		w->gl.BindFramebuffer(GL_FRAMEBUFFER, p->targets[p->current].fbo);
+	} else {
+		w->gl.BindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+	}
+
+	zdl_window_render_size(w, &width, &height);
+	glViewport(0, 0, width, height);
+	return rc;
+}
+
+static void zdl_limiter_clear(zdl_window_t w)
+{
+	struct zdl_limiter *l = &w->limiter;
+	int i;
+
+	for (i = 0; i < ZDL_FRAMES_IN_FLIGHT_MAX; ++i) {
+		if (l->fences[i] != NULL)
+			w->gl.DeleteSync(l->fences[i]);
+		l->fences[i] = NULL;
+	}
+	l->head = 0;
+}
+
+static void zdl_limiter_wait(zdl_window_t w)
+{
+	struct zdl_limiter *l = &w->limiter;
+	GLsync fence = l->fences[l->head];
+
+	/* the slot being reused holds the fence from max frames earlier */
+	if (fence != NULL) {
+		unsigned long long start = zdl_time_ns();
+
+		w->gl.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+				1000000000ULL);
+		w->gl.DeleteSync(fence);
+		w->pacer.waited += zdl_time_ns() - start;
+	}
+
+	l->fences[l->head] = w->gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	l->head = (l->head + 1) % l->max;
+}
+
+int zdl_window_set_max_frames_in_flight(zdl_window_t w, int n)
+{
+	if (n < 0 || n > ZDL_FRAMES_IN_FLIGHT_MAX)
+		return -1;
+	if (n != 0 && !w->gl.has_sync)
+		return -1;
+
+	zdl_limiter_clear(w);
+	w->limiter.max = n;
+	return 0;
+}
+
+static void zdl_capture_read(zdl_window_t w)
+{
+	struct zdl_capture *c = &w->capture;
+	const struct zdl_gl *gl = &w->gl;
+	int width, height;
+	int i;
+
+	if (c->pending == ZDL_CAPTURE_RING) {
+		c->dropped++;
+		return;
+	}
+
+	zdl_window_render_size(w, &width, &height);
+	i = (c->head + c->pending) % ZDL_CAPTURE_RING;
+	gl->BindBuffer(GL_PIXEL_PACK_BUFFER, c->slots[i].pbo);
+	if (c->slots[i].width != width || c->slots[i].height != height) {
+		gl->BufferData(GL_PIXEL_PACK_BUFFER, width * height * 4,
+				NULL, GL_STREAM_READ);
+		c->slots[i].width = width;
+		c->slots[i].height = height;
+	}
+	/* BGRA is the native layout, so the driver can DMA without converting;
+	 * any swizzle is done on the CPU when the frame is collected */
+	glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+	gl->BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	c->slots[i].fence = gl->FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	c->pending++;
+}
+
+int zdl_window_capture_begin(zdl_window_t w, enum zdl_pixel_format format)
+{
+	struct zdl_capture *c = &w->capture;
+	int i;
+
+	if (!w->gl.has_pbo || !w->gl.has_sync)
+		return -1;
+
+	if (!c->active) {
+		for (i = 0; i < ZDL_CAPTURE_RING; ++i) {
+			w->gl.GenBuffers(1, &c->slots[i].pbo);
+			c->slots[i].width = 0;
+			c->slots[i].height = 0;
+		}
+		c->head = 0;
+		c->pending = 0;
+		c->dropped = 0;
+		c->active = 1;
+	}
+	c->format = format;
+	return 0;
+}
+
+int zdl_window_capture_poll(zdl_window_t w, struct zdl_capture_frame *frame)
+{
+	struct zdl_capture *c = &w->capture;
+	const struct zdl_gl *gl = &w->gl;
+	unsigned int ops = ZDL_PIXEL_FLIP_Y;
+	size_t size;
+	void *src;
+	int i;
+
+	if (c->pending == 0)
+		return -1;
+
+	i = c->head;
+	if (gl->ClientWaitSync(c->slots[i].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) ==
+			GL_TIMEOUT_EXPIRED)
+		return -1;
+	gl->DeleteSync(c->slots[i].fence);
+	c->slots[i].fence = NULL;
+	c->head = (c->head + 1) % ZDL_CAPTURE_RING;
+	c->pending--;
+
+	size = c->slots[i].width * c->slots[i].height * 4;
+	if (size > c->size) {
+		void *pixels = zdl_realloc(c->pixels, size);
+		if (pixels == NULL)
+			return -1;
+		c->pixels = pixels;
+		c->size = size;
+	}
+
+	gl->BindBuffer(GL_PIXEL_PACK_BUFFER, c->slots[i].pbo);
+	src = gl->MapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (src == NULL) {
+		gl->BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return -1;
+	}
+	if (c->format == ZDL_PIXEL_RGBA8888)
+		ops |= ZDL_PIXEL_SWAP_RB;
+	zdl_pixel_convert(c->pixels, c->slots[i].width * 4,
+			src, c->slots[i].width * 4,
+			c->slots[i].width, c->slots[i].height, ops);
+	gl->UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	gl->BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	frame->pixels = c->pixels;
+	frame->width = c->slots[i].width;
+	frame->height = c->slots[i].height;
+	frame->stride = c->slots[i].width * 4;
+	frame->format = c->format;
+	frame->dropped = c->dropped;
+	c->dropped = 0;
+	return 0;
+}
+
+void zdl_window_capture_end(zdl_window_t w)
+{
+	struct zdl_capture *c = &w->capture;
+	int i;
+
+	if (!c->active)
+		return;
+
+	for (i = 0; i < ZDL_CAPTURE_RING; ++i) {
+		if (c->slots[i].fence != NULL)
+			w->gl.DeleteSync(c->slots[i].fence);
+		w->gl.DeleteBuffers(1, &c->slots[i].pbo);
+	}
+	zdl_free(c->pixels);
+	memset(c, 0, sizeof(*c));
+}
+
+/* returns 0 if the back buffer was left intact */
+static int zdl_window_present(zdl_window_t w, const struct zdl_rect *rects, int count)
+{
+	int preserved = -1;
+	int i;
+
+	if (w->context == NULL)
+		return -1;
+
+	if (w->pacer.hz != 0)
+		zdl_pacer_wait(&w->pacer);
+
+	if (w->capture.active)
+		zdl_capture_read(w);
+
+	if (w->presenter.running) {
+		zdl_presenter_submit(w);
+	} else if (w->scaler.width != 0) {
+		/* damage is ignored, the whole frame is scaled anyway */
+		w->gl.BindFramebuffer(GL_READ_FRAMEBUFFER, w->scaler.target.fbo);
+		w->gl.BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		w->gl.BlitFramebuffer(0, 0, w->scaler.width, w->scaler.height,
+				0, 0, w->width, w->height,
+				GL_COLOR_BUFFER_BIT, w->scaler.filter);
+		glXSwapBuffers(w->display, w->window);
+		w->gl.BindFramebuffer(GL_FRAMEBUFFER, w->scaler.target.fbo);
+	} else if (rects != NULL && w->gl.has_copy_sub_buffer) {
+		/* GL window coordinates have a bottom-left origin */
+		for (i = 0; i < count; ++i) {
+			w->gl.CopySubBuffer(w->display, w->window,
+					rects[i].x,
+					w->height - (rects[i].y + rects[i].height),
+					rects[i].width, rects[i].height);
+		}
+		preserved = 0;
+	} else {
+		glXSwapBuffers(w->display, w->window);
+	}
+
+	if (w->limiter.max != 0)
+		zdl_limiter_wait(w);
+	zdl_pacer_record(&w->pacer);
+	return preserved;
+}
+
+int zdl_window_lock_pixels(zdl_window_t w, struct zdl_pixels *pixels)
+{
+	struct zdl_surface *s = &w->pixels.buffers[w->pixels.current];
+	XImage *image;
+
+	if (!(w->flags & ZDL_FLAG_PIXELS))
+		return -1;
+
+	zdl_surface_wait(w, s);
+	if (s->image == NULL ||
+	    s->image->width != w->width || s->image->height != w->height) {
+		zdl_surface_fini(w, s);
+		if (zdl_surface_init(w, s, w->width, w->height))
+			return -1;
+	}
+
+	image = s->image;
+	if (image->bits_per_pixel != 32) {
+		fprintf(stderr, "Unsupported pixel surface depth %d\n",
+				image->bits_per_pixel);
+		return -1;
+	}
+
+	pixels->pixels = image->data;
+	pixels->width = image->width;
+	pixels->height = image->height;
+	pixels->stride = image->bytes_per_line;
+	if (image->red_mask == 0xff0000)
+		pixels->format = ZDL_PIXEL_BGRA8888;
+	else
+		pixels->format = ZDL_PIXEL_RGBA8888;
+	return 0;
+}
 
-static int zdl_window_pending_event(zdl_window_t w, struct zdl_event *ev)
+void zdl_window_unlock_pixels(zdl_window_t w)
 {
-	return zdl_window_pop_modifiers(w, ev);
+	struct zdl_surface *s = &w->pixels.buffers[w->pixels.current];
+	struct zdl_event ev;
+
+	if (s->image == NULL)
+		return;
+
+	if (w->pacer.hz != 0)
+		zdl_pacer_wait(&w->pacer);
+
+	if (s->shm.shmaddr != NULL) {
+		XShmPutImage(w->display, w->window, w->pixels.gc, s->image,
+				0, 0, 0, 0, s->image->width, s->image->height, True);
+		s->busy = 1;
+	} else {
+		XPutImage(w->display, w->window, w->pixels.gc, s->image,
+				0, 0, 0, 0, s->image->width, s->image->height);
+		/* the pixels were copied into the request, so release at once */
+		ev.type = ZDL_EVENT_PRESENTED;
+		zdl_window_inject_event(w, &ev);
+	}
+	XFlush(w->display);
+	w->pixels.current ^= 1;
+
+	zdl_pacer_record(&w->pacer);
 }
 
-int zdl_window_poll_event(zdl_window_t w, struct zdl_event *ev)
+void zdl_window_swap(zdl_window_t w)
 {
-	if (zdl_window_pending_event(w, ev) == 0)
-		return 0;
-	while (XPending(w->display)) {
-		if (zdl_window_read_event(w, ev) == 0)
-			return 0;
-	}
-	return -1;
+	zdl_window_present(w, NULL, 0);
 }
 
-void zdl_window_wait_event(zdl_window_t w, struct zdl_event *ev)
+int zdl_window_swap_with_damage(zdl_window_t w, const struct zdl_rect *rects, int count)
 {
-	if (zdl_window_pending_event(w, ev) == 0)
-		return;
-	while (zdl_window_read_event(w, ev) != 0);
+	return zdl_window_present(w, rects, count);
 }
 
-void zdl_window_warp_mouse(zdl_window_t w, int x, int y)
+void zdl_window_set_target_rate(zdl_window_t w, unsigned int hz)
 {
-	XWarpPointer(w->display, None, w->window, 0, 0, 0, 0, x, y);
+	zdl_pacer_set_rate(&w->pacer, hz);
 }
 
-void zdl_window_swap(zdl_window_t w)
+void zdl_window_get_frame_stats(const zdl_window_t w, struct zdl_frame_stats *stats)
 {
-	glXSwapBuffers(w->display, w->window);
+	zdl_pacer_get_stats(&w->pacer, stats);
 }
 
 void zdl_window_set_title(zdl_window_t w, const char *icon, const char *name)
@@ -941,6 +3447,121 @@ void zdl_window_set_title(zdl_window_t w, const char *icon, const char *name)
 	XSetIconName(w->display, w->window, icon);
 }
 
+int zdl_window_is_unredirected(const zdl_window_t w)
+{
+	char name[32];
+	Atom cm;
+
+	/* a running compositing manager owns _NET_WM_CM_S<screen> */
+	snprintf(name, sizeof(name), "_NET_WM_CM_S%d", w->screen);
+	cm = XInternAtom(w->display, name, False);
+	if (XGetSelectionOwner(w->display, cm) == None)
+		return 1;
+
+	return (w->flags & ZDL_FLAG_FULLSCREEN) && !(w->flags & ZDL_FLAG_NOBYPASS);
+}
+
+#define ZDL_VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR 1000004000
+
+/* from vulkan_xlib.h, so the Vulkan headers are not needed to build */
+struct zdl_vk_xlib_surface_create_info {
+	int sType;
+	const void *pNext;
+	unsigned int flags;
+	Display *dpy;
+	Window window;
+};
+
+typedef void (*zdl_vk_void_function)(void);
+typedef zdl_vk_void_function (*zdl_vk_get_instance_proc_addr)(void *instance, const char *name);
+typedef int (*zdl_vk_create_xlib_surface)(void *instance,
+		const struct zdl_vk_xlib_surface_create_info *info,
+		const void *allocator, void *surface);
+
+const char *const *zdl_vulkan_get_instance_extensions(unsigned int *count)
+{
+	static const char *const extensions[] = {
+		"VK_KHR_surface",
+		"VK_KHR_xlib_surface",
+	};
+
+	*count = sizeof(extensions)/sizeof(extensions[0]);
+	return extensions;
+}
+
+int zdl_window_create_vulkan_surface(zdl_window_t w, void *instance, const void *allocator, void *surface)
+{
+	static void *loader;
+	struct zdl_vk_xlib_surface_create_info info;
+	zdl_vk_get_instance_proc_addr get_proc;
+	zdl_vk_create_xlib_surface create;
+
+	if (w->context != NULL) {
+		fprintf(stderr, "Vulkan surface on a GL window; use ZDL_FLAG_NOGL\n");
+		return -1;
+	}
+
+	if (loader == NULL)
+		loader = dlopen("libvulkan.so.1", RTLD_NOW | RTLD_LOCAL);
+	if (loader == NULL) {
+		fprintf(stderr, "Unable to load Vulkan: %s\n", dlerror());
+		return -1;
+	}
+
+	get_proc = (zdl_vk_get_instance_proc_addr)dlsym(loader, "vkGetInstanceProcAddr");
+	if (get_proc == NULL)
+		return -1;
+	create = (zdl_vk_create_xlib_surface)get_proc(instance, "vkCreateXlibSurfaceKHR");
+	if (create == NULL) {
+		fprintf(stderr, "VK_KHR_xlib_surface not enabled on instance\n");
+		return -1;
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.sType = ZDL_VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR;
+	info.dpy = w->display;
+	info.window = w->window;
+
+	/* VK_SUCCESS is 0 */
+	return create(instance, &info, allocator, surface) == 0 ? 0 : -1;
+}
+
+static int zdl_present_mode_supported(const enum zdl_present_mode *modes, int count,
+		enum zdl_present_mode mode)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (modes[i] == mode)
+			return 1;
+	}
+	return 0;
+}
+
+enum zdl_present_mode zdl_window_choose_present_mode(const zdl_window_t w,
+		const enum zdl_present_mode *modes, int count, int vsync)
+{
+	static const enum zdl_present_mode tearing[] = {
+		ZDL_PRESENT_IMMEDIATE,
+		ZDL_PRESENT_MAILBOX,
+		ZDL_PRESENT_FIFO_RELAXED,
+	};
+	int i;
+
+	if (vsync) {
+		if (zdl_window_is_unredirected(w) &&
+		    zdl_present_mode_supported(modes, count, ZDL_PRESENT_MAILBOX))
+			return ZDL_PRESENT_MAILBOX;
+		return ZDL_PRESENT_FIFO;
+	}
+
+	for (i = 0; i < sizeof(tearing)/sizeof(tearing[0]); ++i) {
+		if (zdl_present_mode_supported(modes, count, tearing[i]))
+			return tearing[i];
+	}
+	return ZDL_PRESENT_FIFO;
+}
+
 union zdl_native_handle zdl_window_native_handle(zdl_window_t w)
 {
 	union zdl_native_handle ret;
@@ -951,259 +3572,484 @@ union zdl_native_handle zdl_window_native_handle(zdl_window_t w)
 	return ret;
 }
 
-struct zdl_clipboard {
-	zdl_window_t window;
-	void *data;
-};
-
 zdl_clipboard_t zdl_clipboard_open(zdl_window_t w)
 {
+	char *names[ZDL_ATOM_TARGET0 + ZDL_CLIPBOARD_NTARGETS];
 	zdl_clipboard_t c;
+	int i;
 
-	c = (zdl_clipboard_t)calloc(1, sizeof(*c));
+	c = (zdl_clipboard_t)zdl_calloc(1, sizeof(*c));
 	if (c == NULL)
 		return ZDL_CLIPBOARD_INVALID;
 
 	c->window = w;
+	c->timeout = ZDL_CLIPBOARD_TIMEOUT;
+
+	names[ZDL_ATOM_TARGETS] = "TARGETS";
+	for (i = 0; i < ZDL_CLIPBOARD_NTARGETS; ++i)
+		names[ZDL_ATOM_TARGET0 + i] = (char *)zdl_clipboard_targets[i].name;
+	XInternAtoms(w->display, names, ZDL_ATOM_TARGET0 + ZDL_CLIPBOARD_NTARGETS,
+			False, c->atoms);
 
 	return c;
 }
 
 void zdl_clipboard_close(zdl_clipboard_t c)
 {
-	if (c->data != NULL) {
-		free(c->data);
-		c->data = NULL;
+	if (c->window->paste.clipboard == c) {
+		zdl_free(c->window->paste.sink.data);
+		memset(&c->window->paste, 0, sizeof(c->window->paste));
 	}
-	free(c);
+	zdl_free(c);
 }
 
-int zdl_clipboard_write(zdl_clipboard_t c, const struct zdl_clipboard_data *data)
+void zdl_clipboard_set_timeout(zdl_clipboard_t c, unsigned int ms)
+{
+	c->timeout = ms;
+}
+
+static Atom zdl_clipboard_atom(zdl_clipboard_t c, const char *name)
+{
+	int i;
+
+	for (i = 0; i < ZDL_CLIPBOARD_NTARGETS; ++i) {
+		if (strcmp(zdl_clipboard_targets[i].name, name) == 0)
+			return c->atoms[ZDL_ATOM_TARGET0 + i];
+	}
+	return None;
+}
+
+static void zdl_clipboard_offer(zdl_clipboard_t c, const char *name, const char *type)
+{
+	zdl_window_t w = c->window;
+	int i = w->clipboard.ntargets++;
+
+	w->clipboard.targets[i] = zdl_clipboard_atom(c, name);
+	w->clipboard.types[i] = zdl_clipboard_atom(c, type);
+}
+
+/* drop the owned selection, releasing its buffers */
+static void zdl_clipboard_disown(zdl_window_t w)
+{
+	/* outstanding transfers refer to the old data */
+	zdl_transfer_cancel(w);
+
+	if (w->clipboard.release != NULL)
+		w->clipboard.release(w->clipboard.user, w->clipboard.data);
+	if (w->clipboard.pixmap != None)
+		XFreePixmap(w->display, w->clipboard.pixmap);
+	zdl_free(w->clipboard.latin1);
+	memset(&w->clipboard, 0, sizeof(w->clipboard));
+}
+
+/* decode UTF-8, replacing what Latin-1 cannot hold and malformed input
+ * with '?'; the result is never longer than the input */
+static size_t zdl_utf8_to_latin1(char *dst, const char *src, size_t size)
+{
+	const unsigned char *s = (const unsigned char *)src;
+	const unsigned char *end = s + size;
+	size_t n = 0;
+	unsigned int cp;
+	int len, i;
+
+	while (s < end) {
+		if (s[0] < 0x80) {
+			dst[n++] = *s++;
+			continue;
+		}
+		if ((s[0] & 0xe0) == 0xc0) {
+			cp = s[0] & 0x1f;
+			len = 2;
+		} else if ((s[0] & 0xf0) == 0xe0) {
+			cp = s[0] & 0x0f;
+			len = 3;
+		} else if ((s[0] & 0xf8) == 0xf0) {
+			cp = s[0] & 0x07;
+			len = 4;
+		} else {
+			dst[n++] = '?';
+			s++;
+			continue;
+		}
+		for (i = 1; i < len && s + i < end && (s[i] & 0xc0) == 0x80; ++i)
+			cp = (cp << 6) | (s[i] & 0x3f);
+		/* a truncated sequence becomes a single '?' */
+		dst[n++] = (i == len && cp >= 0x80 && cp <= 0xff) ? (char)cp : '?';
+		s += i;
+	}
+	return n;
+}
+
+/* take the selection and precompute the targets served for format */
+static void zdl_clipboard_own(zdl_clipboard_t c, enum zdl_clipboard_format format)
+{
+	zdl_window_t w = c->window;
+
+	w->clipboard.targets[0] = c->atoms[ZDL_ATOM_TARGETS];
+	w->clipboard.types[0] = XA_ATOM;
+	w->clipboard.ntargets = 1;
+
+	switch (format) {
+	case ZDL_CLIPBOARD_IMAGE:
+		zdl_clipboard_offer(c, "PIXMAP", "PIXMAP");
+		break;
+	case ZDL_CLIPBOARD_URI:
+		zdl_clipboard_offer(c, "text/uri-list", "text/uri-list");
+		/* fall through */
+	case ZDL_CLIPBOARD_TEXT:
+		zdl_clipboard_offer(c, "UTF8_STRING", "UTF8_STRING");
+		w->clipboard.latin1 = (char *)zdl_malloc(w->clipboard.size + 1);
+		if (w->clipboard.latin1 != NULL) {
+			w->clipboard.latin1_size = zdl_utf8_to_latin1(w->clipboard.latin1,
+					w->clipboard.data, w->clipboard.size);
+			zdl_clipboard_offer(c, "STRING", "STRING");
+		}
+		zdl_clipboard_offer(c, "TEXT", "UTF8_STRING");
+		break;
+	}
+
+	XSetSelectionOwner(w->display, XA_PRIMARY, w->window, CurrentTime);
+}
+
+int zdl_clipboard_write_buffer(zdl_clipboard_t c, enum zdl_clipboard_format format,
+		const void *data, size_t size, zdl_clipboard_release_t release, void *user)
 {
-	if (data->format != ZDL_CLIPBOARD_URI &&
-	    data->format != ZDL_CLIPBOARD_TEXT)
+	zdl_window_t w = c->window;
+
+	if (format != ZDL_CLIPBOARD_URI &&
+	    format != ZDL_CLIPBOARD_TEXT)
 		return -1;
 
-	if (c->window->clipboard.text.text != NULL)
-		free((void *)c->window->clipboard.text.text);
+	zdl_clipboard_disown(w);
 
-	if (data->format == ZDL_CLIPBOARD_URI)
-		c->window->clipboard.text.text = strdup(data->uri.uri);
-	else if (data->format == ZDL_CLIPBOARD_TEXT)
-		c->window->clipboard.text.text = strdup(data->text.text);
+	w->clipboard.data = (const char *)data;
+	w->clipboard.size = size;
+	w->clipboard.release = release;
+	w->clipboard.user = user;
 
-	XSetSelectionOwner(c->window->display, XA_PRIMARY,
-			c->window->window, CurrentTime);
+	zdl_clipboard_own(c, format);
 	return 0;
 }
 
-static unsigned long long zdl_time_ms(void)
+/* upload ARGB8888 pixels into a pixmap requestors can read back */
+static Pixmap zdl_clipboard_pixmap(zdl_window_t w, const unsigned int *pixels,
+		int width, int height)
 {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return (unsigned long long)tv.tv_sec*1000 + tv.tv_usec/1000;
+	Visual *visual = w->visual->visual;
+	unsigned int *tmp = NULL;
+	XImage *image;
+	Pixmap pixmap;
+	GC gc;
+
+	if (w->visual->depth != 24 && w->visual->depth != 32)
+		return None;
+
+	if (visual->red_mask != 0xff0000) {
+		tmp = (unsigned int *)zdl_malloc((size_t)width * height * 4);
+		if (tmp == NULL)
+			return None;
+		zdl_pixel_convert(tmp, width * 4, pixels, width * 4,
+				width, height, ZDL_PIXEL_SWAP_RB);
+		pixels = tmp;
+	}
+
+	image = XCreateImage(w->display, visual, w->visual->depth, ZPixmap, 0,
+			(char *)pixels, width, height, 32, width * 4);
+	if (image == NULL) {
+		zdl_free(tmp);
+		return None;
+	}
+
+	pixmap = XCreatePixmap(w->display, w->window, width, height, w->visual->depth);
+	gc = XCreateGC(w->display, pixmap, 0, NULL);
+	XPutImage(w->display, pixmap, gc, image, 0, 0, 0, 0, width, height);
+	XFreeGC(w->display, gc);
+
+	/* the pixels belong to the caller */
+	image->data = NULL;
+	XDestroyImage(image);
+	zdl_free(tmp);
+	return pixmap;
 }
 
-static int zdl_read_property(zdl_window_t w, Atom property, void **data, int *count)
+static void zdl_clipboard_free(void *user, const void *data)
 {
-	Atom actual_type;
-	int actual_format;
-	unsigned long nitems;
-	unsigned long left;
-	unsigned char *ret = 0;
-	int read_bytes = 1024;
-	int rc;
+	zdl_free((void *)data);
+}
 
-	do {
-		if (ret != 0)
-			XFree(ret);
+int zdl_clipboard_write(zdl_clipboard_t c, const struct zdl_clipboard_data *data)
+{
+	Pixmap pixmap;
+	char *text;
 
-		rc = XGetWindowProperty(w->display, w->window,
-				property, 0, read_bytes, False,
-				AnyPropertyType,
-				&actual_type, &actual_format,
-				&nitems, &left, &ret);
-		if (rc != Success)
+	if (data->format == ZDL_CLIPBOARD_IMAGE) {
+		pixmap = zdl_clipboard_pixmap(c->window, data->image.pixels,
+				data->image.width, data->image.height);
+		if (pixmap == None)
 			return -1;
-		read_bytes <<= 1;
-	} while (left != 0);
+		zdl_clipboard_disown(c->window);
+		c->window->clipboard.pixmap = pixmap;
+		zdl_clipboard_own(c, ZDL_CLIPBOARD_IMAGE);
+		return 0;
+	}
 
-	*count = nitems;
-	*data = (void *)ret;
+	if (data->format == ZDL_CLIPBOARD_URI)
+		text = zdl_strdup(data->uri.uri);
+	else if (data->format == ZDL_CLIPBOARD_TEXT)
+		text = zdl_strdup(data->text.text);
+	else
+		return -1;
+	if (text == NULL)
+		return -1;
 
-	return 0;
+	return zdl_clipboard_write_buffer(c, data->format, text, strlen(text),
+			zdl_clipboard_free, NULL);
 }
 
-int zdl_clipboard_read(zdl_clipboard_t c, struct zdl_clipboard_data *data)
+static Bool wait_for_property_notify(Display *d, XEvent *e, char *arg)
 {
-	Window owner;
-	XEvent event;
-	Atom board_atoms[] = {
-		XA_PRIMARY,
-		XA_SECONDARY,
-		XInternAtom(c->window->display, "CLIPBOARD", False),
-	};
-	Atom xa_targets = XInternAtom(c->window->display, "TARGETS", False);
-	Atom targets[] = {
-		/* text formats */
-		XInternAtom(c->window->display, "UTF8_STRING", False),
-		XInternAtom(c->window->display, "C_STRING", False),
-		XInternAtom(c->window->display, "text/unicode", False),
-		XA_STRING,
-		XInternAtom(c->window->display, "COMPOUND_TEXT", False),
-		XInternAtom(c->window->display, "TEXT", False),
-		/* image formats */
-		XA_PIXMAP,
-		//XA_BITMAP,
-		//XA_DRAWABLE,
-		//XA_WINDOW,
-	};
+	const XPropertyEvent *want = (const XPropertyEvent *)arg;
 
-	unsigned long long start;
-	void *pdata;
-	Atom board;
-	Atom type = 0;
-	int count;
-	int i, j, rc;
+	if (e->type == PropertyNotify &&
+	    e->xproperty.window == want->window &&
+	    e->xproperty.atom == want->atom &&
+	    e->xproperty.state == PropertyNewValue)
+		return True;
+	return False;
+}
 
-	if (c->data != NULL) {
-		free(c->data);
-		c->data = NULL;
-	}
+static int zdl_clipboard_wait(zdl_clipboard_t c, unsigned long long deadline, XEvent *event,
+		Bool (*predicate)(Display *, XEvent *, char *), char *arg)
+{
+	unsigned long long now;
+	struct pollfd pfd;
 
-	for (i = 0; i < sizeof(board_atoms)/sizeof(board_atoms[0]); ++i) {
-		board = board_atoms[i];
-		owner = XGetSelectionOwner(c->window->display, board);
-		if (owner != None)
-			break;
+	pfd.fd = ConnectionNumber(c->window->display);
+	pfd.events = POLLIN;
+
+	XFlush(c->window->display);
+	while (!XCheckIfEvent(c->window->display, event, predicate, arg)) {
+		now = zdl_time_ms();
+		if (now >= deadline)
+			return -1;
+		poll(&pfd, 1, (int)(deadline - now));
 	}
-	if (owner == None)
+	return 0;
+}
+
+/* negotiate a target with the owner and wait for it to be converted */
+static int zdl_clipboard_request(zdl_clipboard_t c, unsigned int formats, Atom board)
+{
+	unsigned long long deadline;
+	struct zdl_sink targets = { 0 };
+	int target = -1;
+	XEvent event;
+	size_t size;
+	Atom type;
+
+	/* an asynchronous read would race us for SelectionNotify */
+	if (c->window->paste.clipboard != NULL)
 		return -1;
 
-	start = zdl_time_ms();
+	deadline = zdl_time_ms() + c->timeout;
 	/* request possible conversion targets */
 	XConvertSelection(c->window->display,
-			board, xa_targets, board,
+			board, c->atoms[ZDL_ATOM_TARGETS], board,
 			c->window->window, CurrentTime);
+	if (zdl_clipboard_wait(c, deadline, &event, wait_for_selection_notify, NULL))
+		return -1;
+	if (event.xselection.property == None)
+		return -1;
 
-	for (;;) {
-		count = 0;
-		pdata = NULL;
-		XFlush(c->window->display);
+	if (zdl_read_property(c->window, board, &type, &targets, &size) == 0)
+		target = zdl_clipboard_pick(c, (Atom *)targets.data,
+				size / sizeof(Atom), formats);
+	zdl_free(targets.data);
+	if (target < 0)
+		return -1;
+
+	/* request actual data */
+	XConvertSelection(c->window->display,
+			board, c->atoms[ZDL_ATOM_TARGET0 + target], board,
+			c->window->window, CurrentTime);
+	if (zdl_clipboard_wait(c, deadline, &event, wait_for_selection_notify, NULL))
+		return -1;
+	if (event.xselection.property == None)
+		return -1;
 
-		do {
-			rc = XCheckIfEvent(c->window->display, &event, wait_for_selection_notify, NULL);
-		} while (rc == False && zdl_time_ms() - start < 100);
+	return target;
+}
 
-		if (rc == False)
-			return -1;
+/* read the converted data, following an INCR transfer if the owner starts one */
+static int zdl_clipboard_receive(zdl_clipboard_t c, Atom property, struct zdl_sink *sink)
+{
+	XPropertyEvent want;
+	XEvent event;
+	size_t size;
+	Atom type;
 
-		if (event.xselection.property == None)
-			return -1;
+	if (zdl_read_property(c->window, property, &type, sink, &size) || type == None)
+		return -1;
+	if (type != c->window->xa_incr)
+		return 0;
 
-		if (zdl_read_property(c->window, board, (void **)&pdata, &count))
+	want.window = c->window->window;
+	want.atom = property;
+	do {
+		if (zdl_clipboard_wait(c, zdl_time_ms() + c->timeout, &event,
+				wait_for_property_notify, (char *)&want))
+			return -1;
+		if (zdl_read_property(c->window, property, &type, sink, &size))
 			return -1;
+	} while (type == None || size != 0);
 
-		if (event.xselection.target != xa_targets)
-			break;
+	return 0;
+}
 
-		for (i = 0; i < sizeof(targets)/sizeof(targets[0]); ++i) {
-			for (j = 0; j < count; ++j) {
-				if (((Atom *)pdata)[j] == targets[i])
-					break;
-			}
-			if (j != count)
-				break;
-		}
+int zdl_clipboard_read(zdl_clipboard_t c, struct zdl_clipboard_data *data)
+{
+	const unsigned int formats =
+		ZDL_CLIPBOARD_MASK(ZDL_CLIPBOARD_TEXT) |
+		ZDL_CLIPBOARD_MASK(ZDL_CLIPBOARD_IMAGE);
+	struct zdl_sink sink = { 0 };
+	struct zdl_selection *sel;
+	void *buffer;
+	int target;
+	int rc;
 
-		XFree(pdata);
-		if (j == count)
-			return -1;
+	zdl_selection_sync(c->window);
+	sel = zdl_selection_owned(c->window);
+	if (sel == NULL)
+		return -1;
 
-		type = targets[i];
-		/* request actual data */
-		XConvertSelection(c->window->display,
-				board, type, board,
-				c->window->window, CurrentTime);
+	if (sel->valid && sel->formats == formats) {
+		*data = sel->data;
+		return 0;
 	}
 
-	switch (type) {
-	case XA_PIXMAP: {
-		unsigned int d0;
-		unsigned int w, h;
-		XImage *image;
-		Window root;
-		int x, y;
-		int d1;
+	target = zdl_clipboard_request(c, formats, sel->atom);
+	if (target < 0)
+		return -1;
 
-		XGetGeometry(c->window->display, ((Pixmap *)pdata)[0],
-				&root, &d1, &d1, &w, &h,
-				&d0, &d0);
-		image = XGetImage(c->window->display, ((Pixmap *)pdata)[0], 0, 0,
-				w, h, AllPlanes, ZPixmap);
-		XFree(pdata);
-		data->format = ZDL_CLIPBOARD_IMAGE;
-		data->image.pixels = (unsigned int *)calloc(4, w * h);
-		if (data->image.pixels == NULL)
-			return -1;
-		data->image.width = w;
-		data->image.height = h;
-		for (i = y = 0; y < h; ++y) {
-			char *line = image->data + y * image->bytes_per_line;
-			for (x = 0; x < w; ++x) {
-				void *pin = line + (x * image->bits_per_pixel) / 8;
-				unsigned int *pixel = (unsigned int *)&data->image.pixels[i++];
-				unsigned int in;
-				switch (image->bits_per_pixel) {
-				case 32:
-				case 24:
-					in = (*(unsigned int *)pin) & 0x00ffffff;
-					*pixel = (0xff << 24) | in;
-					break;
-				case 16:
-					in = *(unsigned short *)pin;
-					*pixel = (0xff << 24) |
-						((in & 0xf100) << 8) |
-						((in & 0x03f0) << 6) |
-						 (in & 0x001f);
-					break;
-				case  8:
-					in = *(unsigned char *)pin;
-					*pixel = (0xff << 24) |
-						 (in << 16) |
-						 (in << 8) |
-						  in;
-					break;
-				default:
-					*pixel = 0;
-					break;
-				}
-				/* bgr -> rgb swap */
-				if (image->blue_mask > image->red_mask) {
-					unsigned int tmp = *pixel;
-					*pixel =  (tmp & (0xff << 24)) |
-						  (tmp & (0xff <<  8)) |
-						 ((tmp & (0xff << 16)) >> 16) |
-						 ((tmp & (0xff <<  0)) << 16);
-				}
-			}
-		}
-		XDestroyImage(image);
-		pdata = (void *)data->image.pixels;
-		} break;
-	case XA_BITMAP:
-	case XA_DRAWABLE:
-	case XA_WINDOW:
-		XFree(pdata);
+	rc = zdl_clipboard_receive(c, sel->atom, &sink);
+	if (rc == 0)
+		rc = zdl_clipboard_convert(c, target, &sink, data, &buffer);
+	if (rc == 0)
+		zdl_selection_store(c->window, sel, formats, data, buffer);
+	zdl_free(sink.data);
+	return rc;
+}
+
+int zdl_clipboard_read_stream(zdl_clipboard_t c, unsigned int formats,
+		zdl_clipboard_chunk_t chunk, void *user, enum zdl_clipboard_format *format)
+{
+	struct zdl_sink sink = { 0 };
+	struct zdl_selection *sel;
+	const char *text;
+	int target;
+
+	/* images arrive as a pixmap, not a byte stream */
+	formats &= ~ZDL_CLIPBOARD_MASK(ZDL_CLIPBOARD_IMAGE);
+
+	zdl_selection_sync(c->window);
+	sel = zdl_selection_owned(c->window);
+	if (sel == NULL)
 		return -1;
-	default:
-		data->format = ZDL_CLIPBOARD_TEXT;
-		data->text.text = strdup((char *)pdata);
-		XFree(pdata);
-		pdata = (void *)data->text.text;
-		break;
+
+	if (sel->valid && (formats & ZDL_CLIPBOARD_MASK(sel->data.format)) &&
+	    (formats & sel->formats) == formats) {
+		text = sel->data.format == ZDL_CLIPBOARD_URI ?
+			sel->data.uri.uri : sel->data.text.text;
+		if (format != NULL)
+			*format = sel->data.format;
+		return chunk(user, text, strlen(text));
+	}
+
+	target = zdl_clipboard_request(c, formats, sel->atom);
+	if (target < 0)
+		return -1;
+
+	if (format != NULL)
+		*format = zdl_clipboard_targets[target].format;
+	sink.chunk = chunk;
+	sink.user = user;
+	return zdl_clipboard_receive(c, sel->atom, &sink);
+}
+
+struct zdl_clipboard_copy {
+	char *buffer;
+	size_t size;
+	size_t length;
+};
+
+static int zdl_clipboard_copy(void *user, const void *data, size_t size)
+{
+	struct zdl_clipboard_copy *cp = (struct zdl_clipboard_copy *)user;
+	size_t n;
+
+	if (cp->length < cp->size) {
+		n = cp->size - cp->length;
+		memcpy(cp->buffer + cp->length, data, n < size ? n : size);
+	}
+	cp->length += size;
+	return 0;
+}
+
+int zdl_clipboard_read_buffer(zdl_clipboard_t c, unsigned int formats,
+		void *buffer, size_t size, size_t *length, enum zdl_clipboard_format *format)
+{
+	struct zdl_clipboard_copy cp;
+
+	cp.buffer = (char *)buffer;
+	cp.size = size;
+	cp.length = 0;
+
+	if (zdl_clipboard_read_stream(c, formats, zdl_clipboard_copy, &cp, format))
+		return -1;
+	if (length != NULL)
+		*length = cp.length;
+	/* leave room for the terminator */
+	if (cp.length >= size)
+		return -1;
+	cp.buffer[cp.length] = '\0';
+	return 0;
+}
+
+int zdl_clipboard_read_async(zdl_clipboard_t c, unsigned int formats)
+{
+	zdl_window_t w = c->window;
+	struct zdl_selection *sel;
+	struct zdl_event ev;
+	Atom board;
+
+	if (w->paste.clipboard != NULL)
+		return -1;
+
+	zdl_selection_sync(w);
+	sel = zdl_selection_owned(w);
+	if (sel == NULL)
+		return -1;
+
+	if (sel->valid && sel->formats == formats) {
+		c->result = sel->data;
+		ev.type = ZDL_EVENT_CLIPBOARD;
+		ev.clipboard.clipboard = c;
+		ev.clipboard.status = 0;
+		ev.clipboard.data = &c->result;
+		return zdl_window_inject_event(w, &ev);
 	}
 
-	c->data = pdata;
+	board = sel->atom;
+	w->paste.clipboard = c;
+	w->paste.board = board;
+	w->paste.formats = formats;
+	w->paste.deadline = zdl_time_ms() + c->timeout;
+	w->paste.incr = 0;
+
+	/* request possible conversion targets */
+	XConvertSelection(w->display,
+			board, c->atoms[ZDL_ATOM_TARGETS], board,
+			w->window, CurrentTime);
+	XFlush(w->display);
 	return 0;
 }